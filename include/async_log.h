@@ -0,0 +1,112 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - ASYNCHRONOUS LOGGING
+ *
+ * Serial output can stall the caller for milliseconds once the UART buffer
+ * fills up. Tasks that must not stall (the protocol task on the radio core)
+ * log through an AsyncLog instead: text is cut into lines and pushed onto a
+ * lock-free queue, and a task on the application core writes them to Serial.
+ * If the queue is full the line is dropped and counted, the caller never
+ * blocks.
+ *
+ * The print/println/printf methods mirror Serial so existing log statements
+ * only need their target changed. One AsyncLog supports a single producer
+ * task.
+ */
+
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include "spsc_queue.h"
+
+const int LOG_LINE_LEN = 112;      // Longer lines are truncated
+const int LOG_QUEUE_LENGTH = 32;   // Lines buffered for the log task
+
+typedef struct {
+  char text[LOG_LINE_LEN];
+} log_line_t;
+
+class AsyncLog {
+ public:
+  AsyncLog() : consumer(NULL), pendingLen(0), drops(0) {}
+
+  // Task that is notified when a line is queued
+  void begin(TaskHandle_t logTask) { consumer = logTask; }
+
+  void print(const char *text) { append(text); }
+  void print(int value) { printf("%d", value); }
+  void print(unsigned int value) { printf("%u", value); }
+  void print(long value) { printf("%ld", value); }
+  void print(unsigned long value) { printf("%lu", value); }
+  void print(const String &text) { append(text.c_str()); }
+  void println() { append("\n"); }
+  template <typename V>
+  void println(const V &value) {
+    print(value);
+    append("\n");
+  }
+
+  void printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    char buffer[LOG_LINE_LEN];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    append(buffer);
+  }
+
+  // Log task side - writes all queued lines, returns true if anything was written
+  bool drain() {
+    log_line_t line;
+    bool wrote = false;
+    while (queue.pop(line)) {
+      Serial.println(line.text);
+      wrote = true;
+    }
+    return wrote;
+  }
+
+  // Producer side - wait (bounded) until the log task has caught up, e.g. before sleep
+  void waitEmpty(unsigned long timeoutMs) {
+    unsigned long start = millis();
+    while (!queue.empty() && millis() - start < timeoutMs) {
+      vTaskDelay(1);
+    }
+  }
+
+  uint32_t dropped() const { return drops; }
+  uint32_t depth() const { return queue.size(); }
+  uint32_t maxDepth() const { return queue.maxDepth(); }
+
+ private:
+  void append(const char *text) {
+    for (; *text; text++) {
+      if (*text == '\n') {
+        commit();
+      } else if (pendingLen < LOG_LINE_LEN - 1) {
+        pending.text[pendingLen++] = *text;
+      }
+    }
+  }
+
+  void commit() {
+    pending.text[pendingLen] = '\0';
+    pendingLen = 0;
+    if (!queue.push(pending)) {
+      drops++;
+      return;
+    }
+    if (consumer != NULL) {
+      xTaskNotifyGive(consumer);
+    }
+  }
+
+  SpscQueue<log_line_t, LOG_QUEUE_LENGTH> queue;
+  TaskHandle_t consumer;
+  log_line_t pending;
+  int pendingLen;
+  uint32_t drops;
+};
+
+#endif // ASYNC_LOG_H
@@ -0,0 +1,31 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - CHANNEL SCAN ORDER
+ *
+ * Order in which the sender sweeps the channels when it has lost the
+ * indicator or is looking for one to pair with. The channel the indicator
+ * was last reached on comes first, then the default channel and the
+ * non-overlapping channels 1, 6 and 11 where installations usually end up,
+ * then the rest in ascending order. Each channel appears once.
+ */
+
+#ifndef CHANNEL_SCAN_H
+#define CHANNEL_SCAN_H
+
+#include <stdint.h>
+#include <string.h>
+
+const int CHANNEL_COUNT = 13;            // Channels the scan covers
+
+inline void channelScanOrder(uint8_t order[CHANNEL_COUNT], uint8_t lastChannel, uint8_t defaultChannel) {
+  const uint8_t preferred[] = {defaultChannel, 1, 6, 11};
+  int count = 0;
+  order[count++] = lastChannel;
+  for (int i = 0; i < (int)sizeof(preferred) + CHANNEL_COUNT; i++) {
+    uint8_t channel = (i < (int)sizeof(preferred)) ? preferred[i] : i - sizeof(preferred) + 1;
+    if (memchr(order, channel, count) == NULL) {
+      order[count++] = channel;
+    }
+  }
+}
+
+#endif // CHANNEL_SCAN_H
@@ -0,0 +1,154 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - CHANNEL QUALITY SURVEY
+ *
+ * Sender and indicator step through every channel together on a fixed
+ * schedule that starts at an agreed time, SURVEY_DWELL_MS per channel.
+ * While the survey runs the device's promiscuous callback passes every
+ * frame on the air to frame(), which counts it along with the noise floor
+ * the receiver reports.
+ * The sender also sends probes to the indicator on each channel and
+ * records which were delivered.
+ *
+ * Channels are ranked by probe delivery first, then by how busy they are
+ * and how noisy. The sender moves the pair only when another channel beats
+ * the current one by a clear margin, so two similar channels don't cause
+ * a switch after every survey.
+ *
+ * frame() runs in the WiFi task and only increments counters of the channel
+ * being surveyed.
+ */
+
+#ifndef CHANNEL_SURVEY_H
+#define CHANNEL_SURVEY_H
+
+#include <Arduino.h>
+#include <esp_wifi.h>
+#include "async_log.h"
+
+const int SURVEY_CHANNELS = 13;
+const uint32_t SURVEY_DWELL_MS = 100;          // Time on each channel
+const uint32_t SURVEY_START_DELAY_MS = 50;     // Between the survey request and the first hop
+const uint32_t SURVEY_DURATION_MS = SURVEY_CHANNELS * SURVEY_DWELL_MS;
+const int SURVEY_SWITCH_MARGIN = 20;           // Score points another channel must be ahead by
+
+typedef struct {
+  uint16_t probesSent;
+  uint16_t probesOk;     // Probes the other side's radio acknowledged
+  uint16_t framesHeard;  // Everything received in promiscuous mode, the other side's replies included
+  int16_t noiseMax;      // Highest noise floor seen (dBm), 0 if nothing was received
+} channel_stats_t;
+
+class ChannelSurvey {
+ public:
+  ChannelSurvey() : running(false), startMs(0), tuned(0) {
+    memset(stats, 0, sizeof(stats));
+  }
+
+  // Start counting, the first channel is due at startAtMs
+  void begin(uint32_t startAtMs) {
+    memset(stats, 0, sizeof(stats));
+    startMs = startAtMs;
+    tuned = 0;
+    running = true;
+  }
+
+  void finish() {
+    tuned = 0;
+    running = false;
+  }
+
+  bool active() const { return running; }
+
+  // Channel the schedule is on at nowMs, 0 before the start or after the end
+  uint8_t channelAt(uint32_t nowMs) const {
+    int32_t elapsed = (int32_t)(nowMs - startMs);
+    if (elapsed < 0 || elapsed >= (int32_t)SURVEY_DURATION_MS) {
+      return 0;
+    }
+    return 1 + elapsed / SURVEY_DWELL_MS;
+  }
+
+  // Milliseconds until the first hop, 0 once the survey has started
+  uint32_t msUntilStart(uint32_t nowMs) const {
+    int32_t elapsed = (int32_t)(nowMs - startMs);
+    return (elapsed < 0) ? -elapsed : 0;
+  }
+
+  // Milliseconds until the schedule moves on from the channel at nowMs
+  uint32_t msUntilNextHop(uint32_t nowMs) const {
+    int32_t elapsed = (int32_t)(nowMs - startMs);
+    if (elapsed < 0) {
+      return -elapsed;
+    }
+    return SURVEY_DWELL_MS - elapsed % SURVEY_DWELL_MS;
+  }
+
+  uint32_t endMs() const { return startMs + SURVEY_DURATION_MS; }
+
+  // The radio is now listening on this channel, frames are counted for it
+  void tunedTo(uint8_t channel) { tuned = channel; }
+
+  void recordProbe(uint8_t channel, bool ok) {
+    if (channel < 1 || channel > SURVEY_CHANNELS) {
+      return;
+    }
+    stats[channel - 1].probesSent++;
+    if (ok) {
+      stats[channel - 1].probesOk++;
+    }
+  }
+
+  // 0..100, higher is better. Channels without probes are rated on traffic and noise only.
+  int score(uint8_t channel) const {
+    const channel_stats_t &s = stats[channel - 1];
+    int delivery = (s.probesSent > 0) ? 100 * s.probesOk / s.probesSent : 100;
+    int busy = min((int)s.framesHeard, 50);                       // Up to 50 points off for traffic
+    int noise = (s.noiseMax < -95 || s.noiseMax == 0) ? 0 : min(s.noiseMax + 95, 20);  // Up to 20 off
+    return max(delivery * 70 / 100 + 30 - busy * 30 / 50 - noise, 0);
+  }
+
+  // Best channel, or home unless another one is ahead by the switch margin
+  uint8_t best(uint8_t home) const {
+    uint8_t bestChannel = home;
+    int bestScore = score(home) + SURVEY_SWITCH_MARGIN;
+    for (uint8_t channel = 1; channel <= SURVEY_CHANNELS; channel++) {
+      if (score(channel) > bestScore) {
+        bestChannel = channel;
+        bestScore = score(channel);
+      }
+    }
+    return bestChannel;
+  }
+
+  void printStats(AsyncLog &log) const {
+    for (uint8_t channel = 1; channel <= SURVEY_CHANNELS; channel++) {
+      const channel_stats_t &s = stats[channel - 1];
+      log.printf("  ch%-2u probes %u/%u frames %u noise %d dBm score %d\n", channel,
+                    s.probesOk, s.probesSent, s.framesHeard, s.noiseMax, score(channel));
+    }
+  }
+
+  // WiFi task: a frame was received in promiscuous mode
+  void frame(const wifi_promiscuous_pkt_t *packet) {
+    uint8_t channel = tuned;
+    if (channel == 0) {
+      return;
+    }
+    channel_stats_t &s = stats[channel - 1];
+    if (s.framesHeard < 0xFFFF) {
+      s.framesHeard++;
+    }
+    int16_t noise = packet->rx_ctrl.noise_floor;
+    if (s.noiseMax == 0 || noise > s.noiseMax) {
+      s.noiseMax = noise;
+    }
+  }
+
+ private:
+  bool running;
+  uint32_t startMs;
+  volatile uint8_t tuned;  // Channel being counted, 0 = none
+  channel_stats_t stats[SURVEY_CHANNELS];
+};
+
+#endif // CHANNEL_SURVEY_H
@@ -0,0 +1,146 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - COMMAND QUEUE
+ *
+ * Desired LED state per indicator, filled by producers and drained by the
+ * protocol task. Every indicator has one slot and a new request replaces a
+ * state that was not delivered yet, so only the latest state goes on the
+ * air: a burst of updates costs one delivery instead of a backlog, and the
+ * time until the indicator shows the newest state stays bounded. The table
+ * holds COMMAND_QUEUE_PEERS indicators and allocates nothing.
+ *
+ * Each accepted state gets a ticket. The protocol task sends the state it
+ * peeked and reports the ticket as delivered once acknowledged, a newer
+ * submit in between keeps the slot pending. submit() is safe from any
+ * task, the other calls belong to the protocol task.
+ */
+
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <Arduino.h>
+
+const uint8_t COMMAND_QUEUE_PEERS = 4;
+const uint8_t COMMAND_NONE = 0xFF;   // No state delivered yet
+
+enum CommandSubmit {
+  COMMAND_QUEUED,       // Will be sent
+  COMMAND_SUPERSEDED,   // Will be sent instead of an undelivered state
+  COMMAND_UNCHANGED,    // Already delivered or already waiting, nothing to do
+  COMMAND_FULL          // No slot left for another indicator
+};
+
+typedef struct {
+  uint8_t mac[6];
+  bool used;
+  uint8_t ledIndex;         // Latest requested state
+  uint8_t deliveredIndex;   // Last acknowledged state, COMMAND_NONE if none
+  uint32_t ticket;          // Bumped by every accepted state
+  uint32_t deliveredTicket;
+} command_slot_t;
+
+class CommandQueue {
+ public:
+  CommandQueue() { memset(slots, 0, sizeof(slots)); }
+
+  CommandSubmit submit(const uint8_t *mac, uint8_t ledIndex) {
+    CommandSubmit result = COMMAND_QUEUED;
+    portENTER_CRITICAL(&lock);
+    command_slot_t *slot = find(mac, true);
+    if (slot == NULL) {
+      result = COMMAND_FULL;
+    } else if (slot->ticket != slot->deliveredTicket) {
+      if (slot->ledIndex == ledIndex) {
+        result = COMMAND_UNCHANGED;
+      } else {
+        result = COMMAND_SUPERSEDED;
+      }
+    } else if (slot->deliveredIndex == ledIndex) {
+      result = COMMAND_UNCHANGED;
+    }
+    if (result == COMMAND_QUEUED || result == COMMAND_SUPERSEDED) {
+      slot->ledIndex = ledIndex;
+      slot->ticket++;
+    }
+    portEXIT_CRITICAL(&lock);
+    return result;
+  }
+
+  // Latest undelivered state for mac and its ticket
+  bool peek(const uint8_t *mac, uint8_t &ledIndex, uint32_t &ticket) {
+    bool found = false;
+    portENTER_CRITICAL(&lock);
+    command_slot_t *slot = find(mac, false);
+    if (slot != NULL && slot->ticket != slot->deliveredTicket) {
+      ledIndex = slot->ledIndex;
+      ticket = slot->ticket;
+      found = true;
+    }
+    portEXIT_CRITICAL(&lock);
+    return found;
+  }
+
+  bool pending(const uint8_t *mac) {
+    uint8_t ledIndex;
+    uint32_t ticket;
+    return peek(mac, ledIndex, ticket);
+  }
+
+  // A newer state arrived since ticket was peeked
+  bool superseded(const uint8_t *mac, uint32_t ticket) {
+    portENTER_CRITICAL(&lock);
+    command_slot_t *slot = find(mac, false);
+    bool newer = (slot != NULL && slot->ticket != ticket);
+    portEXIT_CRITICAL(&lock);
+    return newer;
+  }
+
+  // The state behind ticket was acknowledged, a newer one stays pending
+  void delivered(const uint8_t *mac, uint32_t ticket, uint8_t ledIndex) {
+    portENTER_CRITICAL(&lock);
+    command_slot_t *slot = find(mac, false);
+    if (slot != NULL) {
+      slot->deliveredIndex = ledIndex;
+      if (slot->ticket == ticket) {
+        slot->deliveredTicket = ticket;
+      }
+    }
+    portEXIT_CRITICAL(&lock);
+  }
+
+  // Known state of an indicator after a warm restart, nothing to send
+  void restore(const uint8_t *mac, uint8_t ledIndex) {
+    portENTER_CRITICAL(&lock);
+    command_slot_t *slot = find(mac, true);
+    if (slot != NULL) {
+      slot->ledIndex = ledIndex;
+      slot->deliveredIndex = ledIndex;
+      slot->deliveredTicket = slot->ticket;
+    }
+    portEXIT_CRITICAL(&lock);
+  }
+
+ private:
+  command_slot_t *find(const uint8_t *mac, bool create) {
+    command_slot_t *freeSlot = NULL;
+    for (int i = 0; i < COMMAND_QUEUE_PEERS; i++) {
+      if (slots[i].used && memcmp(slots[i].mac, mac, 6) == 0) {
+        return &slots[i];
+      }
+      if (!slots[i].used && freeSlot == NULL) {
+        freeSlot = &slots[i];
+      }
+    }
+    if (!create || freeSlot == NULL) {
+      return NULL;
+    }
+    memcpy(freeSlot->mac, mac, 6);
+    freeSlot->used = true;
+    freeSlot->deliveredIndex = COMMAND_NONE;
+    return freeSlot;
+  }
+
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  command_slot_t slots[COMMAND_QUEUE_PEERS];
+};
+
+#endif // COMMAND_QUEUE_H
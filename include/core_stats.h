@@ -0,0 +1,64 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - PER-CORE LOAD MEASUREMENT
+ *
+ * Optional measurement mode, enabled with -D CORE_STATS. Each firmware task
+ * wraps the work it does after waking in start()/stop(), and the busy time
+ * is summed per core for a periodic utilization report. This covers the
+ * firmware tasks only, not the WiFi driver. Without CORE_STATS the calls
+ * compile to nothing.
+ */
+
+#ifndef CORE_STATS_H
+#define CORE_STATS_H
+
+#include <Arduino.h>
+
+const unsigned long CORE_STATS_INTERVAL_MS = 5000;  // Report period in measurement mode
+
+class TaskLoad {
+ public:
+  TaskLoad(const char *name, int core) : name(name), core(core), startUs(0), busyUs(0) {}
+
+  void start() {
+#ifdef CORE_STATS
+    startUs = micros();
+#endif
+  }
+
+  void stop() {
+#ifdef CORE_STATS
+    busyUs += micros() - startUs;
+#endif
+  }
+
+  // Busy time since the last call (updates from the owning task may race, which only skews one sample)
+  uint32_t takeBusyUs() {
+    uint32_t value = busyUs;
+    busyUs = 0;
+    return value;
+  }
+
+  const char *name;
+  const int core;
+
+ private:
+  unsigned long startUs;
+  volatile uint32_t busyUs;
+};
+
+inline void printCoreLoad(TaskLoad *const loads[], int count, unsigned long intervalMs) {
+  for (int core = 0; core < 2; core++) {
+    uint32_t busy = 0;
+    Serial.printf("Core %d:", core);
+    for (int i = 0; i < count; i++) {
+      if (loads[i]->core == core) {
+        uint32_t taskBusy = loads[i]->takeBusyUs();
+        busy += taskBusy;
+        Serial.printf(" %s=%.2f%%", loads[i]->name, taskBusy / (intervalMs * 10.0));
+      }
+    }
+    Serial.printf(" total=%.2f%%\n", busy / (intervalMs * 10.0));
+  }
+}
+
+#endif // CORE_STATS_H
@@ -0,0 +1,60 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - LIGHTWEIGHT COROUTINES
+ *
+ * Stackless coroutines in the style of protothreads. A flow is written as
+ * sequential code between CO_BEGIN and CO_END and suspends at CO_AWAIT,
+ * CO_DELAY or CO_YIELD without blocking the task that drives it. Suspending
+ * stores the resume point in a statically allocated co_state_t, and resuming
+ * is a single switch jump, so there is no stack or heap per coroutine.
+ *
+ * Rules that come with the technique:
+ *  - Locals do not survive a suspension, keep such values in statics/globals
+ *  - Only one CO_ macro per source line
+ *  - Don't suspend from inside a nested switch statement
+ */
+
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <Arduino.h>
+
+enum CoStatus {
+  CO_RUNNING,  // Suspended, call again to resume
+  CO_DONE      // Ran to completion, the next call starts over
+};
+
+typedef struct {
+  uint16_t line;        // Resume point, 0 = start
+  unsigned long timer;  // Start of the current CO_DELAY
+} co_state_t;
+
+// Each suspension point sets the resume line and falls into its own case label,
+// the attribute tells -Wimplicit-fallthrough that this is intended
+#define CO_BEGIN(co)      switch ((co).line) { case 0:
+#define CO_END(co)        } (co).line = 0; return CO_DONE
+
+// Suspend until cond is true (cond is re-evaluated on every resume)
+#define CO_AWAIT(co, cond) \
+  do { (co).line = __LINE__; __attribute__((fallthrough)); case __LINE__: if (!(cond)) return CO_RUNNING; } while (0)
+
+// Suspend for at least ms milliseconds
+#define CO_DELAY(co, ms) \
+  do { (co).timer = millis(); (co).line = __LINE__; __attribute__((fallthrough)); case __LINE__: \
+       if (millis() - (co).timer < (unsigned long)(ms)) return CO_RUNNING; } while (0)
+
+// Suspend until cond is true or ms milliseconds have passed, the caller re-checks cond
+#define CO_AWAIT_FOR(co, cond, ms) \
+  do { (co).timer = millis(); (co).line = __LINE__; __attribute__((fallthrough)); case __LINE__: \
+       if (!(cond) && millis() - (co).timer < (unsigned long)(ms)) return CO_RUNNING; } while (0)
+
+// Give control back once, resuming on the next call
+#define CO_YIELD(co) \
+  do { (co).line = __LINE__; return CO_RUNNING; __attribute__((fallthrough)); case __LINE__:; } while (0)
+
+// Leave the flow early, the next call starts over
+#define CO_EXIT(co)       do { (co).line = 0; return CO_DONE; } while (0)
+
+// Abandon a suspended flow from outside
+#define CO_RESET(co)      ((co).line = 0)
+
+#endif // COROUTINE_H
@@ -0,0 +1,141 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - CLOCK DRIFT ESTIMATION
+ *
+ * Every wake hint announces, in the sender's clock, how long until the next
+ * frame. Comparing that against the time between the two frames as measured
+ * locally gives one sample of the relative clock skew, which includes the
+ * error the RTC slow clock adds while the indicator is in light sleep.
+ *
+ * Samples are filtered into a skew estimate and a spread (the typical
+ * latency jitter left after the skew is taken out). Announced times are
+ * converted to local time with the skew, and once a few samples agree the
+ * guard band around a hinted transmission shrinks from the fixed worst case
+ * to a few times the spread. Frames that land far from any announcement
+ * are missed or retried frames and are not used, and an announced frame
+ * that never shows up sends the estimator back to the wide guard until it
+ * has settled again.
+ */
+
+#ifndef DRIFT_ESTIMATOR_H
+#define DRIFT_ESTIMATOR_H
+
+#include <Arduino.h>
+
+const uint32_t DRIFT_DEFAULT_GUARD_MS = 50;     // Fixed margin until the estimate has settled
+const int32_t DRIFT_DEFAULT_PPM = 10000;        // Clock error allowance until then (1%)
+const uint32_t DRIFT_MIN_GUARD_MS = 10;         // Margin that is kept however good the estimate gets
+const int32_t DRIFT_RESIDUAL_PPM = 500;         // Allowance for skew changes between samples
+const uint32_t DRIFT_SPREAD_FACTOR = 3;         // Guard covers this many times the spread
+const int32_t DRIFT_REJECT_PPM = 50000;         // Larger errors are not drift
+const uint32_t DRIFT_MIN_INTERVAL_MS = 1000;    // Shorter intervals are dominated by jitter
+const int DRIFT_FILTER_SHIFT = 3;               // Each sample moves the estimate by 1/8
+const uint16_t DRIFT_SETTLE_SAMPLES = 4;        // Samples needed before the guard shrinks
+
+typedef struct {
+  int32_t skewPpm;     // Local clock rate minus sender clock rate, positive when ours runs fast
+  uint32_t spreadUs;   // Mean deviation of the samples from the skew estimate
+  uint16_t samples;    // Samples taken since the last reset
+} drift_state_t;
+
+class DriftEstimator {
+ public:
+  DriftEstimator() : expecting(false), announcedAt(0), announcedMs(0), rejected(0), missed(0) {
+    reset();
+  }
+
+  void reset() {
+    state.skewPpm = 0;
+    state.spreadUs = 0;
+    state.samples = 0;
+    expecting = false;
+  }
+
+  // Carry the estimate over a warm restart
+  const drift_state_t &save() const { return state; }
+
+  void restore(const drift_state_t &saved) {
+    if (saved.skewPpm > -DRIFT_REJECT_PPM && saved.skewPpm < DRIFT_REJECT_PPM) {
+      state = saved;
+    }
+  }
+
+  // A frame arrived at rxMs (local) announcing the next one etaMs later (sender clock), 0 if none
+  void frame(uint32_t rxMs, uint16_t etaMs) {
+    if (expecting) {
+      sample(rxMs - announcedAt, announcedMs);
+    }
+    expecting = (etaMs != 0);
+    announcedAt = rxMs;
+    announcedMs = etaMs;
+  }
+
+  // The next frame comes from another sender, don't measure it against this announcement
+  void forget() { expecting = false; }
+
+  // The announced frame did not arrive within its guard band, widen the guard again
+  void miss() {
+    expecting = false;
+    if (state.samples > 1) {
+      state.samples = 1;  // Keep the skew, re-learn the spread
+    }
+    missed++;
+  }
+
+  bool settled() const { return state.samples >= DRIFT_SETTLE_SAMPLES; }
+
+  // Sender clock interval in local clock
+  uint32_t toLocalMs(uint32_t senderMs) const {
+    return senderMs + (int32_t)((int64_t)senderMs * state.skewPpm / 1000000);
+  }
+
+  // Margin on either side of a transmission expected untilMs from now
+  uint32_t guardMs(uint32_t untilMs) const {
+    if (!settled()) {
+      return DRIFT_DEFAULT_GUARD_MS + (uint32_t)((uint64_t)untilMs * DRIFT_DEFAULT_PPM / 1000000);
+    }
+    return DRIFT_MIN_GUARD_MS + DRIFT_SPREAD_FACTOR * state.spreadUs / 1000 +
+           (uint32_t)((uint64_t)untilMs * DRIFT_RESIDUAL_PPM / 1000000);
+  }
+
+  void printStats() const {
+    Serial.printf("  Skew: %ld ppm, spread %lu us, %u samples (%s)\n",
+                  (long)state.skewPpm, (unsigned long)state.spreadUs, state.samples,
+                  settled() ? "settled" : "learning");
+    Serial.printf("  Rejected samples: %lu, missed windows: %lu\n",
+                  (unsigned long)rejected, (unsigned long)missed);
+  }
+
+ private:
+  void sample(uint32_t measuredMs, uint32_t expectedMs) {
+    int32_t errorMs = (int32_t)(measuredMs - expectedMs);
+    if (expectedMs < DRIFT_MIN_INTERVAL_MS ||
+        (int64_t)abs(errorMs) * 1000000 > (int64_t)expectedMs * DRIFT_REJECT_PPM) {
+      rejected++;
+      return;
+    }
+
+    int32_t ppm = (int32_t)((int64_t)errorMs * 1000000 / (int32_t)expectedMs);
+    if (state.samples == 0) {
+      state.skewPpm = ppm;
+    } else {
+      // Faster gain for the first samples, then the slower filter
+      int shift = min((int)state.samples, DRIFT_FILTER_SHIFT);
+      // Deviation from the current estimate, expressed as time so jitter is not scaled by the interval
+      int32_t residualUs = (int32_t)((int64_t)(ppm - state.skewPpm) * (int32_t)expectedMs / 1000);
+      state.spreadUs += ((int32_t)abs(residualUs) - (int32_t)state.spreadUs) >> shift;
+      state.skewPpm += (ppm - state.skewPpm) >> shift;
+    }
+    if (state.samples < 0xFFFF) {
+      state.samples++;
+    }
+  }
+
+  drift_state_t state;
+  bool expecting;
+  uint32_t announcedAt;  // Local time the last announcement arrived
+  uint32_t announcedMs;  // What it announced, in sender time
+  uint32_t rejected;
+  uint32_t missed;
+};
+
+#endif // DRIFT_ESTIMATOR_H
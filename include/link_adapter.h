@@ -0,0 +1,205 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - LINK ADAPTATION
+ *
+ * Picks the ESP-NOW PHY rate and TX power from delivery reports and the
+ * signal strength of received frames. Faster rates shorten the airtime of
+ * every frame and lower power saves energy, both cut collisions with
+ * neighbouring pairs. Everything starts at the most robust setting (1 Mbps,
+ * full power).
+ *
+ * Reports are evaluated in windows of LINK_WINDOW frames. After a few good
+ * windows the adapter tries one step: a faster rate first, then lower power,
+ * each only when the received signal leaves enough margin for it. A window
+ * below the target delivery ratio reverts that step and doubles the wait
+ * before the next try. Without a pending step, a bad window (or a run of
+ * failures) raises power, then falls back to slower rates.
+ *
+ * Rate and power are radio-wide settings in this IDF, so the adapter follows
+ * the one link that matters to the device. Callers only report frames the
+ * peer was expected to be listening for, otherwise a sleeping peer would
+ * look like a bad link.
+ */
+
+#ifndef LINK_ADAPTER_H
+#define LINK_ADAPTER_H
+
+#include <Arduino.h>
+#include <esp_wifi.h>
+#include "async_log.h"
+
+const uint8_t LINK_WINDOW = 20;              // Delivery reports per decision
+const int LINK_TARGET_PERCENT = 90;          // Delivery ratio every setting has to hold
+const uint8_t LINK_FAIL_STREAK = 3;          // Consecutive failures that end a window early
+const uint8_t LINK_HOLDOFF_WINDOWS = 3;      // Good windows before the next step up
+const uint8_t LINK_MAX_HOLDOFF_WINDOWS = 48; // Limit for the doubling after failed steps
+const int LINK_RSSI_MARGIN_DB = 10;          // Signal needed above the receiver sensitivity
+const int LINK_RSSI_UNKNOWN = 0;
+
+typedef struct {
+  wifi_phy_rate_t rate;
+  const char *name;
+  int8_t sensitivityDbm;  // Typical ESP32 receiver sensitivity at this rate
+} link_rate_t;
+
+// Most robust first. OFDM rates carry a much shorter preamble than DSSS ones.
+const link_rate_t LINK_RATES[] = {
+  {WIFI_PHY_RATE_1M_L, "1M", -97},
+  {WIFI_PHY_RATE_2M_L, "2M", -94},
+  {WIFI_PHY_RATE_6M, "6M", -92},
+  {WIFI_PHY_RATE_12M, "12M", -88},
+  {WIFI_PHY_RATE_24M, "24M", -83},
+  {WIFI_PHY_RATE_54M, "54M", -74},
+};
+const uint8_t LINK_RATE_COUNT = sizeof(LINK_RATES) / sizeof(LINK_RATES[0]);
+
+// TX power steps in dBm, highest first
+const int8_t LINK_POWERS_DBM[] = {20, 17, 14, 11, 8};
+const uint8_t LINK_POWER_COUNT = sizeof(LINK_POWERS_DBM) / sizeof(LINK_POWERS_DBM[0]);
+
+enum LinkStep {
+  LINK_STEP_NONE,
+  LINK_STEP_RATE_UP,
+  LINK_STEP_POWER_DOWN
+};
+
+class LinkAdapter {
+ public:
+  LinkAdapter(AsyncLog &log)
+      : logger(log), rateIndex(0), powerIndex(0), sent(0), ok(0), failStreak(0),
+        goodWindows(0), holdoff(LINK_HOLDOFF_WINDOWS), pending(LINK_STEP_NONE),
+        rssiAvg(LINK_RSSI_UNKNOWN), steps(0), reverts(0) {}
+
+  // Back to the most robust setting, e.g. when the peer could not be reached at all
+  void reset() {
+    rateIndex = 0;
+    powerIndex = 0;
+    pending = LINK_STEP_NONE;
+    holdoff = LINK_HOLDOFF_WINDOWS;
+    startWindow();
+    goodWindows = 0;
+    apply();
+  }
+
+  // Push the current setting to the radio, needed again after ESP-NOW was reinitialized
+  void apply() {
+    esp_wifi_config_espnow_rate(WIFI_IF_STA, LINK_RATES[rateIndex].rate);
+    esp_wifi_set_max_tx_power(LINK_POWERS_DBM[powerIndex] * 4);  // Units of 0.25 dBm
+  }
+
+  // Signal strength of a frame received from the peer
+  void rssi(int8_t dbm) {
+    // Moving average in 1/16 dB, seeded with the first frame
+    if (rssiAvg == LINK_RSSI_UNKNOWN) {
+      rssiAvg = dbm * 16;
+    } else {
+      rssiAvg += dbm - rssiAvg / 16;
+    }
+  }
+
+  // Delivery report of a frame the peer was listening for
+  void delivered(bool success) {
+    sent++;
+    if (success) {
+      ok++;
+      failStreak = 0;
+    } else {
+      failStreak++;
+    }
+    if (failStreak >= LINK_FAIL_STREAK) {
+      endWindow(false);
+    } else if (sent >= LINK_WINDOW) {
+      endWindow(ok * 100 >= (int)sent * LINK_TARGET_PERCENT);
+    }
+  }
+
+  uint8_t rate() const { return rateIndex; }  // Index into LINK_RATES
+  int8_t powerDbm() const { return LINK_POWERS_DBM[powerIndex]; }
+
+  void printStats() const {
+    Serial.printf("  Rate %s, TX power %d dBm, RSSI %d dBm\n", LINK_RATES[rateIndex].name,
+                  LINK_POWERS_DBM[powerIndex], rssiAvg / 16);
+    Serial.printf("  Window %u/%u delivered, steps %lu, reverted %lu\n", ok, sent,
+                  (unsigned long)steps, (unsigned long)reverts);
+  }
+
+ private:
+  void startWindow() {
+    sent = 0;
+    ok = 0;
+    failStreak = 0;
+  }
+
+  void endWindow(bool good) {
+    startWindow();
+    if (good) {
+      pending = LINK_STEP_NONE;  // The last step held up
+      if (++goodWindows >= holdoff) {
+        goodWindows = 0;
+        stepUp();
+      }
+      return;
+    }
+
+    goodWindows = 0;
+    if (pending == LINK_STEP_RATE_UP) {
+      rateIndex--;
+    } else if (pending == LINK_STEP_POWER_DOWN) {
+      powerIndex--;
+    } else if (powerIndex > 0) {
+      powerIndex--;
+    } else if (rateIndex > 0) {
+      rateIndex--;
+    } else {
+      return;  // Nothing more robust to fall back to
+    }
+    if (pending != LINK_STEP_NONE) {
+      reverts++;
+      holdoff = min(holdoff * 2, (int)LINK_MAX_HOLDOFF_WINDOWS);
+    } else {
+      holdoff = LINK_HOLDOFF_WINDOWS;
+    }
+    pending = LINK_STEP_NONE;
+    changed("Link degraded");
+  }
+
+  void stepUp() {
+    // The signal has to clear the sensitivity of the new setting with some margin
+    int rssi = rssiAvg / 16;
+    bool known = (rssiAvg != LINK_RSSI_UNKNOWN);
+    if (rateIndex + 1 < LINK_RATE_COUNT &&
+        (!known || rssi >= LINK_RATES[rateIndex + 1].sensitivityDbm + LINK_RSSI_MARGIN_DB)) {
+      rateIndex++;
+      pending = LINK_STEP_RATE_UP;
+    } else if (powerIndex + 1 < LINK_POWER_COUNT &&
+               (!known || rssi - (LINK_POWERS_DBM[powerIndex] - LINK_POWERS_DBM[powerIndex + 1]) >=
+                              LINK_RATES[rateIndex].sensitivityDbm + LINK_RSSI_MARGIN_DB)) {
+      powerIndex++;
+      pending = LINK_STEP_POWER_DOWN;
+    } else {
+      return;
+    }
+    steps++;
+    changed("Link trying");
+  }
+
+  void changed(const char *what) {
+    apply();
+    logger.printf("%s: rate %s, TX power %d dBm\n", what, LINK_RATES[rateIndex].name,
+                  LINK_POWERS_DBM[powerIndex]);
+  }
+
+  AsyncLog &logger;
+  uint8_t rateIndex;
+  uint8_t powerIndex;
+  uint8_t sent;
+  uint8_t ok;
+  uint8_t failStreak;
+  uint8_t goodWindows;
+  int holdoff;        // Good windows needed before the next step up
+  LinkStep pending;   // Step taken at the end of the last window, reverted if this one is bad
+  int16_t rssiAvg;    // 1/16 dB, LINK_RSSI_UNKNOWN until a frame was measured
+  uint32_t steps;
+  uint32_t reverts;
+};
+
+#endif // LINK_ADAPTER_H
@@ -0,0 +1,172 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - RECEIVED SIGNAL QUALITY
+ *
+ * The ESP-NOW receive callback of this IDF only gets the sender address and
+ * the payload. The radio runs in promiscuous mode, filtered to management
+ * frames, so every ESP-NOW frame (a vendor-specific action frame) is seen by
+ * the promiscuous callback first, together with its RSSI and channel. The
+ * callback keeps the last few of them, and the receive callback that follows
+ * in the same WiFi task picks the matching one by address.
+ *
+ * Per-peer statistics (moving average, last, min and max RSSI, channel) are
+ * kept in a small fixed table updated from the protocol task. The least
+ * recently heard peer makes room when the table is full.
+ */
+
+#ifndef LINK_QUALITY_H
+#define LINK_QUALITY_H
+
+#include <Arduino.h>
+#include <esp_wifi.h>
+
+const int LINK_QUALITY_PEERS = 8;            // Peers with statistics
+const int LINK_CAPTURE_SLOTS = 4;            // Frames kept for the receive callback
+const uint32_t LINK_CAPTURE_MAX_AGE_MS = 20; // Older captures belong to an earlier frame
+const int LINK_QUALITY_FILTER_SHIFT = 3;     // Each frame moves the average by 1/8
+const int8_t LINK_RSSI_NONE = 0;             // No capture matched the frame
+
+// What the promiscuous callback saw of a frame
+typedef struct {
+  uint8_t mac[6];
+  int8_t rssi;       // dBm
+  uint8_t channel;
+  uint32_t rxMs;     // millis() when captured
+} rx_capture_t;
+
+typedef struct {
+  uint8_t mac[6];
+  int16_t rssiAvg;   // 1/16 dBm
+  int8_t rssiLast;
+  int8_t rssiMin;
+  int8_t rssiMax;
+  uint8_t channel;   // Channel of the last frame
+  uint32_t frames;   // Frames with a capture
+  uint32_t lastMs;   // millis() of the last frame
+} link_quality_t;
+
+class LinkQuality {
+ public:
+  LinkQuality() : next(0), count(0) {
+    memset(captures, 0, sizeof(captures));
+    memset(peers, 0, sizeof(peers));
+  }
+
+  // Start capturing, callback is the device's promiscuous callback that calls capture()
+  void begin(wifi_promiscuous_cb_t callback) {
+    esp_wifi_set_promiscuous_rx_cb(callback);
+    captureAll(false);
+    esp_wifi_set_promiscuous(true);
+  }
+
+  // Let every frame through (channel surveys), otherwise only management frames
+  void captureAll(bool all) {
+    wifi_promiscuous_filter_t filter;
+    filter.filter_mask = all ? WIFI_PROMIS_FILTER_MASK_ALL : WIFI_PROMIS_FILTER_MASK_MGMT;
+    esp_wifi_set_promiscuous_filter(&filter);
+  }
+
+  // WiFi task: remember ESP-NOW frames for the receive callback
+  void capture(const wifi_promiscuous_pkt_t *packet, wifi_promiscuous_pkt_type_t type) {
+    const uint8_t *frame = packet->payload;
+    // Action frame (subtype 13) with the vendor-specific category and Espressif's OUI
+    if (type != WIFI_PKT_MGMT || packet->rx_ctrl.sig_len < 28 || frame[0] != 0xD0 ||
+        frame[24] != 127 || frame[25] != 0x18 || frame[26] != 0xFE || frame[27] != 0x34) {
+      return;
+    }
+    rx_capture_t &slot = captures[next];
+    next = (next + 1) % LINK_CAPTURE_SLOTS;
+    memcpy(slot.mac, frame + 10, 6);  // Transmitter address
+    slot.rssi = packet->rx_ctrl.rssi;
+    slot.channel = packet->rx_ctrl.channel;
+    slot.rxMs = millis();
+  }
+
+  // WiFi task, from the receive callback: the capture of the frame just received from mac
+  bool lookup(const uint8_t *mac, rx_capture_t &out) const {
+    uint32_t nowMs = millis();
+    for (int i = 1; i <= LINK_CAPTURE_SLOTS; i++) {
+      const rx_capture_t &slot = captures[(next + LINK_CAPTURE_SLOTS - i) % LINK_CAPTURE_SLOTS];
+      if (nowMs - slot.rxMs <= LINK_CAPTURE_MAX_AGE_MS && memcmp(slot.mac, mac, 6) == 0) {
+        out = slot;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Protocol task: add a received frame to the peer's statistics
+  void record(const uint8_t *mac, int8_t rssi, uint8_t channel, uint32_t rxMs) {
+    if (rssi == LINK_RSSI_NONE) {
+      return;
+    }
+    link_quality_t *peer = find(mac);
+    if (peer == NULL) {
+      peer = slotFor(mac);
+      peer->rssiAvg = rssi * 16;
+      peer->rssiMin = rssi;
+      peer->rssiMax = rssi;
+    }
+    peer->rssiAvg += (rssi * 16 - peer->rssiAvg) >> LINK_QUALITY_FILTER_SHIFT;
+    peer->rssiLast = rssi;
+    peer->rssiMin = min(peer->rssiMin, rssi);
+    peer->rssiMax = max(peer->rssiMax, rssi);
+    peer->channel = channel;
+    peer->frames++;
+    peer->lastMs = rxMs;
+  }
+
+  link_quality_t *find(const uint8_t *mac) {
+    for (int i = 0; i < count; i++) {
+      if (memcmp(peers[i].mac, mac, 6) == 0) {
+        return &peers[i];
+      }
+    }
+    return NULL;
+  }
+
+  // Average RSSI in dBm, LINK_RSSI_NONE if nothing was heard from mac
+  int8_t averageOf(const uint8_t *mac) {
+    link_quality_t *peer = find(mac);
+    return (peer != NULL) ? peer->rssiAvg / 16 : LINK_RSSI_NONE;
+  }
+
+  int peerCount() const { return count; }
+  const link_quality_t &peer(int index) const { return peers[index]; }
+
+  void printStats() const {
+    for (int i = 0; i < count; i++) {
+      const link_quality_t &p = peers[i];
+      Serial.printf("  %02X:%02X:%02X:%02X:%02X:%02X avg %d dBm (last %d, min %d, max %d) ch%u, %lu frames\n",
+                    p.mac[0], p.mac[1], p.mac[2], p.mac[3], p.mac[4], p.mac[5],
+                    p.rssiAvg / 16, p.rssiLast, p.rssiMin, p.rssiMax, p.channel,
+                    (unsigned long)p.frames);
+    }
+  }
+
+ private:
+  link_quality_t *slotFor(const uint8_t *mac) {
+    int index = count;
+    if (count < LINK_QUALITY_PEERS) {
+      count++;
+    } else {
+      // Replace the peer heard from least recently
+      uint32_t nowMs = millis();
+      index = 0;
+      for (int i = 1; i < count; i++) {
+        if (nowMs - peers[i].lastMs > nowMs - peers[index].lastMs) {
+          index = i;
+        }
+      }
+    }
+    memset(&peers[index], 0, sizeof(link_quality_t));
+    memcpy(peers[index].mac, mac, 6);
+    return &peers[index];
+  }
+
+  rx_capture_t captures[LINK_CAPTURE_SLOTS];  // Ring written by the promiscuous callback
+  int next;
+  link_quality_t peers[LINK_QUALITY_PEERS];
+  int count;
+};
+
+#endif // LINK_QUALITY_H
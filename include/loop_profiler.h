@@ -0,0 +1,180 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - TASK LOOP PROFILER
+ *
+ * Optional measurement mode, enabled with -D LOOP_PROFILE. A task calls
+ * waiting() before it blocks, start() when it wakes, section() whenever it
+ * moves on to another piece of work and stop() before blocking again. Each
+ * iteration's duration and each timed wake's lateness go into histograms of
+ * the metrics registry. Sections keep their own totals, and an iteration
+ * longer than LOOP_STALL_US is charged as a stall to the section that took
+ * most of it. Time spent in light sleep can be left out with pause().
+ * Without LOOP_PROFILE the calls compile to nothing and no metrics are
+ * registered.
+ */
+
+#ifndef LOOP_PROFILER_H
+#define LOOP_PROFILER_H
+
+#include <Arduino.h>
+#include "metrics.h"
+
+const uint32_t LOOP_PROFILE_BOUNDS_US[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000};
+const uint32_t LOOP_STALL_US = 5000;  // Iterations longer than this are stalls
+const int LOOP_MAX_SECTIONS = 12;     // Further section names are counted as "other"
+
+typedef struct {
+  const char *name;
+  uint32_t calls;
+  uint32_t totalUs;
+  uint32_t maxUs;
+  uint32_t stalls;   // Stalling iterations this section took the largest share of
+} loop_section_t;
+
+class LoopProfiler {
+ public:
+  LoopProfiler(const char *task, const char *iterationMetric, const char *latenessMetric)
+      : task(task)
+#ifdef LOOP_PROFILE
+        , iterations(iterationMetric, LOOP_PROFILE_BOUNDS_US), lateness(latenessMetric, LOOP_PROFILE_BOUNDS_US)
+#endif
+  {
+    memset(sections, 0, sizeof(sections));
+    sections[0].name = "other";
+    sectionCount = 1;
+    current = 0;
+    dueUs = 0;
+    timedWait = false;
+    startUs = 0;
+    sectionStartUs = 0;
+    pausedUs = 0;
+    longest = 0;
+    longestUs = 0;
+    worstUs = 0;
+    worstSection = 0;
+  }
+
+  // About to block for at most ticks
+  void waiting(TickType_t ticks) {
+#ifdef LOOP_PROFILE
+    timedWait = (ticks != portMAX_DELAY);
+    dueUs = micros() + ticks * portTICK_PERIOD_MS * 1000;
+#endif
+  }
+
+  // Woke up, timedOut if the wait ran out rather than being ended by work
+  void start(bool timedOut) {
+#ifdef LOOP_PROFILE
+    startUs = micros();
+    if (timedOut && timedWait) {
+      long late = (long)(startUs - dueUs);
+      lateness.record(late > 0 ? late : 0);
+    }
+    sectionStartUs = startUs;
+    pausedUs = 0;
+    current = 0;
+    longest = 0;
+    longestUs = 0;
+#endif
+  }
+
+  // The work from here on belongs to name, a string literal
+  void section(const char *name) {
+#ifdef LOOP_PROFILE
+    closeSection();
+    current = find(name);
+#endif
+  }
+
+  // Leave the time until the next section() out, e.g. light sleep
+  void pause() {
+#ifdef LOOP_PROFILE
+    closeSection();
+    current = -1;
+#endif
+  }
+
+  void stop() {
+#ifdef LOOP_PROFILE
+    closeSection();
+    uint32_t busy = micros() - startUs - pausedUs;
+    iterations.record(busy);
+    if (busy >= LOOP_STALL_US) {
+      sections[longest].stalls++;
+    }
+    if (busy > worstUs) {
+      worstUs = busy;
+      worstSection = longest;
+    }
+#endif
+  }
+
+  // Section totals, the histograms are part of Metric::printAll()
+  void printReport() const {
+#ifdef LOOP_PROFILE
+    Serial.printf("  %s: worst iteration %lu us in %s\n", task, (unsigned long)worstUs,
+                  sections[worstSection].name);
+    for (int i = 0; i < sectionCount; i++) {
+      const loop_section_t &s = sections[i];
+      if (s.totalUs == 0) {
+        continue;  // Never took a measurable time
+      }
+      Serial.printf("    %-14s calls=%lu avg=%luus max=%luus stalls=%lu\n", s.name, (unsigned long)s.calls,
+                    (unsigned long)(s.totalUs / s.calls), (unsigned long)s.maxUs, (unsigned long)s.stalls);
+    }
+#endif
+  }
+
+ private:
+  void closeSection() {
+    uint32_t now = micros();
+    uint32_t elapsed = now - sectionStartUs;
+    sectionStartUs = now;
+    if (current < 0) {
+      pausedUs += elapsed;
+      return;
+    }
+    loop_section_t &s = sections[current];
+    s.calls++;
+    s.totalUs += elapsed;
+    if (elapsed > s.maxUs) {
+      s.maxUs = elapsed;
+    }
+    if (elapsed > longestUs) {
+      longestUs = elapsed;
+      longest = current;
+    }
+  }
+
+  int find(const char *name) {
+    for (int i = 0; i < sectionCount; i++) {
+      if (sections[i].name == name || strcmp(sections[i].name, name) == 0) {
+        return i;
+      }
+    }
+    if (sectionCount == LOOP_MAX_SECTIONS) {
+      return 0;
+    }
+    sections[sectionCount].name = name;
+    return sectionCount++;
+  }
+
+  const char *task;
+#ifdef LOOP_PROFILE
+  MetricHistogram<sizeof(LOOP_PROFILE_BOUNDS_US) / sizeof(LOOP_PROFILE_BOUNDS_US[0])> iterations;
+  MetricHistogram<sizeof(LOOP_PROFILE_BOUNDS_US) / sizeof(LOOP_PROFILE_BOUNDS_US[0])> lateness;
+#endif
+  loop_section_t sections[LOOP_MAX_SECTIONS];
+  int sectionCount;
+  int current;            // Index into sections, -1 while paused
+  uint32_t dueUs;         // When the current wait runs out
+  bool timedWait;
+  uint32_t startUs;
+  uint32_t sectionStartUs;
+  uint32_t pausedUs;
+  int longest;            // Section with the largest share of this iteration
+  uint32_t longestUs;
+  uint32_t worstUs;       // Longest iteration since boot
+  int worstSection;
+};
+
+#endif // LOOP_PROFILER_H
@@ -0,0 +1,155 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - METRICS REGISTRY
+ *
+ * Counters, gauges and fixed-bucket histograms declared as globals next to
+ * the code they measure. Each metric links itself into the registry when it
+ * is constructed, so reports list every metric of the firmware without a
+ * central table, and nothing is allocated.
+ *
+ * Updates are relaxed atomics and safe from any task or from the WiFi
+ * callbacks. Reports read the values one at a time, a report taken while
+ * updates are happening may be off by the updates in flight.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <atomic>
+
+enum MetricKind {
+  METRIC_COUNTER,
+  METRIC_GAUGE,
+  METRIC_HISTOGRAM
+};
+
+class Metric {
+ public:
+  const char *name() const { return metricName; }
+  MetricKind kind() const { return metricKind; }
+  const Metric *next() const { return nextMetric; }
+  static const Metric *first() { return head(); }
+
+  // Counter and gauge value, histograms report their sample count
+  uint32_t value() const { return current.load(std::memory_order_relaxed); }
+
+  // Every registered metric, one per line
+  static void printAll();
+
+ protected:
+  Metric(const char *name, MetricKind kind) : metricName(name), metricKind(kind), nextMetric(NULL), current(0) {
+    // Append so reports keep the declaration order
+    if (tail() == NULL) {
+      head() = this;
+    } else {
+      tail()->nextMetric = this;
+    }
+    tail() = this;
+  }
+
+  const char *metricName;
+  MetricKind metricKind;
+  Metric *nextMetric;
+  std::atomic<uint32_t> current;
+
+ private:
+  static Metric *&head() {
+    static Metric *list = NULL;
+    return list;
+  }
+  static Metric *&tail() {
+    static Metric *last = NULL;
+    return last;
+  }
+};
+
+class MetricCounter : public Metric {
+ public:
+  explicit MetricCounter(const char *name) : Metric(name, METRIC_COUNTER) {}
+
+  void inc(uint32_t amount = 1) { current.fetch_add(amount, std::memory_order_relaxed); }
+};
+
+class MetricGauge : public Metric {
+ public:
+  explicit MetricGauge(const char *name) : Metric(name, METRIC_GAUGE) {}
+
+  void set(uint32_t value) { current.store(value, std::memory_order_relaxed); }
+
+  // Keep the highest value seen
+  void raise(uint32_t value) {
+    uint32_t seen = current.load(std::memory_order_relaxed);
+    while (value > seen && !current.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+  }
+};
+
+// Bucket i counts samples <= bounds[i], the last bucket everything above the last bound
+class MetricHistogramBase : public Metric {
+ public:
+  void record(uint32_t sample) {
+    int bucket = 0;
+    while (bucket < bucketCount - 1 && sample > bounds[bucket]) {
+      bucket++;
+    }
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    current.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(sample, std::memory_order_relaxed);
+    uint32_t seen = largest.load(std::memory_order_relaxed);
+    while (sample > seen && !largest.compare_exchange_weak(seen, sample, std::memory_order_relaxed)) {
+    }
+  }
+
+  int buckets() const { return bucketCount; }
+  uint32_t bound(int bucket) const { return bounds[bucket]; }  // Not valid for the last bucket
+  uint32_t count(int bucket) const { return counts[bucket].load(std::memory_order_relaxed); }
+  uint32_t total() const { return sum.load(std::memory_order_relaxed); }
+  uint32_t peak() const { return largest.load(std::memory_order_relaxed); }
+
+ protected:
+  MetricHistogramBase(const char *name, const uint32_t *bounds, std::atomic<uint32_t> *counts, int bucketCount)
+      : Metric(name, METRIC_HISTOGRAM), bounds(bounds), counts(counts), bucketCount(bucketCount), sum(0), largest(0) {}
+
+ private:
+  const uint32_t *bounds;
+  std::atomic<uint32_t> *counts;
+  int bucketCount;
+  std::atomic<uint32_t> sum;
+  std::atomic<uint32_t> largest;
+};
+
+// N upper bounds give N + 1 buckets
+template <int N>
+class MetricHistogram : public MetricHistogramBase {
+ public:
+  MetricHistogram(const char *name, const uint32_t (&bounds)[N])
+      : MetricHistogramBase(name, bounds, storage, N + 1) {
+    for (int i = 0; i <= N; i++) {
+      storage[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  std::atomic<uint32_t> storage[N + 1];
+};
+
+inline void Metric::printAll() {
+  for (const Metric *metric = first(); metric != NULL; metric = metric->next()) {
+    if (metric->kind() != METRIC_HISTOGRAM) {
+      Serial.printf("  %-20s %lu\n", metric->name(), (unsigned long)metric->value());
+      continue;
+    }
+
+    const MetricHistogramBase *histogram = static_cast<const MetricHistogramBase *>(metric);
+    uint32_t samples = histogram->value();
+    Serial.printf("  %-20s n=%lu avg=%lu max=%lu |", histogram->name(), (unsigned long)samples,
+                  (unsigned long)(samples ? histogram->total() / samples : 0), (unsigned long)histogram->peak());
+    for (int i = 0; i < histogram->buckets() - 1; i++) {
+      Serial.printf(" <=%lu:%lu", (unsigned long)histogram->bound(i), (unsigned long)histogram->count(i));
+    }
+    Serial.printf(" >%lu:%lu\n", (unsigned long)histogram->bound(histogram->buckets() - 2),
+                  (unsigned long)histogram->count(histogram->buckets() - 1));
+  }
+}
+
+#endif // METRICS_H
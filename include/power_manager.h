@@ -0,0 +1,93 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - POWER-MANAGED SLEEP
+ *
+ * Alternative to the manual sleep cycle, enabled with -D POWER_MANAGED_SLEEP.
+ * The ESP-IDF power manager scales the CPU clock down and enters light sleep
+ * by itself whenever every task is blocked, and WiFi modem sleep only powers
+ * the radio for a short listen window in each interval. ESP-NOW stays
+ * initialized throughout, so nothing is torn down or re-registered around a
+ * sleep. stayAwake() keeps the chip and radio fully on, e.g. right after a
+ * command.
+ *
+ * The framework must be built with CONFIG_PM_ENABLE and
+ * CONFIG_FREERTOS_USE_TICKLESS_IDLE, otherwise begin() fails and the caller
+ * keeps its manual mode. Listen windows without an access point need the
+ * connectionless power save API of ESP-IDF 5; on older frameworks the radio
+ * stays on and only the CPU side sleeps. Without POWER_MANAGED_SLEEP every
+ * call compiles to nothing and begin() reports ESP_ERR_NOT_SUPPORTED.
+ */
+
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <esp_pm.h>
+#include <esp_idf_version.h>
+
+const int PM_MAX_FREQ_MHZ = 80;  // Same clock the firmwares run at without power management
+const int PM_MIN_FREQ_MHZ = 40;  // XTAL frequency, the lowest the radio works with
+
+class PowerManager {
+ public:
+  PowerManager() : enabled(false), awake(false), awakeLock(NULL) {}
+
+  // Turn on frequency scaling, automatic light sleep and radio duty cycling.
+  // The radio listens for windowMs out of every intervalMs while no one holds it awake,
+  // a window of 0 leaves it off until stayAwake(true).
+  esp_err_t begin(uint16_t windowMs, uint16_t intervalMs) {
+#ifdef POWER_MANAGED_SLEEP
+    esp_pm_config_esp32_t config = {};
+    config.max_freq_mhz = PM_MAX_FREQ_MHZ;
+    config.min_freq_mhz = PM_MIN_FREQ_MHZ;
+    config.light_sleep_enable = true;
+    esp_err_t result = esp_pm_configure(&config);
+    if (result == ESP_OK) {
+      result = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "awake", &awakeLock);
+    }
+    if (result != ESP_OK) {
+      return result;
+    }
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    esp_now_set_wake_window(windowMs);
+    if (windowMs > 0) {
+      esp_wifi_connectionless_module_set_wake_interval(intervalMs);
+    }
+#endif
+    enabled = true;
+    esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+  }
+
+  bool active() const { return enabled; }
+  bool isAwake() const { return awake; }
+
+  // Hold the chip and radio fully awake, or hand control back to the power manager
+  void stayAwake(bool on) {
+#ifdef POWER_MANAGED_SLEEP
+    if (!enabled || on == awake) {
+      return;
+    }
+    if (on) {
+      esp_pm_lock_acquire(awakeLock);
+      esp_wifi_set_ps(WIFI_PS_NONE);
+    } else {
+      esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+      esp_pm_lock_release(awakeLock);
+    }
+    awake = on;
+#endif
+  }
+
+ private:
+  bool enabled;
+  bool awake;
+  esp_pm_lock_handle_t awakeLock;
+};
+
+#endif // POWER_MANAGER_H
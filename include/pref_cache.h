@@ -0,0 +1,80 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - PREFERENCES WRITE COALESCING
+ *
+ * Flash writes are slow and wear the NVS pages, so values are not written
+ * where they change. Producers mark keys dirty from any task, and the task
+ * that owns the flash collects them at most once per interval. A shadow of
+ * each blob holds what flash currently stores, so a key that was marked
+ * dirty but ends up with the same bytes again costs no write at all. A
+ * flood of frames touching the same key therefore becomes at most one
+ * write per interval.
+ *
+ * The caller passes the time in and nothing here depends on Arduino, so the
+ * coalescing can be tested on the host.
+ */
+
+#ifndef PREF_CACHE_H
+#define PREF_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+class PrefCoalescer {
+ public:
+  explicit PrefCoalescer(uint32_t intervalMs)
+      : intervalMs(intervalMs), dirtyKeys(0), lastFlushMs(0), writeCount(0) {}
+
+  // Safe from any task, keys is a bit mask chosen by the owner
+  void markDirty(uint32_t keys) { dirtyKeys.fetch_or(keys, std::memory_order_relaxed); }
+  bool dirty() const { return dirtyKeys.load(std::memory_order_relaxed) != 0; }
+
+  // Keys to write now, 0 while nothing is dirty or the last flush is too recent
+  uint32_t collect(uint32_t nowMs) {
+    if (!dirty() || nowMs - lastFlushMs < intervalMs) {
+      return 0;
+    }
+    lastFlushMs = nowMs;
+    return dirtyKeys.exchange(0, std::memory_order_relaxed);
+  }
+
+  // Time until collect() can return anything, for tasks that block until then
+  uint32_t msUntilFlush(uint32_t nowMs) const {
+    uint32_t elapsed = nowMs - lastFlushMs;
+    return (elapsed >= intervalMs) ? 0 : intervalMs - elapsed;
+  }
+
+  // The owner wrote a value to flash
+  void wrote() { writeCount++; }
+  uint32_t writes() const { return writeCount; }
+
+ private:
+  uint32_t intervalMs;
+  std::atomic<uint32_t> dirtyKeys;
+  uint32_t lastFlushMs;
+  uint32_t writeCount;
+};
+
+// Copy of a blob as it is stored in flash, up to Capacity bytes
+template <size_t Capacity>
+class PrefShadow {
+ public:
+  PrefShadow() : length(0) {}
+
+  bool differs(const void *value, size_t len) const {
+    return len != length || memcmp(bytes, value, len) != 0;
+  }
+
+  // Flash holds value now, after loading or writing it
+  void stored(const void *value, size_t len) {
+    length = (len < Capacity) ? len : Capacity;
+    memcpy(bytes, value, length);
+  }
+
+ private:
+  uint8_t bytes[Capacity];
+  size_t length;
+};
+
+#endif // PREF_CACHE_H
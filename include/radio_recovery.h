@@ -0,0 +1,180 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - RADIO RECOVERY LADDER
+ *
+ * Non-blocking recovery for ESP-NOW failures. Instead of restarting the
+ * whole chip, recovery escalates one level at a time:
+ *
+ *   1. Retry esp_now_init() after a short deinit
+ *   2. Stop and restart the WiFi driver
+ *   3. Retune the radio by hopping off the channel and back
+ *   4. Reboot (warm state in RTC memory survives this)
+ *
+ * Each level keeps attempt/success counters and timing so the status output
+ * shows how often and how long the radio was down. Progress is logged through
+ * the AsyncLog of the task that drives the recovery.
+ */
+
+#ifndef RADIO_RECOVERY_H
+#define RADIO_RECOVERY_H
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include "async_log.h"
+
+enum RecoveryLevel {
+  RECOVERY_RETRY_INIT,
+  RECOVERY_WIFI_RESET,
+  RECOVERY_CHANNEL_RETUNE,
+  RECOVERY_REBOOT,
+  RECOVERY_LEVEL_COUNT
+};
+
+enum RecoveryStep {
+  RECOVERY_IDLE,
+  RECOVERY_TEARDOWN,
+  RECOVERY_SETTLE,
+  RECOVERY_RETUNE_WAIT,
+  RECOVERY_INIT
+};
+
+typedef struct {
+  uint32_t attempts;        // Times this level was tried
+  uint32_t successes;       // Times this level brought the radio back
+  uint32_t lastDurationMs;  // Downtime of the last recovery that ended here
+  uint32_t maxDurationMs;   // Longest downtime that ended here
+} recovery_level_stats_t;
+
+const int RECOVERY_INIT_RETRIES = 2;        // esp_now_init() retries before escalating
+const int RECOVERY_DEINIT_SETTLE_MS = 10;   // Wait after esp_now_deinit()
+const int RECOVERY_WIFI_SETTLE_MS = 50;     // Wait after restarting the WiFi driver
+const int RECOVERY_RETUNE_SETTLE_MS = 20;   // Wait after each channel change
+
+class RadioRecovery {
+ public:
+  RadioRecovery(uint8_t channel, AsyncLog &log) : channel(channel), logger(log) {}
+
+  void setChannel(uint8_t newChannel) { channel = newChannel; }
+  bool active() const { return step != RECOVERY_IDLE; }
+  const recovery_level_stats_t &stats(RecoveryLevel level) const { return levelStats[level]; }
+
+  // Start recovering after an ESP-NOW error (ignored if already recovering)
+  void begin(esp_err_t error) {
+    if (active()) {
+      return;
+    }
+    logger.printf("Radio recovery started after error %d\n", error);
+    startTime = millis();
+    startLevel(RECOVERY_RETRY_INIT);
+  }
+
+  // Runs one non-blocking step, returns true once ESP-NOW is up again.
+  // The caller is responsible for re-registering callbacks and peers.
+  bool process() {
+    unsigned long currentTime = millis();
+
+    switch (step) {
+      case RECOVERY_IDLE:
+        return false;
+
+      case RECOVERY_TEARDOWN:
+        esp_now_deinit();
+        if (level == RECOVERY_WIFI_RESET) {
+          esp_wifi_stop();
+          esp_wifi_start();
+        }
+        stepTimer = currentTime;
+        step = RECOVERY_SETTLE;
+        break;
+
+      case RECOVERY_SETTLE:
+        if (currentTime - stepTimer >= settleTime()) {
+          if (level == RECOVERY_CHANNEL_RETUNE) {
+            // Move off our channel so setting it again forces a retune
+            esp_wifi_set_channel(channel == 1 ? 2 : 1, WIFI_SECOND_CHAN_NONE);
+          } else if (level == RECOVERY_WIFI_RESET) {
+            WiFi.mode(WIFI_STA);
+          }
+          esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+          stepTimer = currentTime;
+          step = (level == RECOVERY_RETRY_INIT) ? RECOVERY_INIT : RECOVERY_RETUNE_WAIT;
+        }
+        break;
+
+      case RECOVERY_RETUNE_WAIT:
+        if (currentTime - stepTimer >= RECOVERY_RETUNE_SETTLE_MS) {
+          step = RECOVERY_INIT;
+        }
+        break;
+
+      case RECOVERY_INIT:
+        {
+          esp_err_t result = esp_now_init();
+          if (result == ESP_OK) {
+            uint32_t duration = currentTime - startTime;
+            recovery_level_stats_t &s = levelStats[level];
+            s.successes++;
+            s.lastDurationMs = duration;
+            if (duration > s.maxDurationMs) {
+              s.maxDurationMs = duration;
+            }
+            logger.printf("Radio recovered at level %d after %u ms\n", level, duration);
+            step = RECOVERY_IDLE;
+            return true;
+          }
+
+          logger.printf("Recovery level %d failed: %d\n", level, result);
+          if (level == RECOVERY_RETRY_INIT && ++levelRetries < RECOVERY_INIT_RETRIES) {
+            levelStats[level].attempts++;
+            step = RECOVERY_TEARDOWN;
+          } else {
+            startLevel((RecoveryLevel)(level + 1));
+          }
+        }
+        break;
+    }
+
+    return false;
+  }
+
+  void printStats() const {
+    static const char *names[RECOVERY_LEVEL_COUNT] = {"retry init", "wifi reset", "retune", "reboot"};
+    for (int i = 0; i < RECOVERY_LEVEL_COUNT; i++) {
+      const recovery_level_stats_t &s = levelStats[i];
+      Serial.printf("  %-10s attempts=%u ok=%u last=%ums max=%ums\n",
+                    names[i], s.attempts, s.successes, s.lastDurationMs, s.maxDurationMs);
+    }
+  }
+
+ private:
+  void startLevel(RecoveryLevel next) {
+    level = next;
+    levelRetries = 0;
+    levelStats[level].attempts++;
+
+    if (level == RECOVERY_REBOOT) {
+      logger.println("Radio recovery exhausted, restarting");
+      logger.waitEmpty(100);
+      Serial.flush();
+      ESP.restart();
+      return;
+    }
+    step = RECOVERY_TEARDOWN;
+  }
+
+  unsigned long settleTime() const {
+    return (level == RECOVERY_WIFI_RESET) ? RECOVERY_WIFI_SETTLE_MS : RECOVERY_DEINIT_SETTLE_MS;
+  }
+
+  uint8_t channel;
+  AsyncLog &logger;
+  RecoveryStep step = RECOVERY_IDLE;
+  RecoveryLevel level = RECOVERY_RETRY_INIT;
+  int levelRetries = 0;
+  unsigned long startTime = 0;
+  unsigned long stepTimer = 0;
+  recovery_level_stats_t levelStats[RECOVERY_LEVEL_COUNT] = {};
+};
+
+#endif // RADIO_RECOVERY_H
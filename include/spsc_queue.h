@@ -0,0 +1,67 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - LOCK-FREE SPSC QUEUE
+ *
+ * Fixed-size single-producer/single-consumer ring buffer used to pass work
+ * between tasks pinned to different cores without taking a lock. Exactly one
+ * task may push and exactly one task may pop. The capacity must be a power
+ * of two; no memory is allocated.
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+
+template <typename T, uint32_t N>
+class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+ public:
+  SpscQueue() : head(0), tail(0), highWater(0) {}
+
+  // Producer side - returns false if the queue is full
+  bool push(const T &item) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    uint32_t t = tail.load(std::memory_order_acquire);
+    if (h - t >= N) {
+      return false;
+    }
+    items[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+
+    uint32_t depth = h + 1 - t;
+    if (depth > highWater.load(std::memory_order_relaxed)) {
+      highWater.store(depth, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  // Consumer side - returns false if the queue is empty
+  bool pop(T &item) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t h = head.load(std::memory_order_acquire);
+    if (h == t) {
+      return false;
+    }
+    item = items[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Safe to call from either side, the result may be stale by the time it is used
+  uint32_t size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+  uint32_t maxDepth() const { return highWater.load(std::memory_order_relaxed); }
+  static uint32_t capacity() { return N; }
+
+ private:
+  T items[N];
+  std::atomic<uint32_t> head;       // Written by the producer only
+  std::atomic<uint32_t> tail;       // Written by the consumer only
+  std::atomic<uint32_t> highWater;  // Deepest the queue has been
+};
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,125 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - STATE TRANSITION TRACE
+ *
+ * Optional measurement mode, enabled with -D STATE_TRACE. The protocol state
+ * machines keep their phase in TracedState variables, which record every
+ * change (machine, old state, new state, time and CPU cycle count) into a
+ * small ring buffer. The application task prints new entries to the serial
+ * log, and tools/trace_to_perfetto.py turns a captured log into a timeline
+ * for ui.perfetto.dev or chrome://tracing. Without STATE_TRACE the variables
+ * behave like the plain enums and nothing is recorded.
+ *
+ * Line format: "TRC <seq> <micros> <ccount> <core> <machine> <from> <to>"
+ *
+ * The ring keeps the newest TRACE_CAPACITY transitions, a gap in <seq> means
+ * older ones were overwritten before they were printed, and <seq> starting
+ * over means a reboot. CCOUNT stops in light sleep and follows the CPU
+ * frequency, so the timeline runs on micros() and the cycle count resolves
+ * transitions that follow each other closely on one core.
+ */
+
+#ifndef STATE_TRACE_H
+#define STATE_TRACE_H
+
+#include <Arduino.h>
+
+const uint32_t TRACE_CAPACITY = 128;                 // Transitions kept, power of two
+const unsigned long TRACE_DUMP_INTERVAL_MS = 1000;   // Longest wait before new entries are printed
+
+// Names of one state machine, indexed by its enum
+typedef struct {
+  const char *name;
+  const char *const *states;
+  uint8_t count;
+} trace_machine_t;
+
+typedef struct {
+  const trace_machine_t *machine;
+  uint32_t us;       // micros()
+  uint32_t cycles;   // CCOUNT of the recording core
+  uint8_t from;
+  uint8_t to;
+  uint8_t core;
+} trace_event_t;
+
+class StateTrace {
+ public:
+  StateTrace() : written(0), printed(0) {}
+
+  // Safe from any task
+  void record(const trace_machine_t *machine, int from, int to) {
+#ifdef STATE_TRACE
+    trace_event_t event;
+    event.machine = machine;
+    event.us = micros();
+    event.cycles = ESP.getCycleCount();
+    event.from = from;
+    event.to = to;
+    event.core = xPortGetCoreID();
+    portENTER_CRITICAL(&lock);
+    events[written % TRACE_CAPACITY] = event;
+    written++;
+    portEXIT_CRITICAL(&lock);
+#endif
+  }
+
+  // Print the transitions recorded since the last call, from one task only
+  void dump() {
+#ifdef STATE_TRACE
+    for (;;) {
+      portENTER_CRITICAL(&lock);
+      if (printed == written) {
+        portEXIT_CRITICAL(&lock);
+        return;
+      }
+      if (written - printed > TRACE_CAPACITY) {
+        printed = written - TRACE_CAPACITY;  // Overwritten, the sequence gap shows it
+      }
+      uint32_t seq = printed++;
+      trace_event_t event = events[seq % TRACE_CAPACITY];
+      portEXIT_CRITICAL(&lock);
+
+      Serial.printf("TRC %lu %lu %lu %u %s %s %s\n", (unsigned long)seq, (unsigned long)event.us,
+                    (unsigned long)event.cycles, event.core, event.machine->name,
+                    stateName(event.machine, event.from), stateName(event.machine, event.to));
+    }
+#endif
+  }
+
+ private:
+  static const char *stateName(const trace_machine_t *machine, uint8_t state) {
+    return (state < machine->count) ? machine->states[state] : "?";
+  }
+
+  uint32_t written;
+  uint32_t printed;
+#ifdef STATE_TRACE
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  trace_event_t events[TRACE_CAPACITY];
+#endif
+};
+
+// State variable that records its changes, reads and assignments work like the enum itself
+template <typename State>
+class TracedState {
+ public:
+  TracedState(StateTrace &trace, const trace_machine_t &machine, State initial)
+      : trace(trace), machine(machine), state(initial) {}
+
+  TracedState &operator=(State next) {
+    if (next != state) {
+      trace.record(&machine, state, next);
+    }
+    state = next;
+    return *this;
+  }
+
+  operator State() const { return state; }
+
+ private:
+  StateTrace &trace;
+  const trace_machine_t &machine;
+  State state;
+};
+
+#endif // STATE_TRACE_H
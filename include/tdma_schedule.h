@@ -0,0 +1,197 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - TIME-SLOTTED TRANSMISSION SCHEDULE
+ *
+ * Optional mode for large installations, enabled with -D TDMA_SLOTS. Time
+ * is divided into frames of TDMA_SLOT_COUNT slots. Each indicator owns one
+ * slot and its sender only talks to it inside that slot, so the exchanges
+ * of different pairs don't overlap on the shared channel. Wake hints point
+ * at the slot, which is how indicators follow the schedule without knowing
+ * their slot number.
+ *
+ * Slot 0 carries beacons. A beacon states when the sender's next frame
+ * starts and which slot it uses. Senders adopt the frame timing of any
+ * sender with a lower MAC address, so the timing of the lowest address
+ * spreads through the installation, and move their indicator to the next
+ * free slot when a lower address already uses theirs.
+ *
+ * The schedule holds TDMA_SLOT_COUNT - 1 pairs. Each sender remembers the
+ * slots the beacons of lower addresses carried over the last two claim
+ * windows. When those cover every slot, its pair gives up its slot and
+ * beacons TDMA_NO_SLOT, and every sender that hears it stops using slots
+ * and sends whenever its own timers say, as without TDMA_SLOTS. Slot
+ * assignment goes on meanwhile, a pair without a slot takes one that no
+ * beacon claimed for TDMA_REJOIN_MS, and once no beacon went without a slot
+ * for TDMA_REJOIN_MS the slots are used again. Pairs sharing slots would
+ * keep pushing each other along, and a fleet that only partly uses slots
+ * collides more often than one without them (see test/test_tdma_sim).
+ *
+ * Without TDMA_SLOTS the schedule is inactive and nextSlot() just adds
+ * the interval, as it does for TDMA_NO_SLOT, so callers need no separate
+ * code path.
+ */
+
+#ifndef TDMA_SCHEDULE_H
+#define TDMA_SCHEDULE_H
+
+#include <Arduino.h>
+#include <string.h>
+
+const uint32_t TDMA_SLOT_MS = 20;                 // One command and its acknowledgment
+const uint8_t TDMA_SLOT_COUNT = 100;              // Slots per frame
+const uint32_t TDMA_FRAME_MS = TDMA_SLOT_MS * TDMA_SLOT_COUNT;
+const uint8_t TDMA_BEACON_SLOT = 0;               // Reserved for beacons
+const uint8_t TDMA_NO_SLOT = 0xFF;
+const uint32_t TDMA_BEACON_INTERVAL_MS = 10000;   // Beacon spacing (rounded to whole frames)
+const int TDMA_SLOT_RETRIES = 2;                  // Retries kept in the slot before assuming the indicator lost it
+const int32_t TDMA_ALIGN_TOLERANCE_MS = 2;        // Beacon timing differences up to this are airtime, not offset
+const uint32_t TDMA_CLAIM_WINDOW_MS = TDMA_BEACON_INTERVAL_MS + TDMA_FRAME_MS;  // Holds a beacon from every sender
+const uint32_t TDMA_REJOIN_MS = 60000;            // Without a slot, look for a free one this often
+
+class TdmaSchedule {
+ public:
+  TdmaSchedule()
+      : enabled(false), exhausted(false), epoch(0), claimStart(0), releasedAt(0), exhaustedAt(0),
+        releasedSlot(TDMA_NO_SLOT) {
+    memset(claims, 0, sizeof(claims));
+  }
+
+  // Start our own frame timing now, until a beacon says otherwise
+  void begin(uint32_t nowMs) {
+#ifdef TDMA_SLOTS
+    enabled = true;
+    epoch = nowMs;
+    claimStart = nowMs;
+#endif
+  }
+
+  bool active() const { return enabled; }
+
+  // A beacon without a slot says some pair found them all taken. Until none
+  // has said so for TDMA_REJOIN_MS, nobody sends in their slot.
+  void slotsExhausted(uint32_t nowMs) {
+    exhausted = true;
+    exhaustedAt = nowMs;
+  }
+
+  bool crowded(uint32_t nowMs) const {
+    return exhausted && nowMs - exhaustedAt < TDMA_REJOIN_MS;
+  }
+
+  // Slot a MAC address maps to, never the beacon slot
+  static uint8_t preferredSlot(const uint8_t *mac) {
+    uint32_t hash = 2166136261UL;  // FNV-1a over the whole address
+    for (int i = 0; i < 6; i++) {
+      hash = (hash ^ mac[i]) * 16777619UL;
+    }
+    return 1 + hash % (TDMA_SLOT_COUNT - 1);
+  }
+
+  // Next candidate when a slot turns out to be taken
+  static uint8_t followingSlot(uint8_t slot) {
+    return (slot + 1 < TDMA_SLOT_COUNT) ? slot + 1 : 1;
+  }
+
+  // A beacon from a lower address carried beaconSlot. Returns the slot for our
+  // indicator: ourSlot while nobody else uses it, otherwise the next slot no
+  // lower address claims, or TDMA_NO_SLOT when they claim every slot.
+  uint8_t slotAfterBeacon(uint8_t beaconSlot, uint8_t ourSlot, uint32_t nowMs) {
+    if (nowMs - claimStart >= TDMA_CLAIM_WINDOW_MS) {
+      bool recent = nowMs - claimStart < 2 * TDMA_CLAIM_WINDOW_MS;
+      for (size_t i = 0; i < CLAIM_WORDS; i++) {
+        claims[1][i] = recent ? claims[0][i] : 0;
+        claims[0][i] = 0;
+      }
+      claimStart = nowMs;
+    }
+    if (beaconSlot != TDMA_BEACON_SLOT && beaconSlot < TDMA_SLOT_COUNT) {
+      claims[0][beaconSlot / 32] |= 1UL << (beaconSlot % 32);
+      claims[2][beaconSlot / 32] |= 1UL << (beaconSlot % 32);
+    }
+
+    if (ourSlot == TDMA_NO_SLOT) {
+      // Never had a slot (not paired yet), or take one that no beacon claimed since we gave ours up.
+      // The recent windows alone would show the slots of senders whose last beacons we missed.
+      if (releasedSlot == TDMA_NO_SLOT || nowMs - releasedAt < TDMA_REJOIN_MS) {
+        return TDMA_NO_SLOT;
+      }
+      return freeSlotFrom(releasedSlot, 2, 2, nowMs);
+    } else if (ourSlot != beaconSlot) {
+      return ourSlot;
+    }
+    return freeSlotFrom(followingSlot(ourSlot), 0, 1, nowMs);
+  }
+
+  // Adopt another sender's timing, a frame starts at frameStartMs
+  void align(uint32_t frameStartMs) {
+    epoch = frameStartMs;
+  }
+
+  // Offset of our frame timing from frameStartMs, in -FRAME/2..FRAME/2
+  int32_t offsetFrom(uint32_t frameStartMs) {
+    int32_t diff = (int32_t)(phase(frameStartMs, 0) % TDMA_FRAME_MS);
+    return (diff > (int32_t)TDMA_FRAME_MS / 2) ? diff - (int32_t)TDMA_FRAME_MS : diff;
+  }
+
+  // millis() at the start of the slot occurrence closest to fromMs + intervalMs,
+  // at least one slot after fromMs. Inactive or crowded schedules and TDMA_NO_SLOT
+  // return fromMs + intervalMs, beacons keep their slot.
+  uint32_t nextSlot(uint8_t slot, uint32_t fromMs, uint32_t intervalMs) {
+    uint32_t target = fromMs + intervalMs;
+    if (!enabled || slot == TDMA_NO_SLOT || (slot != TDMA_BEACON_SLOT && crowded(fromMs))) {
+      return target;
+    }
+
+    uint32_t into = phase(target, slot);
+    uint32_t start = (into < TDMA_FRAME_MS / 2) ? target - into : target + (TDMA_FRAME_MS - into);
+    if ((int32_t)(start - fromMs) < (int32_t)TDMA_SLOT_MS) {
+      start += TDMA_FRAME_MS;
+    }
+    return start;
+  }
+
+ private:
+  // First slot from from on that is in none of claims[first..last], otherwise
+  // TDMA_NO_SLOT and the search starts over from an empty record
+  uint8_t freeSlotFrom(uint8_t from, int first, int last, uint32_t nowMs) {
+    uint8_t slot = from;
+    do {
+      bool claimed = false;
+      for (int i = first; i <= last; i++) {
+        claimed = claimed || (claims[i][slot / 32] & (1UL << (slot % 32)));
+      }
+      if (!claimed) {
+        return slot;
+      }
+      slot = followingSlot(slot);
+    } while (slot != from);
+    memset(claims[2], 0, sizeof(claims[2]));
+    releasedAt = nowMs;
+    releasedSlot = from;
+    slotsExhausted(nowMs);
+    return TDMA_NO_SLOT;
+  }
+
+  // Time since the start of the slot's last occurrence, 0..FRAME-1
+  uint32_t phase(uint32_t timeMs, uint8_t slot) {
+    // Keep the epoch within a frame of the present so the difference never wraps
+    if ((int32_t)(timeMs - epoch) > (int32_t)TDMA_FRAME_MS) {
+      epoch += (timeMs - epoch) / TDMA_FRAME_MS * TDMA_FRAME_MS;
+    }
+    int32_t diff = (int32_t)(timeMs - epoch - slot * TDMA_SLOT_MS) % (int32_t)TDMA_FRAME_MS;
+    return (diff < 0) ? diff + TDMA_FRAME_MS : diff;
+  }
+
+  static const size_t CLAIM_WORDS = (TDMA_SLOT_COUNT + 31) / 32;
+
+  bool enabled;
+  bool exhausted;  // Some pair found no free slot, at exhaustedAt
+  uint32_t epoch;  // millis() at the start of some frame
+  uint32_t claims[3][CLAIM_WORDS];  // Slots of lower addresses: this and the previous claim window,
+                                    // and everything since releasedAt
+  uint32_t claimStart;  // millis() at the start of the current claim window
+  uint32_t releasedAt;  // Last time we found every slot taken
+  uint32_t exhaustedAt;
+  uint8_t releasedSlot;  // Slot given up then, the search for a free one starts there
+};
+
+#endif // TDMA_SCHEDULE_H
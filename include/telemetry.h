@@ -0,0 +1,100 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - TELEMETRY RECORD
+ *
+ * Compact binary status of an indicator. Indicators send it to their sender
+ * over ESP-NOW now and then, right after an acknowledgment got through
+ * (the sender is listening then). The sender writes every record it gets to
+ * its serial log as one text line, so a single USB cable on a sender
+ * collects the telemetry of every indicator that talks to it. Indicators
+ * built with -D TELEMETRY_SERIAL print the same line instead of the text
+ * status dump.
+ *
+ * Line format: "TLM <indicator MAC, 12 hex digits> <record, 2 hex digits per byte>"
+ *
+ * tools/telemetry_decode.py mirrors the layout below, bump TELEMETRY_VERSION
+ * and update the decoder together with it.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include <stddef.h>
+
+const uint8_t TELEMETRY_VERSION = 2;
+const uint8_t TELEMETRY_TYPE = 8;       // Message type, first byte like every other frame
+
+enum TelemetryFlag {
+  TELEMETRY_POWER_MANAGED = 1 << 0,     // Sleeping through the power manager instead of manual cycles
+  TELEMETRY_EXTENDED_AWAKE = 1 << 1,    // In a forced extended awake period
+  TELEMETRY_WARM_RESTART = 1 << 2,      // Booted from RTC state
+  TELEMETRY_DRIFT_SETTLED = 1 << 3,     // Wake hint guard band narrowed by the drift estimate
+  TELEMETRY_LOCAL = 1 << 4              // Printed on the indicator's serial port, numbered separately
+};
+
+typedef struct __attribute__((packed)) {
+  uint8_t type;            // TELEMETRY_TYPE
+  uint8_t version;         // TELEMETRY_VERSION
+  uint16_t sequence;       // Per boot, gaps are lost records (radio and local records count separately)
+  uint32_t uptimeS;
+  int8_t activeLed;        // -1 if none
+  uint8_t channel;
+  uint8_t flags;           // TelemetryFlag
+  uint8_t peerCount;
+  uint16_t sleepCycles;    // Manual sleep cycles since boot
+  uint16_t lastCommandS;   // Seconds since the last command
+  uint16_t rxFrames;       // Frames received from all peers
+  uint16_t txOk;           // Frames delivered to all peers
+  uint16_t txFail;
+  uint16_t queueDrops;     // Radio and log queues together
+  uint16_t prefWrites;     // Flash writes since boot
+  uint16_t recoveries;     // Radio recovery attempts since boot
+  int8_t rssiAvg;          // From the sender, 0 if unknown
+  int8_t rssiMin;
+  uint8_t phyRate;         // Index into LINK_RATES
+  int8_t txPowerDbm;
+  int16_t skewPpm;         // Clock skew against the sender
+  uint16_t duplicates;     // Commands repeating the active LED (lost acknowledgments)
+  uint16_t txErrors;       // esp_now_send() calls that failed
+  uint16_t peerAddFails;
+  uint16_t initFails;      // esp_now_init() failures
+} telemetry_t;
+
+// Length of a record of the given version, 0 if unknown. Older indicators keep
+// sending their version until updated, every version extends the previous one.
+inline size_t telemetryLength(uint8_t version) {
+  switch (version) {
+    case 1: return offsetof(telemetry_t, duplicates);
+    case 2: return sizeof(telemetry_t);
+    default: return 0;
+  }
+}
+
+// Counters are 16 bits on the air and stop at the top instead of wrapping
+inline uint16_t telemetryCount(uint32_t value) {
+  return (value > 0xFFFF) ? 0xFFFF : value;
+}
+
+// One log line for a record received from (or sent by) mac, out needs TELEMETRY_LINE_LEN bytes.
+// len is the length of the record's version, older records are shorter.
+const size_t TELEMETRY_LINE_LEN = 4 + 12 + 1 + 2 * sizeof(telemetry_t) + 1;
+
+inline void formatTelemetry(const uint8_t *mac, const telemetry_t &record, char *out,
+                            size_t len = sizeof(telemetry_t)) {
+  static const char digits[] = "0123456789ABCDEF";
+  memcpy(out, "TLM ", 4);
+  out += 4;
+  for (int i = 0; i < 6; i++) {
+    *out++ = digits[mac[i] >> 4];
+    *out++ = digits[mac[i] & 0x0F];
+  }
+  *out++ = ' ';
+  const uint8_t *bytes = (const uint8_t *)&record;
+  for (size_t i = 0; i < len; i++) {
+    *out++ = digits[bytes[i] >> 4];
+    *out++ = digits[bytes[i] & 0x0F];
+  }
+  *out = '\0';
+}
+
+#endif // TELEMETRY_H
@@ -0,0 +1,287 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - HIERARCHICAL TIMER WHEEL
+ *
+ * Keeps every deadline of a task in one place instead of timestamps that
+ * are compared against millis() on each pass. Timers are list nodes owned
+ * by the caller, so arming and cancelling are O(1) and the wheel never
+ * allocates, however many timers a fleet needs.
+ *
+ * Three levels of 64 slots at 1 ms, 64 ms and 4096 ms resolution cover
+ * about 262 s. Timers move down a level as their expiry comes closer, and
+ * longer timers wait on an overflow list that is re-filed whenever the top
+ * level moves on, so everything on the list is due after everything on the
+ * wheel. Per-level occupancy bitmaps let advance() skip empty slots and let
+ * nextExpiry() find the earliest deadline from the first occupied slot of
+ * each level, so the owning task can block until exactly that time.
+ *
+ * A wheel is not thread safe, it belongs to the task that advances it.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <Arduino.h>
+
+const int TIMER_WHEEL_BITS = 6;                          // 64 slots per level, one bit each in a uint64_t
+const int TIMER_WHEEL_SLOTS = 1 << TIMER_WHEEL_BITS;
+const uint32_t TIMER_WHEEL_MASK = TIMER_WHEEL_SLOTS - 1;
+const int TIMER_WHEEL_LEVELS = 3;
+const int TIMER_WHEEL_OVERFLOW = TIMER_WHEEL_LEVELS;  // Level number of timers beyond the wheel
+
+class TimerWheel;
+
+class WheelTimer {
+ public:
+  typedef void (*Callback)(WheelTimer &timer, void *arg);
+
+  // Without a callback, owners check pending() after TimerWheel::advance()
+  WheelTimer(Callback callback = NULL, void *arg = NULL)
+      : callback(callback), arg(arg), next(NULL), prev(NULL), expires(0),
+        level(0), slot(0), armed(false) {}
+
+  bool pending() const { return armed; }
+  uint32_t expiry() const { return expires; }
+
+ private:
+  friend class TimerWheel;
+
+  Callback callback;
+  void *arg;
+  WheelTimer *next;
+  WheelTimer *prev;
+  uint32_t expires;  // millis() value the timer fires at
+  uint8_t level;
+  uint8_t slot;
+  bool armed;
+};
+
+class TimerWheel {
+ public:
+  TimerWheel() : overflow(NULL), current(0), started(false), count(0) {
+    memset(slots, 0, sizeof(slots));
+    memset(occupied, 0, sizeof(occupied));
+  }
+
+  // (Re)arm a timer to fire delayMs from now
+  void arm(WheelTimer &timer, uint32_t delayMs) {
+    uint32_t nowMs = millis();
+    start(nowMs);
+    if (timer.armed) {
+      unlink(timer);
+    } else {
+      count++;
+    }
+    timer.expires = nowMs + delayMs;
+    if (timer.expires == current) {
+      timer.expires++;  // This tick was already processed, fire on the next one
+    }
+    insert(timer);
+  }
+
+  void cancel(WheelTimer &timer) {
+    if (timer.armed) {
+      unlink(timer);
+      count--;
+    }
+  }
+
+  // Fire every timer that is due, call this before looking at timer state
+  void advance() {
+    uint32_t nowMs = millis();
+    start(nowMs);
+
+    while (current != nowMs) {
+      // Jump straight to the next occupied slot or level boundary, whichever is first
+      uint32_t slot = current & TIMER_WHEEL_MASK;
+      uint32_t step = TIMER_WHEEL_SLOTS - slot;
+      uint32_t busy = distanceToNext(occupied[0], slot);
+      if (busy != 0 && busy < step) {
+        step = busy;
+      }
+      if (step > nowMs - current) {
+        step = nowMs - current;
+      }
+      current += step;
+
+      if ((current & TIMER_WHEEL_MASK) == 0) {
+        // Higher levels first, so their timers can drop all the way down
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+          if (isBoundary(level)) {
+            cascade(level);
+          }
+        }
+        if (isBoundary(TIMER_WHEEL_LEVELS - 1)) {
+          refileOverflow();
+        }
+      }
+      expire(current & TIMER_WHEEL_MASK);
+    }
+  }
+
+  // Earliest expiry of all armed timers, false if none are armed
+  bool nextExpiry(uint32_t &expires) const {
+    bool found = false;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+      uint32_t base = (current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+      uint32_t distance = distanceToNext(occupied[level], base);
+      if (distance == 0) {
+        continue;
+      }
+      // The first occupied slot after the current one holds this level's earliest timers
+      for (const WheelTimer *t = slots[level][(base + distance) & TIMER_WHEEL_MASK]; t != NULL; t = t->next) {
+        if (!found || (int32_t)(t->expires - expires) < 0) {
+          expires = t->expires;
+          found = true;
+        }
+      }
+    }
+    if (found) {
+      return true;  // Overflow timers are all due after anything on the wheel
+    }
+    for (const WheelTimer *t = overflow; t != NULL; t = t->next) {
+      if (!found || (int32_t)(t->expires - expires) < 0) {
+        expires = t->expires;
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  // Milliseconds until the next timer is due, limitMs if nothing is due sooner
+  uint32_t msUntilNext(uint32_t limitMs) const {
+    uint32_t expires;
+    if (!nextExpiry(expires)) {
+      return limitMs;
+    }
+    int32_t wait = (int32_t)(expires - millis());
+    if (wait <= 0) {
+      return 0;
+    }
+    return min((uint32_t)wait, limitMs);
+  }
+
+  uint32_t size() const { return count; }
+
+ private:
+  void start(uint32_t nowMs) {
+    if (!started) {
+      current = nowMs;
+      started = true;
+    }
+  }
+
+  bool isBoundary(int level) const {
+    return (current & ((1UL << (TIMER_WHEEL_BITS * level)) - 1)) == 0;
+  }
+
+  // Slots from `slot` to the next occupied one (1..64), 0 if the level is empty
+  static uint32_t distanceToNext(uint64_t mask, uint32_t slot) {
+    if (mask == 0) {
+      return 0;
+    }
+    uint32_t shift = slot + 1;
+    uint64_t rotated = (shift == TIMER_WHEEL_SLOTS) ? mask
+                                                    : (mask >> shift) | (mask << (TIMER_WHEEL_SLOTS - shift));
+    return __builtin_ctzll(rotated) + 1;
+  }
+
+  void insert(WheelTimer &timer) {
+    // Lowest level whose window still reaches the expiry (block numbers wrap with millis())
+    int level = 0;
+    uint32_t shift = 0;
+    uint32_t ahead = timer.expires - current;
+    while (ahead >= (uint32_t)TIMER_WHEEL_SLOTS && level < TIMER_WHEEL_LEVELS - 1) {
+      level++;
+      shift += TIMER_WHEEL_BITS;
+      ahead = ((timer.expires >> shift) - (current >> shift)) & (0xFFFFFFFFUL >> shift);
+    }
+
+    timer.prev = NULL;
+    timer.armed = true;
+    if (ahead >= (uint32_t)TIMER_WHEEL_SLOTS) {
+      // Beyond the wheel - wait on the overflow list until the top level reaches it
+      timer.level = TIMER_WHEEL_OVERFLOW;
+      timer.slot = 0;
+      timer.next = overflow;
+      if (timer.next != NULL) {
+        timer.next->prev = &timer;
+      }
+      overflow = &timer;
+      return;
+    }
+
+    uint32_t slot = (timer.expires >> shift) & TIMER_WHEEL_MASK;
+    timer.level = level;
+    timer.slot = slot;
+    timer.next = slots[level][slot];
+    if (timer.next != NULL) {
+      timer.next->prev = &timer;
+    }
+    slots[level][slot] = &timer;
+    occupied[level] |= 1ULL << slot;
+  }
+
+  void unlink(WheelTimer &timer) {
+    if (timer.prev != NULL) {
+      timer.prev->next = timer.next;
+    } else if (timer.level == TIMER_WHEEL_OVERFLOW) {
+      overflow = timer.next;
+    } else {
+      slots[timer.level][timer.slot] = timer.next;
+      if (timer.next == NULL) {
+        occupied[timer.level] &= ~(1ULL << timer.slot);
+      }
+    }
+    if (timer.next != NULL) {
+      timer.next->prev = timer.prev;
+    }
+    timer.next = NULL;
+    timer.prev = NULL;
+    timer.armed = false;
+  }
+
+  void cascade(int level) {
+    uint32_t slot = (current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    WheelTimer *timer;
+    while ((timer = slots[level][slot]) != NULL) {
+      unlink(*timer);
+      insert(*timer);
+    }
+  }
+
+  // Every 4096 ms, long timers that came within reach move onto the wheel
+  void refileOverflow() {
+    WheelTimer *timer = overflow;
+    overflow = NULL;
+    while (timer != NULL) {
+      WheelTimer *next = timer->next;
+      insert(*timer);
+      timer = next;
+    }
+  }
+
+  void expire(uint32_t slot) {
+    // One at a time, callbacks may arm or cancel other timers
+    WheelTimer *timer;
+    while ((timer = slots[0][slot]) != NULL) {
+      unlink(*timer);
+      count--;
+      if (timer->callback != NULL) {
+        timer->callback(*timer, timer->arg);
+      }
+    }
+  }
+
+  WheelTimer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  uint64_t occupied[TIMER_WHEEL_LEVELS];
+  WheelTimer *overflow;  // Timers due beyond the top level, unsorted
+  uint32_t current;  // Last millis() value fully processed
+  bool started;
+  uint32_t count;
+};
+
+// Suspend a coroutine (coroutine.h) until the timer fires, arming it for ms first
+#define CO_WAIT_TIMER(co, wheel, timer, ms) \
+  do { (wheel).arm(timer, ms); CO_AWAIT(co, !(timer).pending()); } while (0)
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,63 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - WARM RESTART STATE
+ *
+ * Runtime state that should survive a software, panic or watchdog reset is
+ * mirrored into a block placed in RTC_NOINIT memory. The block starts with a
+ * header holding a magic value, layout version, length and CRC32, so garbage
+ * left in RTC memory after power-on is never mistaken for valid state.
+ *
+ * These helpers have no Arduino dependencies and work on any memory region,
+ * which lets the restore logic run on the host as well.
+ */
+
+#ifndef WARM_STATE_H
+#define WARM_STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+const uint32_t WARM_STATE_MAGIC = 0x574D5354;  // "WMST"
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;  // Layout version, bump when the state struct changes
+  uint16_t length;   // sizeof() the whole state struct
+  uint32_t crc;      // CRC32 of everything after the header
+} warm_state_header_t;
+
+inline uint32_t warmStateCrc(const uint8_t *data, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+// State structs must start with a warm_state_header_t member named "header"
+template <typename T>
+void warmStateSeal(T &state, uint16_t version) {
+  const uint8_t *body = (const uint8_t *)&state + sizeof(warm_state_header_t);
+  state.header.magic = WARM_STATE_MAGIC;
+  state.header.version = version;
+  state.header.length = sizeof(T);
+  state.header.crc = warmStateCrc(body, sizeof(T) - sizeof(warm_state_header_t));
+}
+
+template <typename T>
+bool warmStateValid(const T &state, uint16_t version) {
+  const uint8_t *body = (const uint8_t *)&state + sizeof(warm_state_header_t);
+  return state.header.magic == WARM_STATE_MAGIC &&
+         state.header.version == version &&
+         state.header.length == sizeof(T) &&
+         state.header.crc == warmStateCrc(body, sizeof(T) - sizeof(warm_state_header_t));
+}
+
+template <typename T>
+void warmStateInvalidate(T &state) {
+  state.header.magic = 0;
+}
+
+#endif // WARM_STATE_H
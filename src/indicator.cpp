@@ -12,44 +12,156 @@
 #include <esp_wifi.h>
 #include <Preferences.h>
 #include <esp_sleep.h>
+#include <esp_system.h>
+#include <atomic>
+#include "warm_state.h"
+#include "pref_cache.h"
+#include "radio_recovery.h"
+#include "async_log.h"
+#include "core_stats.h"
+#include "coroutine.h"
+#include "timer_wheel.h"
+#include "power_manager.h"
+#include "drift_estimator.h"
+#include "channel_survey.h"
+#include "link_adapter.h"
+#include "link_quality.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "state_trace.h"
+#include "loop_profiler.h"
 
 // Configuration constants
 const int NUM_LEDS = 3;
 const int LED_PINS[NUM_LEDS] = {25, 26, 27};  // GPIO pins for the LEDs (active LOW)
-const int WIFI_CHANNEL = 6;                   // WiFi channel for ESP-NOW communication
+const uint8_t DEFAULT_WIFI_CHANNEL = 6;       // ESP-NOW channel until a sender moves us
 const char* PREF_NAMESPACE = "espnow-leds";
 
+// Boot timing
+const int BOOT_WIFI_SETTLE_MS = 20;     // Wait after WiFi mode change (same as sleep reinit)
+const int BOOT_CHANNEL_SETTLE_MS = 20;  // Wait after setting the channel
+
+// Task runtime
+const int RADIO_QUEUE_LENGTH = 8;        // Radio events buffered between callbacks and protocol task
+const int RADIO_EVENT_MAX_LEN = 64;      // Largest frame payload carried through the queue
+const int PROTOCOL_CORE = PRO_CPU_NUM;   // Radio handling shares the core with the WiFi driver
+const int APP_CORE = APP_CPU_NUM;        // LED output, logging, flash writes and status
+const int PROTOCOL_TASK_STACK = 4096;
+const int PROTOCOL_TASK_PRIORITY = 3;
+const int LED_TASK_STACK = 2048;
+const int LED_TASK_PRIORITY = 4;         // LED output reacts before anything else
+const int16_t LED_NOT_PENDING = -128;    // pendingLed holds no new state
+const int APP_TASK_STACK = 4096;
+const int APP_TASK_PRIORITY = 1;
+const int PROTOCOL_POLL_MS = 5;          // Wake interval while a state machine is mid-flight
+const int LED_TEST_POLL_MS = 10;         // Step interval for the LED self-test
+
+// Acknowledgment burst
+const int ACK_ATTEMPTS = 3;              // Acks sent per command unless one is delivered earlier
+const int ACK_INTERVAL_MS = 20;          // Minimum gap between ack attempts
+const int PEER_RETRY_MS = 10;            // Wait before retrying a failed esp_now_add_peer()
+
 // Sleep and timing control
 const int AWAKE_TIME_MS = 300;        // 300ms awake time
 const int SLEEP_DURATION_MS = 1700;   // 1.7 seconds sleep time
 const int AWAKE_AFTER_COMMAND_MS = 3000;  // Stay awake for 3 seconds after command
+const int SLEEP_REINIT_MS = 80;       // Radio bring-up after light sleep (3 x 20ms settle + init)
+const int MIN_SLEEP_MS = 100;         // Shorter sleeps cost more than they save
+
+// Wake hints - senders announce when they transmit next, guard bands come from the drift estimator
+const unsigned long WAKE_HINT_MAX_SLEEP_MS = 60000;  // Longest sleep a hint may ask for
 
 // State tracking variables
 unsigned long lastCommandTime = 0;
 unsigned long lastStatusTime = 0;
-unsigned long nextSleepTime = 0;  // Timestamp for when to enter next sleep cycle
 int consecutiveSleepCycles = 0;
+uint32_t totalSleepCycles = 0;
 const int MAX_SLEEP_CYCLES = 10;  // Force a long awake period after this many sleep cycles
 bool forceExtendedAwake = false;  // Flag to enforce extended awake period
 
+// Metrics, reported with the status update and in telemetry
+const uint32_t HINT_ERROR_BOUNDS_MS[] = {1, 2, 5, 10, 20, 50, 100};
+const uint32_t ACK_ATTEMPT_BOUNDS[] = {1, 2};
+MetricCounter framesReceived("rx.frames");
+MetricCounter duplicateCommands("rx.duplicates");
+MetricCounter sendErrors("tx.errors");
+MetricCounter deliveryFailures("tx.failed");
+MetricCounter peerAddFailures("peer.add_failed");
+MetricCounter initFailures("espnow.init_failed");
+MetricCounter hintsMissed("hint.missed");
+MetricCounter acksUndelivered("ack.undelivered");
+MetricHistogram<7> hintError("hint.error_ms", HINT_ERROR_BOUNDS_MS);  // Arrival vs announced time
+MetricHistogram<2> ackAttempts("ack.attempts", ACK_ATTEMPT_BOUNDS);   // Sends until delivered
+
+// Telemetry to the sender, sent after a delivered acknowledgment once this much time has passed
+const unsigned long TELEMETRY_INTERVAL_MS = 60000;
+unsigned long lastTelemetryTime = 0;
+uint16_t telemetrySequence = 0;        // Records sent to the sender, protocol task only
+uint16_t localTelemetrySequence = 0;   // Lines printed with -D TELEMETRY_SERIAL, app task only
+uint8_t ownMac[6] = {0};
+
+// Preferences write coalescing
+const unsigned long PREF_FLUSH_INTERVAL_MS = 5000;  // Minimum time between flash writes
+
+// Peer table
+const int MAX_PEERS = 8;                  // Maximum number of senders remembered
+const int PEER_HASH_SIZE = 16;            // Hash index slots (power of two, > MAX_PEERS)
+const unsigned long PEER_STATS_PERSIST_MS = 600000;  // Persist link stats every 10 minutes
+
 // Message types for communication protocol
 enum MessageType {
   LED_COMMAND = 1,
   ACKNOWLEDGMENT = 2,
-  DISCOVERY = 3
+  DISCOVERY = 3,
+  HEARTBEAT = 4,
+  BEACON = 5,       // Frame timing between senders, not for indicators
+  SURVEY = 6,       // Channel survey (value = SurveyKind, etaMs = time until the first hop)
+  CHANNEL_SWITCH = 7,  // Move to another channel (value = channel, etaMs = time until the switch)
+  TELEMETRY = TELEMETRY_TYPE  // Our status record to the sender (telemetry_t)
+};
+
+// SURVEY values
+enum SurveyKind {
+  SURVEY_START = 0,
+  SURVEY_PROBE = 1   // Only there to be delivered, nothing to do
+};
+
+// DISCOVERY values
+enum DiscoveryKind {
+  DISCOVERY_REQUEST = 0,   // Broadcast by senders looking for an indicator to pair with
+  DISCOVERY_ANNOUNCE = 1   // Our answer, or a broadcast after boot while no sender is known
 };
 
 // ESP-NOW message structure
-typedef struct {
+typedef struct __attribute__((packed)) {
   uint8_t type;     // Message type
   uint8_t value;    // LED index or acknowledgment value
+  uint16_t etaMs;   // Wake hint: time until the sender transmits next, WAKE_HINT_NONE if unknown
 } message_t;
 
+const size_t MESSAGE_BASE_LEN = 2;  // type + value, all that firmware without wake hints sends
+const uint16_t WAKE_HINT_NONE = 0;
+
+// Radio event passed from the ESP-NOW callbacks to the protocol task
+enum RadioEventType {
+  RADIO_EVENT_RX,
+  RADIO_EVENT_TX_DONE
+};
+
+typedef struct {
+  uint8_t type;      // RadioEventType
+  uint8_t mac[6];
+  uint8_t status;    // esp_now_send_status_t for RADIO_EVENT_TX_DONE
+  uint8_t len;       // Payload length for RADIO_EVENT_RX
+  int8_t rssi;       // dBm for RADIO_EVENT_RX, LINK_RSSI_NONE if it was not captured
+  uint8_t channel;   // Channel it was received on, 0 if it was not captured
+  uint32_t rxMs;     // millis() when the frame arrived, for RADIO_EVENT_RX
+  uint8_t data[RADIO_EVENT_MAX_LEN];
+} radio_event_t;
+
 // State machine states
 enum SetupState {
   SETUP_INIT,
-  SETUP_SERIAL_WAIT,
-  SETUP_LED_TEST,
   SETUP_WIFI_INIT,
   SETUP_WIFI_DISCONNECT_WAIT,
   SETUP_WIFI_CHANNEL_WAIT,
@@ -92,43 +204,226 @@ enum SleepState {
   SLEEP_CHANNEL_SETUP,
   SLEEP_CHANNEL_WAIT,
   SLEEP_ESPNOW_INIT,
+  SLEEP_RADIO_RECOVERY,
   SLEEP_ESPNOW_CALLBACK,
   SLEEP_PEER_SETUP,
   SLEEP_COMPLETE
 };
 
+// State names for the transition trace (-D STATE_TRACE), in enum order
+const char *const SETUP_STATE_NAMES[SETUP_COMPLETE + 1] = {
+  "INIT", "WIFI_INIT", "WIFI_DISCONNECT_WAIT", "WIFI_CHANNEL_WAIT",
+  "ESPNOW_INIT", "COMPLETE"
+};
+const char *const ACK_STATE_NAMES[ACK_COMPLETE + 1] = {
+  "INIT", "PEER_SETUP", "SEND", "WAIT", "COMPLETE"
+};
+const char *const DISCOVERY_STATE_NAMES[DISCOVERY_COMPLETE + 1] = {
+  "INIT", "PEER_SETUP", "SEND", "COMPLETE"
+};
+const char *const SLEEP_STATE_NAMES[SLEEP_COMPLETE + 1] = {
+  "AWAKE", "PREPARE", "ENTER", "WAKEUP", "REINIT_START", "WIFI_DISCONNECT", "WIFI_SETUP",
+  "WIFI_WAIT", "CHANNEL_SETUP", "CHANNEL_WAIT", "ESPNOW_INIT", "RADIO_RECOVERY",
+  "ESPNOW_CALLBACK", "PEER_SETUP", "COMPLETE"
+};
+const trace_machine_t SETUP_TRACE = {"setup", SETUP_STATE_NAMES, SETUP_COMPLETE + 1};
+const trace_machine_t ACK_TRACE = {"ack", ACK_STATE_NAMES, ACK_COMPLETE + 1};
+const trace_machine_t DISCOVERY_TRACE = {"discovery", DISCOVERY_STATE_NAMES, DISCOVERY_COMPLETE + 1};
+const trace_machine_t SLEEP_TRACE = {"sleep", SLEEP_STATE_NAMES, SLEEP_COMPLETE + 1};
+
+// Preferences keys that can be marked dirty and flushed lazily
+enum PrefDirtyFlag {
+  PREF_DIRTY_PEER_TABLE = 1 << 0,
+  PREF_DIRTY_CHANNEL = 1 << 1
+};
+
+enum PeerRole {
+  PEER_ROLE_UNKNOWN = 0,
+  PEER_ROLE_SENDER = 1
+};
+
+enum PeerFlag {
+  PEER_FLAG_SEEN = 1 << 0   // Heard from since boot (not persisted)
+};
+
+// Persisted peer record - packed so the flash blob stays compact
+typedef struct __attribute__((packed)) {
+  uint8_t mac[6];
+  uint8_t role;       // PeerRole
+  uint8_t flags;      // PeerFlag
+  uint32_t lastSeen;  // millis() when last heard from
+  uint16_t rxFrames;  // Valid frames received from this peer
+  uint16_t txOk;      // Frames delivered to this peer
+  uint16_t txFail;    // Frames that failed delivery to this peer
+} peer_record_t;
+
+// Runtime state mirrored in RTC memory so a warm reset resumes where it left off
+const uint16_t WARM_STATE_VERSION = 2;
+
+typedef struct {
+  warm_state_header_t header;
+  int8_t activeLedIndex;
+  uint8_t consecutiveSleepCycles;
+  uint8_t forceExtendedAwake;
+  uint8_t peerCount;
+  uint8_t lastSenderMac[6];
+  peer_record_t peers[MAX_PEERS];
+  drift_state_t drift;
+} indicator_warm_state_t;
+
 // Global variables
 Preferences preferences;
+uint8_t wifiChannel = DEFAULT_WIFI_CHANNEL;
 int activeLedIndex = -1;
-uint8_t lastSenderMac[6] = {0};
+uint8_t lastSenderMac[6] = {0};  // Most recent sender, used for responses
 bool sendDiscoveryResponse = false;
+uint8_t discoveryTarget[6] = {0};  // Requesting sender, or broadcast for an announcement
+const uint8_t BROADCAST_MAC[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// Wake hint from the last sender frame
+bool wakeHintValid = false;
+unsigned long wakeHintAt = 0;  // millis() when the sender's next transmission is due
+DriftEstimator driftEstimator;  // Sender clock vs ours, measured from consecutive hints
+
+// Peer table with a hashed index by MAC (open addressing, linear probing)
+peer_record_t peerTable[MAX_PEERS];
+int peerCount = 0;
+int8_t peerIndex[PEER_HASH_SIZE];
+bool legacyPeerKey = false;  // Old single "last_sender" key still in flash
+
+// Persistence cache - flash is only written when a value really changed
+portMUX_TYPE prefMux = portMUX_INITIALIZER_UNLOCKED;
+PrefCoalescer prefCache(PREF_FLUSH_INTERVAL_MS);
+PrefShadow<sizeof(peer_record_t) * MAX_PEERS> savedPeers;  // What flash currently holds
+unsigned long lastPeerPersistTime = 0;
+
+// Task runtime - callbacks queue radio events, tasks sleep until they have work.
+// The protocol task runs on the radio core and hands LED states and log lines
+// to the application core without locks: log lines through a queue, the LED
+// state through a single word where a newer state replaces one not shown yet.
+QueueHandle_t radioQueue = NULL;
+TaskHandle_t protocolTaskHandle = NULL;
+TaskHandle_t ledTaskHandle = NULL;
+TaskHandle_t appTaskHandle = NULL;
+MetricCounter radioQueueDrops("radio.queue_drops");
+MetricGauge radioQueueMaxDepth("radio.queue_max");
+std::atomic<int16_t> pendingLed(LED_NOT_PENDING);
+AsyncLog asyncLog;
+
+// Per-core load in measurement mode (-D CORE_STATS)
+TaskLoad protocolLoad("protocol", PROTOCOL_CORE);
+TaskLoad ledLoad("led", APP_CORE);
+TaskLoad appLoad("app", APP_CORE);
+
+// Iteration time and wake lateness per task in measurement mode (-D LOOP_PROFILE)
+LoopProfiler protocolProfile("protocol", "protocol.loop_us", "protocol.late_us");
+LoopProfiler appProfile("app", "app.loop_us", "app.late_us");
 
-// State machine variables
-SetupState setupState = SETUP_INIT;
+// Radio recovery ladder used instead of ESP.restart() on ESP-NOW errors
+RadioRecovery radioRecovery(DEFAULT_WIFI_CHANNEL, asyncLog);
+
+// Rate and TX power of our acknowledgments, adapted on their delivery
+LinkAdapter linkAdapter(asyncLog);
+
+// Signal strength of received frames, captured in promiscuous mode
+LinkQuality linkQuality;
+
+// Automatic light sleep with radio listen windows (-D POWER_MANAGED_SLEEP)
+PowerManager powerManager;
+
+// Warm restart state
+RTC_NOINIT_ATTR indicator_warm_state_t warmState;
+volatile bool warmStateDirty = false;
+bool warmRestored = false;
+
+// State machine variables, protocol machines record their transitions (-D STATE_TRACE)
+StateTrace stateTrace;
+TracedState<SetupState> setupState(stateTrace, SETUP_TRACE, SETUP_INIT);
 LedTestState ledTestState = LED_TEST_INIT;
-AckState ackState = ACK_INIT;
-DiscoveryState discoveryState = DISCOVERY_INIT;
-SleepState sleepState = SLEEP_AWAKE;
+TracedState<AckState> ackState(stateTrace, ACK_TRACE, ACK_INIT);
+TracedState<DiscoveryState> discoveryState(stateTrace, DISCOVERY_TRACE, DISCOVERY_INIT);
+TracedState<SleepState> sleepState(stateTrace, SLEEP_TRACE, SLEEP_AWAKE);
+
+// Coroutine resume points for the flows above, the enums mark their current phase
+co_state_t setupFlow;
+co_state_t ledTestFlow;
+co_state_t ackFlow;
+co_state_t discoveryFlow;
+co_state_t sleepFlow;
+co_state_t surveyFlow;
+
+// Protocol task timers - advanced once per pass, the task blocks until the next expiry
+TimerWheel protocolTimers;
+WheelTimer setupTimer;
+WheelTimer ackTimer;
+WheelTimer discoveryTimer;
+WheelTimer sleepStepTimer;      // Steps of the sleep/reinit flow
+WheelTimer nextSleepTimer;      // Start of the next sleep cycle
+WheelTimer extendedAwakeTimer;  // Re-check of a forced extended awake period
+void openWakeWindow(WheelTimer &timer, void *arg);
+WheelTimer wakeWindowTimer(openWakeWindow);  // Power-managed mode: listen across a hinted transmission
+WheelTimer surveyTimer;         // Next hop of a channel survey
+void switchChannel(WheelTimer &timer, void *arg);
+WheelTimer channelSwitchTimer(switchChannel);
 
-unsigned long stateTimer = 0;
+// Channel survey run together with the sender, and the channel it asked us to move to
+ChannelSurvey survey;
+uint8_t pendingChannel = 0;
+
+unsigned long setupStateTime[SETUP_COMPLETE + 1] = {0};  // micros() when each setup state was entered
 int currentTestLed = 0;
 int ackAttemptCount = 0;
-const uint8_t *ackTargetAddr = NULL;
+uint8_t ackTargetMac[6] = {0};
+bool ackTargetValid = false;
+bool ackSendDone = false;  // Delivery report received for the last ack sent
+bool ackSendOk = false;
 bool reinitRequired = false;
 
 // Function prototypes
-void processLedTest();
+void setSetupState(SetupState state);
+bool isWarmReset();
+void printBootTimeline();
+CoStatus processSetup();
+CoStatus processLedTest();
 bool setupEspNow();
 bool reinitEspNowAfterSleep();
-bool loadSavedAddresses();
-void savePeerAddress(const uint8_t *addr);
+bool loadPeerTable();
+void rebuildPeerIndex();
+int findPeer(const uint8_t *addr);
+bool hasSenderPeer();
+void announceIfUnpaired();
+int updatePeer(const uint8_t *addr, uint8_t role);
+void restorePeers();
+void attachRadio();
+void flushPreferences();
+bool restoreWarmState();
+void saveWarmState();
 void printMacAddress(const uint8_t *addr);
 void onDataReceived(const uint8_t *macAddr, const uint8_t *data, int dataLen);
+void onDataSent(const uint8_t *macAddr, esp_now_send_status_t status);
+void onPromiscuous(void *buf, wifi_promiscuous_pkt_type_t type);
+void protocolTask(void *param);
+void ledTask(void *param);
+void appTask(void *param);
+TickType_t appWaitTicks();
+void printCoreStats();
+void processProtocol();
+TickType_t protocolWaitTicks();
+void handleRadioEvent(const radio_event_t &event);
+void setLedOutput(int ledIndex);
 void handleLedCommand(uint8_t ledIndex, const uint8_t *senderAddr);
-void processAcknowledgment();
-void processDiscoveryResponse();
-void processSleepWakeup();
+void applyWakeHint(uint32_t rxMs, uint16_t etaMs);
+uint32_t wakeHintGuardMs();
+uint32_t nextSleepDurationMs();
+esp_err_t registerPeer(const uint8_t *addr);
+CoStatus processAcknowledgment();
+CoStatus processDiscoveryResponse();
+CoStatus processSleepWakeup();
+CoStatus processChannelSurvey();
 void printStatusUpdate();
+void fillTelemetry(telemetry_t &record);
+void sendTelemetry(const uint8_t *addr);
+void printTelemetry();
 
 void setup() {
   Serial.begin(115200);
@@ -137,170 +432,290 @@ void setup() {
   setCpuFrequencyMhz(80);
   
   // Initialize setup state machine
-  setupState = SETUP_SERIAL_WAIT;
-  stateTimer = millis();
+  setSetupState(SETUP_INIT);
   
   // Initialize preferences
   preferences.begin(PREF_NAMESPACE, false);
+  
+  // Bring outputs back right away if RTC memory survived a warm reset
+  warmRestored = isWarmReset() && restoreWarmState();
+  
+  // Initialize LED pins (a restored LED was already switched on above)
+  for (int i = 0; i < NUM_LEDS; i++) {
+    pinMode(LED_PINS[i], OUTPUT);
+    digitalWrite(LED_PINS[i], (i == activeLedIndex) ? LOW : HIGH);  // Active LOW
+  }
+  
+  // The LED test runs alongside radio bring-up; skip it on warm resets
+  ledTestState = isWarmReset() ? LED_TEST_COMPLETE : LED_TEST_INIT;
+  
+  // Start the task runtime, consumers first so they are ready for the protocol task
+  radioQueue = xQueueCreate(RADIO_QUEUE_LENGTH, sizeof(radio_event_t));
+  xTaskCreatePinnedToCore(ledTask, "led", LED_TASK_STACK, NULL,
+                          LED_TASK_PRIORITY, &ledTaskHandle, APP_CORE);
+  xTaskCreatePinnedToCore(appTask, "app", APP_TASK_STACK, NULL,
+                          APP_TASK_PRIORITY, &appTaskHandle, APP_CORE);
+  asyncLog.begin(appTaskHandle);
+  xTaskCreatePinnedToCore(protocolTask, "protocol", PROTOCOL_TASK_STACK, NULL,
+                          PROTOCOL_TASK_PRIORITY, &protocolTaskHandle, PROTOCOL_CORE);
 }
 
 void loop() {
-  unsigned long currentTime = millis();
+  // All work happens in the protocol, LED and app tasks
+  vTaskDelete(NULL);
+}
+
+void protocolTask(void *param) {
+  radio_event_t event;
   
-  // Handle setup state machine
-  if (setupState != SETUP_COMPLETE) {
-    switch (setupState) {
-      case SETUP_SERIAL_WAIT:
-        if (currentTime - stateTimer >= 500) {
-          Serial.print("\n\n==== ESP32 ESP-NOW LED System ====\n");
-          Serial.println("INDICATOR MODE (RECEIVER)");
-          Serial.println("FW Version: 7.2 - Reliable Light Sleep Implementation with Non-Blocking Design");
-          
-          // Initialize LED pins
-          for (int i = 0; i < NUM_LEDS; i++) {
-            pinMode(LED_PINS[i], OUTPUT);
-            digitalWrite(LED_PINS[i], HIGH);  // LEDs are OFF initially (active LOW)
-          }
-          
-          ledTestState = LED_TEST_INIT;
-          setupState = SETUP_LED_TEST;
-        }
-        break;
-        
-      case SETUP_LED_TEST:
-        processLedTest();
-        if (ledTestState == LED_TEST_COMPLETE) {
-          // Load saved addresses
-          if (loadSavedAddresses()) {
-            Serial.println("Loaded saved peer address:");
-            printMacAddress(lastSenderMac);
-          } else {
-            Serial.println("No saved peer address found.");
-          }
-          
-          setupState = SETUP_WIFI_INIT;
-        }
-        break;
-        
-      case SETUP_WIFI_INIT:
-        // Initialize WiFi in Station mode
-        WiFi.mode(WIFI_STA);
-        WiFi.disconnect();
-        stateTimer = currentTime;
-        setupState = SETUP_WIFI_DISCONNECT_WAIT;
-        break;
-        
-      case SETUP_WIFI_DISCONNECT_WAIT:
-        if (currentTime - stateTimer >= 300) {
-          // Set WiFi channel
-          esp_wifi_set_channel(WIFI_CHANNEL, WIFI_SECOND_CHAN_NONE);
-          stateTimer = currentTime;
-          setupState = SETUP_WIFI_CHANNEL_WAIT;
-        }
-        break;
-        
-      case SETUP_WIFI_CHANNEL_WAIT:
-        if (currentTime - stateTimer >= 100) {
-          setupState = SETUP_ESPNOW_INIT;
-        }
-        break;
-        
-      case SETUP_ESPNOW_INIT:
-        // Initialize ESP-NOW
-        esp_err_t result = esp_now_init();
-        if (result != ESP_OK) {
-          Serial.printf("Error initializing ESP-NOW: %d\n", result);
-          stateTimer = currentTime;
-          ESP.restart(); // Restart ESP32 if initialization fails
-          return;
-        }
-        
-        // Register receive callback
-        esp_now_register_recv_cb(onDataReceived);
-        
-        Serial.printf("Device MAC Address: %s\n", WiFi.macAddress().c_str());
-        Serial.printf("Operating on WiFi channel: %d\n", WIFI_CHANNEL);
-        
-        Serial.println("Indicator ready - using optimized light sleep");
-        Serial.printf("Sleep pattern: %dms awake, %dms sleep\n", 
-                      AWAKE_TIME_MS, SLEEP_DURATION_MS);
-        
+  // Kick off the boot sequence, from then on timers and radio events drive the loop
+  protocolProfile.start(false);
+  processProtocol();
+  protocolProfile.stop();
+  
+  for (;;) {
+    // Sleep until a radio event arrives or the next deadline is due
+    TickType_t wait = protocolWaitTicks();
+    protocolProfile.waiting(wait);
+    bool received = xQueueReceive(radioQueue, &event, wait) == pdTRUE;
+    protocolLoad.start();
+    protocolProfile.start(!received);
+    if (received) {
+      protocolProfile.section("radio");
+      do {
+        handleRadioEvent(event);
+      } while (xQueueReceive(radioQueue, &event, 0) == pdTRUE);
+    }
+    
+    processProtocol();
+    protocolLoad.stop();
+    protocolProfile.stop();
+  }
+}
+
+void ledTask(void *param) {
+  for (;;) {
+    // Wait for a new LED state, stepping the self-test while it runs
+    TickType_t wait = (ledTestState != LED_TEST_COMPLETE) ?
+                      pdMS_TO_TICKS(LED_TEST_POLL_MS) : portMAX_DELAY;
+    bool notified = ulTaskNotifyTake(pdTRUE, wait) > 0;
+    ledLoad.start();
+    
+    // Only the latest state matters, whatever it replaced was never shown
+    int16_t ledIndex = pendingLed.exchange(LED_NOT_PENDING, std::memory_order_acquire);
+    
+    if (ledIndex != LED_NOT_PENDING) {
+      // A real command ends the boot LED test early
+      if (ledTestState != LED_TEST_COMPLETE) {
+        ledTestState = LED_TEST_COMPLETE;
+        CO_RESET(ledTestFlow);
+        Serial.println("LED test aborted by command");
+      }
+      
+      for (int i = 0; i < NUM_LEDS; i++) {
+        digitalWrite(LED_PINS[i], (i == ledIndex) ? LOW : HIGH);  // Active LOW
+      }
+    } else if (!notified && ledTestState != LED_TEST_COMPLETE) {
+      processLedTest();
+    }
+    ledLoad.stop();
+  }
+}
+
+void appTask(void *param) {
+#ifdef CORE_STATS
+  unsigned long lastCoreStatsTime = millis();
+#endif
+  
+  for (;;) {
+    // Woken by queued log lines, otherwise by flash and status deadlines
+    TickType_t wait = appWaitTicks();
+    appProfile.waiting(wait);
+    bool notified = ulTaskNotifyTake(pdTRUE, wait) > 0;
+    appLoad.start();
+    appProfile.start(!notified);
+    unsigned long currentTime = millis();
+    
+    appProfile.section("log");
+    asyncLog.drain();
+#ifdef STATE_TRACE
+    appProfile.section("trace");
+    stateTrace.dump();
+#endif
+    
+    if (setupState == SETUP_COMPLETE) {
+      // Periodically persist link stats, then write any changed settings to flash (rate limited)
+      if (currentTime - lastPeerPersistTime >= PEER_STATS_PERSIST_MS) {
+        prefCache.markDirty(PREF_DIRTY_PEER_TABLE);
+        lastPeerPersistTime = currentTime;
+      }
+      appProfile.section("prefs");
+      flushPreferences();
+      
+      // Print status update periodically
+      if (currentTime - lastStatusTime >= 10000) {
+        appProfile.section("status");
+#ifdef TELEMETRY_SERIAL
+        printTelemetry();
+#else
+        printStatusUpdate();
+#endif
         lastStatusTime = currentTime;
-        lastCommandTime = currentTime; // Start with active state
-        nextSleepTime = currentTime + AWAKE_AFTER_COMMAND_MS; // Set initial sleep time
-        
-        setupState = SETUP_COMPLETE;
-        break;
+      }
     }
     
-    return; // Don't process the rest of the loop until setup is complete
+#ifdef CORE_STATS
+    if (currentTime - lastCoreStatsTime >= CORE_STATS_INTERVAL_MS) {
+      appProfile.section("core_stats");
+      printCoreStats();
+      lastCoreStatsTime = currentTime;
+    }
+#endif
+    appLoad.stop();
+    appProfile.stop();
+  }
+}
+
+TickType_t appWaitTicks() {
+  if (setupState != SETUP_COMPLETE) {
+    return pdMS_TO_TICKS(100);
+  }
+  
+  unsigned long currentTime = millis();
+  long wait = (long)(lastStatusTime + 10000 - currentTime);
+  wait = min(wait, (long)(lastPeerPersistTime + PEER_STATS_PERSIST_MS - currentTime));
+  if (prefCache.dirty()) {
+    wait = min(wait, (long)prefCache.msUntilFlush(currentTime));
+  }
+#ifdef CORE_STATS
+  wait = min(wait, (long)CORE_STATS_INTERVAL_MS);
+#endif
+#ifdef STATE_TRACE
+  wait = min(wait, (long)TRACE_DUMP_INTERVAL_MS);
+#endif
+  
+  return pdMS_TO_TICKS(max(wait, 1L));
+}
+
+void setLedOutput(int ledIndex) {
+  pendingLed.store(ledIndex, std::memory_order_release);
+  xTaskNotifyGive(ledTaskHandle);
+}
+
+TickType_t protocolWaitTicks() {
+  // Poll while the recovery ladder steps through its own short waits
+  if (radioRecovery.active() || warmStateDirty) {
+    return pdMS_TO_TICKS(PROTOCOL_POLL_MS);
+  }
+  
+  // Otherwise sleep until the next timer is due
+  return pdMS_TO_TICKS(max(protocolTimers.msUntilNext(10000), (uint32_t)1));
+}
+
+void processProtocol() {
+  protocolProfile.section("timers");
+  protocolTimers.advance();
+  
+  // Run the boot sequence until it completes
+  if (setupState != SETUP_COMPLETE) {
+    protocolProfile.section("setup");
+    if (processSetup() == CO_RUNNING) {
+      return; // Don't process the rest of the loop until setup is complete
+    }
+  }
+  
+  unsigned long currentTime = millis();
+  
+  // Bring the radio back after a runtime ESP-NOW failure
+  if (radioRecovery.active() && sleepState == SLEEP_AWAKE) {
+    protocolProfile.section("recovery");
+    if (radioRecovery.process()) {
+      attachRadio();
+    }
+    return;
   }
   
   // Process acknowledgment if needed
   if (ackState != ACK_INIT && ackState != ACK_COMPLETE) {
+    protocolProfile.section("ack");
     processAcknowledgment();
   }
   
   // Process discovery response if needed
-  if (sendDiscoveryResponse && discoveryState == DISCOVERY_INIT) {
-    discoveryState = DISCOVERY_PEER_SETUP;
-    stateTimer = currentTime;
-  }
-  
-  if (discoveryState != DISCOVERY_INIT && discoveryState != DISCOVERY_COMPLETE) {
+  if (sendDiscoveryResponse) {
+    protocolProfile.section("discovery");
     processDiscoveryResponse();
   }
   
-  // Print status update periodically
-  if (currentTime - lastStatusTime >= 10000) {
-    printStatusUpdate();
-    lastStatusTime = currentTime;
+  // Follow the sender through a channel survey
+  if (survey.active()) {
+    protocolProfile.section("survey");
+    processChannelSurvey();
   }
   
-  // Ensure LED is correctly set
-  if (activeLedIndex >= 0) {
-    digitalWrite(LED_PINS[activeLedIndex], LOW);  // Ensure LED stays ON
+  // Keep the RTC copy of the runtime state current
+  if (warmStateDirty) {
+    protocolProfile.section("warm_state");
+    saveWarmState();
   }
   
   // Determine if we should stay awake or enter sleep
+  protocolProfile.section("sleep");
   bool shouldPrepareSleep = false;
   
   // After receiving a command, stay awake for defined period
   if (currentTime - lastCommandTime < AWAKE_AFTER_COMMAND_MS) {
     // Actively scanning mode after receiving a command
     if (currentTime % 1000 < 10) { // Print only occasionally to reduce log spam
-      Serial.println("Active scanning after command");
+      asyncLog.println("Active scanning after command");
     }
-    nextSleepTime = lastCommandTime + AWAKE_AFTER_COMMAND_MS;
+    powerManager.stayAwake(true);
     consecutiveSleepCycles = 0;
     sleepState = SLEEP_AWAKE;
     
   } else if (forceExtendedAwake) {
-    // We're in a forced extended awake period
-    if (currentTime - lastStatusTime >= 5000) {
-      Serial.println("Extended awake period to ensure communication");
-      lastStatusTime = currentTime;
+    // We're in a forced extended awake period, re-checked every 5 seconds
+    if (!extendedAwakeTimer.pending()) {
+      asyncLog.println("Extended awake period to ensure communication");
+      protocolTimers.arm(extendedAwakeTimer, 5000);
       
       // End extended awake period after 10 seconds
       if (currentTime - lastCommandTime >= 10000) {
-        Serial.println("Ending extended awake period");
+        asyncLog.println("Ending extended awake period");
         forceExtendedAwake = false;
         consecutiveSleepCycles = 0;
-        nextSleepTime = currentTime + 100; // Enter sleep soon
+        protocolTimers.cancel(extendedAwakeTimer);
+        protocolTimers.arm(nextSleepTimer, 100); // Enter sleep soon
       }
     }
     sleepState = SLEEP_AWAKE;
     
-  } else if (currentTime >= nextSleepTime && sleepState == SLEEP_AWAKE) {
-    // Time to enter a sleep cycle
-    shouldPrepareSleep = true;
+  } else if (!nextSleepTimer.pending() && sleepState == SLEEP_AWAKE) {
+    // A hinted transmission that did not show up within its window is not waited for again
+    if (wakeHintValid && (long)(currentTime - wakeHintAt) > (long)wakeHintGuardMs()) {
+      asyncLog.println("Hinted transmission missed, back to regular sleep cycles");
+      hintsMissed.inc();
+      wakeHintValid = false;
+      driftEstimator.miss();
+    }
+    
+    if (powerManager.active()) {
+      // The power manager sleeps between radio listen windows, no manual cycle needed
+      if (powerManager.isAwake()) {
+        asyncLog.println("Handing sleep over to the power manager");
+        powerManager.stayAwake(false);
+      }
+    } else {
+      // Time to enter a sleep cycle
+      shouldPrepareSleep = true;
+    }
   }
   
   // Process sleep/wakeup state machine
   if (shouldPrepareSleep) {
     sleepState = SLEEP_PREPARE;
-    stateTimer = currentTime;
-    Serial.println("Scanning briefly before sleep");
+    CO_RESET(sleepFlow);
+    asyncLog.println("Scanning briefly before sleep");
   }
   
   // Process sleep state machine if not in AWAKE state
@@ -309,60 +724,158 @@ void loop() {
   }
 }
 
-void processLedTest() {
-  static unsigned long ledTimer = 0;
-  unsigned long currentTime = millis();
+CoStatus processSetup() {
+  esp_err_t result;
   
-  switch (ledTestState) {
-    case LED_TEST_INIT:
-      Serial.println("Running LED test sequence");
-      currentTestLed = 0;
-      ledTimer = currentTime;
-      ledTestState = LED_TEST_SEQUENCE;
-      break;
-      
-    case LED_TEST_SEQUENCE:
-      if (currentTime - ledTimer < 300) {
-        // LED on for 300ms
-        digitalWrite(LED_PINS[currentTestLed], LOW);
-      } else if (currentTime - ledTimer < 400) {
-        // LED off for 100ms
-        digitalWrite(LED_PINS[currentTestLed], HIGH);
-      } else {
-        // Move to next LED
-        currentTestLed++;
-        if (currentTestLed >= NUM_LEDS) {
-          ledTestState = LED_TEST_ALL_ON;
-        } else {
-          ledTimer = currentTime;
-        }
-      }
-      break;
-      
-    case LED_TEST_ALL_ON:
-      // Turn all LEDs on
-      for (int i = 0; i < NUM_LEDS; i++) {
-        digitalWrite(LED_PINS[i], LOW);
-      }
-      ledTimer = currentTime;
-      ledTestState = LED_TEST_ALL_OFF;
-      break;
-      
-    case LED_TEST_ALL_OFF:
-      if (currentTime - ledTimer >= 300) {
-        // Turn all LEDs off after 300ms
-        for (int i = 0; i < NUM_LEDS; i++) {
-          digitalWrite(LED_PINS[i], HIGH);
-        }
-        ledTestState = LED_TEST_COMPLETE;
-        Serial.println("LED test complete");
-      }
-      break;
-      
-    case LED_TEST_COMPLETE:
-      // Nothing to do, test is complete
-      break;
+  CO_BEGIN(setupFlow);
+  
+  // No need to wait for the UART - output is buffered
+  asyncLog.print("\n\n==== ESP32 ESP-NOW LED System ====\n");
+  asyncLog.println("INDICATOR MODE (RECEIVER)");
+  asyncLog.println("FW Version: 7.2 - Reliable Light Sleep Implementation with Non-Blocking Design");
+  
+  if (isWarmReset()) {
+    asyncLog.println("Warm reset - skipping LED test");
+  }
+  
+  // Load saved peers and channel, RTC memory holds a fresher copy of the peers after a warm reset
+  loadPeerTable();
+  wifiChannel = preferences.getUChar("channel", DEFAULT_WIFI_CHANNEL);
+  if (wifiChannel < 1 || wifiChannel > SURVEY_CHANNELS) {
+    wifiChannel = DEFAULT_WIFI_CHANNEL;
+  }
+  radioRecovery.setChannel(wifiChannel);
+  if (warmRestored) {
+    peerCount = min((int)warmState.peerCount, MAX_PEERS);
+    memcpy(peerTable, warmState.peers, peerCount * sizeof(peer_record_t));
+    memcpy(lastSenderMac, warmState.lastSenderMac, 6);
+    rebuildPeerIndex();
+    asyncLog.printf("Warm restart: restored LED %d and %d peer(s) from RTC memory\n",
+                    activeLedIndex, peerCount);
+  }
+  
+  if (peerCount > 0) {
+    asyncLog.printf("Loaded %d saved peer(s), last sender:\n", peerCount);
+    printMacAddress(lastSenderMac);
+  } else {
+    asyncLog.println("No saved peer address found.");
+  }
+  
+  // Initialize WiFi in Station mode
+  setSetupState(SETUP_WIFI_INIT);
+  WiFi.mode(WIFI_STA);
+  WiFi.disconnect();
+  setSetupState(SETUP_WIFI_DISCONNECT_WAIT);
+  CO_WAIT_TIMER(setupFlow, protocolTimers, setupTimer, BOOT_WIFI_SETTLE_MS);
+  
+  // Set WiFi channel
+  esp_wifi_set_channel(wifiChannel, WIFI_SECOND_CHAN_NONE);
+  setSetupState(SETUP_WIFI_CHANNEL_WAIT);
+  CO_WAIT_TIMER(setupFlow, protocolTimers, setupTimer, BOOT_CHANNEL_SETTLE_MS);
+  
+  // Initialize ESP-NOW, escalating through the recovery ladder on failure
+  setSetupState(SETUP_ESPNOW_INIT);
+  result = esp_now_init();
+  if (result != ESP_OK) {
+    initFailures.inc();
+    asyncLog.printf("Error initializing ESP-NOW: %d\n", result);
+    radioRecovery.begin(result);
+    CO_AWAIT(setupFlow, radioRecovery.process());
+  }
+  
+  // Register callbacks and known peers
+  attachRadio();
+  
+  esp_wifi_get_mac(WIFI_IF_STA, ownMac);
+  asyncLog.printf("Device MAC Address: %02X:%02X:%02X:%02X:%02X:%02X\n",
+                  ownMac[0], ownMac[1], ownMac[2], ownMac[3], ownMac[4], ownMac[5]);
+  asyncLog.printf("Operating on WiFi channel: %d\n", wifiChannel);
+  
+  // Prefer the power manager when the build enables it, ESP-NOW then stays up while sleeping
+  result = powerManager.begin(AWAKE_TIME_MS, AWAKE_TIME_MS + SLEEP_DURATION_MS);
+  if (result == ESP_OK) {
+    powerManager.stayAwake(true);  // Start with active state
+    asyncLog.println("Indicator ready - using power-managed light sleep");
+    asyncLog.printf("Radio listen window: %dms every %dms\n",
+                    AWAKE_TIME_MS, AWAKE_TIME_MS + SLEEP_DURATION_MS);
+  } else {
+#ifdef POWER_MANAGED_SLEEP
+    asyncLog.printf("Power manager unavailable (%d), using manual sleep cycle\n", result);
+#endif
+    asyncLog.println("Indicator ready - using optimized light sleep");
+    asyncLog.printf("Sleep pattern: %dms awake, %dms sleep\n", 
+                    AWAKE_TIME_MS, SLEEP_DURATION_MS);
   }
+  
+  lastStatusTime = millis();
+  lastPeerPersistTime = lastStatusTime;
+  lastCommandTime = lastStatusTime; // Start with active state
+  protocolTimers.arm(nextSleepTimer, AWAKE_AFTER_COMMAND_MS); // Set initial sleep time
+  
+  warmStateDirty = true;  // Take the first RTC snapshot
+  announceIfUnpaired();
+  setSetupState(SETUP_COMPLETE);
+  printBootTimeline();
+  
+  CO_END(setupFlow);
+}
+
+void setSetupState(SetupState state) {
+  setupState = state;
+  setupStateTime[state] = micros();
+}
+
+bool isWarmReset() {
+  // Power-on, external pin and brownout resets get the full LED test
+  switch (esp_reset_reason()) {
+    case ESP_RST_SW:
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+    case ESP_RST_DEEPSLEEP:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void printBootTimeline() {
+  asyncLog.println("Boot timeline (ms since reset):");
+  for (int i = SETUP_INIT; i <= SETUP_COMPLETE; i++) {
+    asyncLog.printf("  %-22s %8.1f\n", SETUP_STATE_NAMES[i], setupStateTime[i] / 1000.0);
+  }
+  asyncLog.printf("Receive-ready after %.1f ms\n", setupStateTime[SETUP_COMPLETE] / 1000.0);
+}
+
+CoStatus processLedTest() {
+  CO_BEGIN(ledTestFlow);
+  
+  Serial.println("Running LED test sequence");
+  ledTestState = LED_TEST_SEQUENCE;
+  for (currentTestLed = 0; currentTestLed < NUM_LEDS; currentTestLed++) {
+    // LED on for 300ms, then off for 100ms
+    digitalWrite(LED_PINS[currentTestLed], LOW);
+    CO_DELAY(ledTestFlow, 300);
+    digitalWrite(LED_PINS[currentTestLed], HIGH);
+    CO_DELAY(ledTestFlow, 100);
+  }
+  
+  // Turn all LEDs on for 300ms
+  ledTestState = LED_TEST_ALL_ON;
+  for (int i = 0; i < NUM_LEDS; i++) {
+    digitalWrite(LED_PINS[i], LOW);
+  }
+  ledTestState = LED_TEST_ALL_OFF;
+  CO_DELAY(ledTestFlow, 300);
+  for (int i = 0; i < NUM_LEDS; i++) {
+    digitalWrite(LED_PINS[i], HIGH);
+  }
+  
+  ledTestState = LED_TEST_COMPLETE;
+  Serial.println("LED test complete");
+  
+  CO_END(ledTestFlow);
 }
 
 bool setupEspNow() {
@@ -370,127 +883,114 @@ bool setupEspNow() {
   return true;
 }
 
-void processSleepWakeup() {
-  unsigned long currentTime = millis();
+CoStatus processSleepWakeup() {
+  esp_err_t result;
+  uint32_t sleepMs;
   
-  switch (sleepState) {
-    case SLEEP_PREPARE:
-      if (currentTime - stateTimer >= AWAKE_TIME_MS) {
-        // After brief scanning period, enter sleep
-        Serial.printf("Entering light sleep for %d ms\n", SLEEP_DURATION_MS);
-        Serial.flush(); // Ensure all data is sent before sleep
-        
-        // Configure light sleep
-        esp_sleep_enable_timer_wakeup(SLEEP_DURATION_MS * 1000); // Convert to microseconds
-        
-        // Hold GPIO state for LED
-        if (activeLedIndex >= 0) {
-          gpio_hold_en((gpio_num_t)LED_PINS[activeLedIndex]);
-          gpio_deep_sleep_hold_en(); // Enable GPIO hold during sleep
-        }
-        
-        sleepState = SLEEP_ENTER;
-      }
-      break;
-      
-    case SLEEP_ENTER:
-      esp_light_sleep_start();
-      // Code continues here after wakeup
-      Serial.println("Woke up from light sleep");
-      
-      // Disable GPIO hold
-      gpio_hold_dis((gpio_num_t)LED_PINS[0]);
-      gpio_hold_dis((gpio_num_t)LED_PINS[1]);
-      gpio_hold_dis((gpio_num_t)LED_PINS[2]);
-      gpio_deep_sleep_hold_dis();
-      
-      // Ensure LED state is maintained after wakeup
-      if (activeLedIndex >= 0) {
-        digitalWrite(LED_PINS[activeLedIndex], LOW);
-      }
-      
-      sleepState = SLEEP_REINIT_START;
-      stateTimer = millis();
-      break;
-      
-    case SLEEP_REINIT_START:
-      // De-initialize ESP-NOW
-      esp_now_deinit();
-      sleepState = SLEEP_WIFI_DISCONNECT;
-      stateTimer = millis();
-      break;
-      
-    case SLEEP_WIFI_DISCONNECT:
-      if (millis() - stateTimer >= 20) {
-        // Reinitialize WiFi
-        WiFi.disconnect();
-        WiFi.mode(WIFI_STA);
-        sleepState = SLEEP_WIFI_SETUP;
-        stateTimer = millis();
-      }
-      break;
-      
-    case SLEEP_WIFI_SETUP:
-      if (millis() - stateTimer >= 20) {
-        // Set WiFi channel
-        esp_wifi_set_channel(WIFI_CHANNEL, WIFI_SECOND_CHAN_NONE);
-        sleepState = SLEEP_CHANNEL_SETUP;
-        stateTimer = millis();
-      }
-      break;
-      
-    case SLEEP_CHANNEL_SETUP:
-      if (millis() - stateTimer >= 20) {
-        // Initialize ESP-NOW
-        esp_err_t result = esp_now_init();
-        if (result != ESP_OK) {
-          Serial.printf("Error reinitializing ESP-NOW: %d\n", result);
-          sleepState = SLEEP_COMPLETE; // Skip to complete even on error
-        } else {
-          sleepState = SLEEP_ESPNOW_CALLBACK;
-        }
-        stateTimer = millis();
-      }
-      break;
-      
-    case SLEEP_ESPNOW_CALLBACK:
-      // Register receive callback
-      esp_now_register_recv_cb(onDataReceived);
-      sleepState = SLEEP_PEER_SETUP;
-      stateTimer = millis();
-      break;
-      
-    case SLEEP_PEER_SETUP:
-      // Re-add peer if we have one
-      if (lastSenderMac[0] != 0 || lastSenderMac[1] != 0) {
-        esp_now_peer_info_t peerInfo = {};
-        memcpy(peerInfo.peer_addr, lastSenderMac, 6);
-        peerInfo.channel = WIFI_CHANNEL;
-        peerInfo.encrypt = false;
-        esp_now_add_peer(&peerInfo);
-      }
-      
-      Serial.println("ESP-NOW reinitialized after sleep");
-      sleepState = SLEEP_COMPLETE;
-      break;
-      
-    case SLEEP_COMPLETE:
-      // Update sleep cycle tracking
-      consecutiveSleepCycles++;
-      
-      // Check if we need to force an extended awake period
-      if (consecutiveSleepCycles >= MAX_SLEEP_CYCLES) {
-        Serial.println("Forcing extended awake period after multiple sleep cycles");
-        forceExtendedAwake = true;
-        consecutiveSleepCycles = 0;
-      } else {
-        // Schedule next sleep
-        nextSleepTime = millis() + AWAKE_TIME_MS;
-      }
-      
-      sleepState = SLEEP_AWAKE;
-      break;
+  CO_BEGIN(sleepFlow);
+  
+  // Brief scanning period before sleep, not needed when the sender told us when it is back
+  CO_WAIT_TIMER(sleepFlow, protocolTimers, sleepStepTimer, wakeHintValid ? 0 : AWAKE_TIME_MS);
+  
+  sleepMs = nextSleepDurationMs();
+  if (sleepMs == 0) {
+    // The sender transmits too soon for a sleep to pay off, listen until its window ends
+    protocolTimers.arm(nextSleepTimer, max((long)(wakeHintAt + wakeHintGuardMs() - millis()), 0L));
+    sleepState = SLEEP_AWAKE;
+    CO_EXIT(sleepFlow);
+  }
+  
+  asyncLog.printf("Entering light sleep for %u ms\n", sleepMs);
+  asyncLog.waitEmpty(50);  // Let the log task catch up before sleep
+  Serial.flush();          // Ensure all data is sent before sleep
+  
+  // Configure light sleep
+  esp_sleep_enable_timer_wakeup((uint64_t)sleepMs * 1000); // Convert to microseconds
+  
+  // Hold GPIO state for LED
+  if (activeLedIndex >= 0) {
+    gpio_hold_en((gpio_num_t)LED_PINS[activeLedIndex]);
+    gpio_deep_sleep_hold_en(); // Enable GPIO hold during sleep
   }
+  
+  sleepState = SLEEP_ENTER;
+  protocolProfile.pause();
+  esp_light_sleep_start();
+  // Code continues here after wakeup
+  protocolProfile.section("sleep");
+  asyncLog.println("Woke up from light sleep");
+  
+  // Disable GPIO hold
+  gpio_hold_dis((gpio_num_t)LED_PINS[0]);
+  gpio_hold_dis((gpio_num_t)LED_PINS[1]);
+  gpio_hold_dis((gpio_num_t)LED_PINS[2]);
+  gpio_deep_sleep_hold_dis();
+  
+  // Ensure LED state is maintained after wakeup
+  setLedOutput(activeLedIndex);
+  
+  // De-initialize ESP-NOW
+  sleepState = SLEEP_REINIT_START;
+  esp_now_deinit();
+  sleepState = SLEEP_WIFI_DISCONNECT;
+  CO_WAIT_TIMER(sleepFlow, protocolTimers, sleepStepTimer, 20);
+  
+  // Reinitialize WiFi
+  WiFi.disconnect();
+  WiFi.mode(WIFI_STA);
+  sleepState = SLEEP_WIFI_SETUP;
+  CO_WAIT_TIMER(sleepFlow, protocolTimers, sleepStepTimer, 20);
+  
+  // Set WiFi channel
+  esp_wifi_set_channel(wifiChannel, WIFI_SECOND_CHAN_NONE);
+  sleepState = SLEEP_CHANNEL_SETUP;
+  CO_WAIT_TIMER(sleepFlow, protocolTimers, sleepStepTimer, 20);
+  
+  // Initialize ESP-NOW, don't continue without a working radio
+  result = esp_now_init();
+  if (result != ESP_OK) {
+    initFailures.inc();
+    asyncLog.printf("Error reinitializing ESP-NOW: %d\n", result);
+    radioRecovery.begin(result);
+    sleepState = SLEEP_RADIO_RECOVERY;
+    CO_AWAIT(sleepFlow, radioRecovery.process());
+  }
+  
+  // Register callbacks
+  sleepState = SLEEP_ESPNOW_CALLBACK;
+  esp_now_register_recv_cb(onDataReceived);
+  esp_now_register_send_cb(onDataSent);
+  
+  // Re-add all known peers in one pass
+  sleepState = SLEEP_PEER_SETUP;
+  restorePeers();
+  linkQuality.begin(onPromiscuous);
+  linkAdapter.apply();
+  asyncLog.println("ESP-NOW reinitialized after sleep");
+  announceIfUnpaired();
+  
+  // Update sleep cycle tracking
+  sleepState = SLEEP_COMPLETE;
+  consecutiveSleepCycles++;
+  totalSleepCycles++;
+  
+  // Check if we need to force an extended awake period
+  if (consecutiveSleepCycles >= MAX_SLEEP_CYCLES) {
+    asyncLog.println("Forcing extended awake period after multiple sleep cycles");
+    forceExtendedAwake = true;
+    consecutiveSleepCycles = 0;
+  } else if (wakeHintValid && (long)(wakeHintAt - millis()) > -(long)wakeHintGuardMs()) {
+    // Stay up until the hinted transmission window has passed
+    protocolTimers.arm(nextSleepTimer, wakeHintAt + wakeHintGuardMs() - millis());
+  } else {
+    // Schedule next sleep
+    protocolTimers.arm(nextSleepTimer, AWAKE_TIME_MS);
+  }
+  
+  warmStateDirty = true;
+  sleepState = SLEEP_AWAKE;
+  
+  CO_END(sleepFlow);
 }
 
 bool reinitEspNowAfterSleep() {
@@ -498,243 +998,654 @@ bool reinitEspNowAfterSleep() {
   return true;
 }
 
-bool loadSavedAddresses() {
-  size_t macLen = preferences.getBytesLength("last_sender");
-  if (macLen == 6) {
-    preferences.getBytes("last_sender", lastSenderMac, 6);
-    return true;
+uint8_t peerHash(const uint8_t *addr) {
+  // The last three bytes are the device specific part of the MAC
+  return (addr[3] * 31 + addr[4] * 7 + addr[5]) & (PEER_HASH_SIZE - 1);
+}
+
+void rebuildPeerIndex() {
+  memset(peerIndex, -1, sizeof(peerIndex));
+  for (int i = 0; i < peerCount; i++) {
+    uint8_t slot = peerHash(peerTable[i].mac);
+    while (peerIndex[slot] >= 0) {
+      slot = (slot + 1) & (PEER_HASH_SIZE - 1);
+    }
+    peerIndex[slot] = i;
+  }
+}
+
+bool hasSenderPeer() {
+  for (int i = 0; i < peerCount; i++) {
+    if (peerTable[i].role == PEER_ROLE_SENDER) {
+      return true;
+    }
   }
   return false;
 }
 
-void savePeerAddress(const uint8_t *addr) {
-  preferences.putBytes("last_sender", addr, 6);
-  memcpy(lastSenderMac, addr, 6);
-  Serial.println("Saved peer MAC address");
+void announceIfUnpaired() {
+  // Senders searching for an indicator pair on this without waiting for their next request
+  if (!hasSenderPeer() && !sendDiscoveryResponse) {
+    memcpy(discoveryTarget, BROADCAST_MAC, 6);
+    sendDiscoveryResponse = true;
+  }
+}
+
+int findPeer(const uint8_t *addr) {
+  uint8_t slot = peerHash(addr);
+  while (peerIndex[slot] >= 0) {
+    int i = peerIndex[slot];
+    if (memcmp(peerTable[i].mac, addr, 6) == 0) {
+      return i;
+    }
+    slot = (slot + 1) & (PEER_HASH_SIZE - 1);
+  }
+  return -1;
+}
+
+int updatePeer(const uint8_t *addr, uint8_t role) {
+  // Only RAM is touched here, new peers are flushed to flash
+  // later by flushPreferences().
+  portENTER_CRITICAL(&prefMux);
+  int i = findPeer(addr);
+  if (i < 0) {
+    if (peerCount < MAX_PEERS) {
+      i = peerCount++;
+    } else {
+      // Table full - replace the peer we have not heard from for the longest time,
+      // preferring peers that have not been seen at all since boot
+      i = 0;
+      for (int j = 1; j < MAX_PEERS; j++) {
+        bool jSeen = peerTable[j].flags & PEER_FLAG_SEEN;
+        bool iSeen = peerTable[i].flags & PEER_FLAG_SEEN;
+        if ((!jSeen && iSeen) ||
+            (jSeen == iSeen && peerTable[j].lastSeen < peerTable[i].lastSeen)) {
+          i = j;
+        }
+      }
+    }
+    memset(&peerTable[i], 0, sizeof(peer_record_t));
+    memcpy(peerTable[i].mac, addr, 6);
+    rebuildPeerIndex();
+    prefCache.markDirty(PREF_DIRTY_PEER_TABLE);
+    warmStateDirty = true;
+  }
+  
+  if (role != PEER_ROLE_UNKNOWN && peerTable[i].role != role) {
+    peerTable[i].role = role;
+    prefCache.markDirty(PREF_DIRTY_PEER_TABLE);
+  }
+  peerTable[i].flags |= PEER_FLAG_SEEN;
+  peerTable[i].lastSeen = millis();
+  peerTable[i].rxFrames++;
+  portEXIT_CRITICAL(&prefMux);
+  
+  return i;
+}
+
+void restorePeers() {
+  for (int i = 0; i < peerCount; i++) {
+    if (esp_now_is_peer_exist(peerTable[i].mac)) {
+      continue;
+    }
+    esp_now_peer_info_t peerInfo = {};
+    memcpy(peerInfo.peer_addr, peerTable[i].mac, 6);
+    peerInfo.channel = 0;  // Whatever channel the radio is on
+    peerInfo.encrypt = false;
+    esp_now_add_peer(&peerInfo);
+  }
+}
+
+void attachRadio() {
+  esp_now_register_recv_cb(onDataReceived);
+  esp_now_register_send_cb(onDataSent);
+  restorePeers();
+  linkQuality.begin(onPromiscuous);
+  linkAdapter.apply();
+}
+
+bool loadPeerTable() {
+  peerCount = 0;
+  
+  size_t tableLen = preferences.getBytesLength("peers");
+  if (tableLen > 0 && tableLen % sizeof(peer_record_t) == 0) {
+    peerCount = min((int)(tableLen / sizeof(peer_record_t)), MAX_PEERS);
+    preferences.getBytes("peers", peerTable, peerCount * sizeof(peer_record_t));
+    savedPeers.stored(peerTable, peerCount * sizeof(peer_record_t));
+  } else if (preferences.getBytesLength("last_sender") == 6) {
+    // Migrate the old single peer key into the table
+    memset(&peerTable[0], 0, sizeof(peer_record_t));
+    preferences.getBytes("last_sender", peerTable[0].mac, 6);
+    peerTable[0].role = PEER_ROLE_SENDER;
+    peerCount = 1;
+    legacyPeerKey = true;
+    prefCache.markDirty(PREF_DIRTY_PEER_TABLE);
+  }
+  
+  // Find the most recently seen sender to answer by default, preferring senders we paired with
+  int latest = -1;
+  for (int i = 0; i < peerCount; i++) {
+    peerTable[i].flags &= ~PEER_FLAG_SEEN;
+    bool paired = peerTable[i].role == PEER_ROLE_SENDER;
+    bool latestPaired = latest >= 0 && peerTable[latest].role == PEER_ROLE_SENDER;
+    if (latest < 0 || (paired && !latestPaired) ||
+        (paired == latestPaired && peerTable[i].lastSeen > peerTable[latest].lastSeen)) {
+      latest = i;
+    }
+  }
+  if (latest >= 0) {
+    memcpy(lastSenderMac, peerTable[latest].mac, 6);
+  }
+  
+  rebuildPeerIndex();
+  return peerCount > 0;
+}
+
+void flushPreferences() {
+  uint32_t dirty = prefCache.collect(millis());
+  if (dirty == 0) {
+    return;
+  }
+  
+  // Take a consistent snapshot of everything that needs writing
+  static peer_record_t table[MAX_PEERS];
+  portENTER_CRITICAL(&prefMux);
+  int count = peerCount;
+  memcpy(table, peerTable, count * sizeof(peer_record_t));
+  uint8_t channel = wifiChannel;
+  portEXIT_CRITICAL(&prefMux);
+  
+  if (dirty & PREF_DIRTY_PEER_TABLE) {
+    // Flags are runtime only
+    for (int i = 0; i < count; i++) {
+      table[i].flags = 0;
+    }
+    
+    if (savedPeers.differs(table, count * sizeof(peer_record_t))) {
+      preferences.putBytes("peers", table, count * sizeof(peer_record_t));
+      savedPeers.stored(table, count * sizeof(peer_record_t));
+      prefCache.wrote();
+      Serial.printf("Saved peer table (%d peer(s))\n", count);
+    }
+    
+    if (legacyPeerKey) {
+      preferences.remove("last_sender");
+      legacyPeerKey = false;
+    }
+  }
+  
+  if (dirty & PREF_DIRTY_CHANNEL) {
+    preferences.putUChar("channel", channel);
+    prefCache.wrote();
+    Serial.printf("Saved WiFi channel %u\n", channel);
+  }
+}
+
+bool restoreWarmState() {
+  if (!warmStateValid(warmState, WARM_STATE_VERSION)) {
+    return false;
+  }
+  
+  if (warmState.activeLedIndex >= 0 && warmState.activeLedIndex < NUM_LEDS) {
+    activeLedIndex = warmState.activeLedIndex;
+    pinMode(LED_PINS[activeLedIndex], OUTPUT);
+    digitalWrite(LED_PINS[activeLedIndex], LOW);  // Turn ON (active LOW)
+  }
+  consecutiveSleepCycles = warmState.consecutiveSleepCycles;
+  forceExtendedAwake = warmState.forceExtendedAwake;
+  driftEstimator.restore(warmState.drift);
+  
+  // Peers are applied once the peer table has been loaded from flash
+  return true;
+}
+
+void saveWarmState() {
+  warmStateDirty = false;
+  
+  portENTER_CRITICAL(&prefMux);
+  warmState.peerCount = peerCount;
+  memcpy(warmState.peers, peerTable, peerCount * sizeof(peer_record_t));
+  memcpy(warmState.lastSenderMac, lastSenderMac, 6);
+  portEXIT_CRITICAL(&prefMux);
+  
+  warmState.activeLedIndex = activeLedIndex;
+  warmState.consecutiveSleepCycles = consecutiveSleepCycles;
+  warmState.forceExtendedAwake = forceExtendedAwake;
+  warmState.drift = driftEstimator.save();
+  warmStateSeal(warmState, WARM_STATE_VERSION);
 }
 
 void printMacAddress(const uint8_t *addr) {
   char macStr[18];
   snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
            addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
-  Serial.println(macStr);
+  asyncLog.println(macStr);
+}
+
+void onPromiscuous(void *buf, wifi_promiscuous_pkt_type_t type) {
+  // Runs in the WiFi task ahead of the ESP-NOW receive callback for the same frame
+  const wifi_promiscuous_pkt_t *packet = (const wifi_promiscuous_pkt_t *)buf;
+  linkQuality.capture(packet, type);
+  survey.frame(packet);
 }
 
 void onDataReceived(const uint8_t *macAddr, const uint8_t *data, int dataLen) {
+  // Runs in the WiFi task - hand the frame to the protocol task and return
+  radio_event_t event;
+  if (dataLen > RADIO_EVENT_MAX_LEN) {
+    radioQueueDrops.inc();
+    return;
+  }
+  event.type = RADIO_EVENT_RX;
+  memcpy(event.mac, macAddr, 6);
+  event.len = dataLen;
+  event.rssi = LINK_RSSI_NONE;
+  event.channel = 0;
+  event.rxMs = millis();
+  rx_capture_t capture;
+  if (linkQuality.lookup(macAddr, capture)) {
+    event.rssi = capture.rssi;
+    event.channel = capture.channel;
+  }
+  memcpy(event.data, data, dataLen);
+  
+  if (xQueueSend(radioQueue, &event, 0) != pdTRUE) {
+    radioQueueDrops.inc();
+  }
+  radioQueueMaxDepth.raise(uxQueueMessagesWaiting(radioQueue));
+}
+
+void onDataSent(const uint8_t *macAddr, esp_now_send_status_t status) {
+  radio_event_t event;
+  event.type = RADIO_EVENT_TX_DONE;
+  memcpy(event.mac, macAddr, 6);
+  event.status = status;
+  event.len = 0;
+  
+  if (xQueueSend(radioQueue, &event, 0) != pdTRUE) {
+    radioQueueDrops.inc();
+  }
+}
+
+void handleRadioEvent(const radio_event_t &event) {
+  const uint8_t *macAddr = event.mac;
+  
+  if (event.type == RADIO_EVENT_TX_DONE) {
+    if (event.status != ESP_NOW_SEND_SUCCESS) {
+      deliveryFailures.inc();
+    }
+    
+    // Per-peer delivery statistics
+    portENTER_CRITICAL(&prefMux);
+    int i = findPeer(macAddr);
+    if (i >= 0) {
+      if (event.status == ESP_NOW_SEND_SUCCESS) {
+        peerTable[i].txOk++;
+      } else {
+        peerTable[i].txFail++;
+      }
+    }
+    portEXIT_CRITICAL(&prefMux);
+    
+    // Delivery report for the acknowledgment in flight
+    if (ackTargetValid && memcmp(macAddr, ackTargetMac, 6) == 0) {
+      ackSendOk = (event.status == ESP_NOW_SEND_SUCCESS);
+      ackSendDone = true;
+      linkAdapter.delivered(ackSendOk);  // The sender listens right after its command
+    }
+    return;
+  }
+  
+  framesReceived.inc();
+  linkQuality.record(macAddr, event.rssi, event.channel, event.rxMs);
+  
+  // Sender beacons and other indicators' announcements are broadcast, they are neither a peer
+  // nor a wake hint for us. Survey probes only need to be delivered.
+  if (event.len >= MESSAGE_BASE_LEN &&
+      (event.data[0] == BEACON || (event.data[0] == DISCOVERY && event.data[1] == DISCOVERY_ANNOUNCE) ||
+       (event.data[0] == SURVEY && event.data[1] == SURVEY_PROBE))) {
+    return;
+  }
+  
   // Print who sent this data
   char macStr[18];
   snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
            macAddr[0], macAddr[1], macAddr[2], macAddr[3], macAddr[4], macAddr[5]);
   
-  Serial.print("Received data from: ");
-  Serial.println(macStr);
+  asyncLog.print("Received data from: ");
+  asyncLog.println(macStr);
   
-  // Process only if data length matches our message structure
-  if (dataLen == sizeof(message_t)) {
-    message_t *message = (message_t *)data;
+  // Process only if data length matches our message structure (with or without wake hint)
+  if (event.len == sizeof(message_t) || event.len == MESSAGE_BASE_LEN) {
+    message_t message = {};
+    memcpy(&message, event.data, event.len);
     
-    // Save the sender's address for potential responses
+    // Once paired, only senders we already know may pair with us again
+    if (message.type == DISCOVERY && hasSenderPeer() && findPeer(macAddr) < 0) {
+      asyncLog.println("Ignoring discovery request, already paired with another sender");
+      return;
+    }
+    // and only our senders may drive the LEDs
+    if (message.type == LED_COMMAND && hasSenderPeer()) {
+      int peer = findPeer(macAddr);
+      if (peer < 0 || peerTable[peer].role != PEER_ROLE_SENDER) {
+        asyncLog.println("Ignoring LED command, already paired with another sender");
+        return;
+      }
+    }
+
+    // Track the sender and save its address for potential responses. Answering a discovery
+    // request commits us to nothing, a sender becomes ours with its first LED command.
+    updatePeer(macAddr, (message.type == LED_COMMAND) ? PEER_ROLE_SENDER : PEER_ROLE_UNKNOWN);
+    if (event.rssi != LINK_RSSI_NONE) {
+      linkAdapter.rssi(event.rssi);  // Our acknowledgments take the same path back
+    }
+    if (memcmp(lastSenderMac, macAddr, 6) != 0) {
+      driftEstimator.forget();  // Announcements only say something about their own sender
+    }
     memcpy(lastSenderMac, macAddr, 6);
     
-    switch (message->type) {
+    switch (message.type) {
       case LED_COMMAND: {
-        Serial.printf("Received LED command: %d\n", message->value);
+        asyncLog.printf("Received LED command: %d\n", message.value);
+        if (message.value == activeLedIndex) {
+          duplicateCommands.inc();  // Our acknowledgment did not get through
+        }
         // Update last command time and reset counter
         lastCommandTime = millis();
+        protocolTimers.arm(nextSleepTimer, AWAKE_AFTER_COMMAND_MS);
         consecutiveSleepCycles = 0;
         forceExtendedAwake = false;  // Cancel any forced awake period
-        handleLedCommand(message->value, macAddr);
+        handleLedCommand(message.value, macAddr);
         break;
       }
         
       case DISCOVERY: {
-        Serial.println("Received discovery request");
-        savePeerAddress(macAddr);
+        asyncLog.println("Received discovery request");
+        memcpy(discoveryTarget, macAddr, 6);
         sendDiscoveryResponse = true;
         lastCommandTime = millis();
+        protocolTimers.arm(nextSleepTimer, AWAKE_AFTER_COMMAND_MS);
         consecutiveSleepCycles = 0;
         forceExtendedAwake = false;  // Cancel any forced awake period
         break;
       }
         
+      case HEARTBEAT: {
+        // Nothing to answer, sleep again until the announced transmission
+        protocolTimers.arm(nextSleepTimer, 0);
+        break;
+      }
+        
+      case SURVEY: {
+        if (message.value != SURVEY_START || survey.active()) {
+          break;
+        }
+        asyncLog.println("Channel survey requested");
+        survey.begin(event.rxMs + message.etaMs);
+        linkQuality.captureAll(true);
+        CO_RESET(surveyFlow);
+        lastCommandTime = millis();  // Stay awake through it
+        protocolTimers.arm(nextSleepTimer, AWAKE_AFTER_COMMAND_MS);
+        break;
+      }
+        
+      case CHANNEL_SWITCH: {
+        if (message.value < 1 || message.value > SURVEY_CHANNELS) {
+          asyncLog.printf("Invalid channel in switch request: %d\n", message.value);
+          break;
+        }
+        asyncLog.printf("Moving to channel %d in %u ms\n", message.value, message.etaMs);
+        pendingChannel = message.value;
+        protocolTimers.arm(channelSwitchTimer, max((long)(event.rxMs + message.etaMs - millis()), 0L));
+        lastCommandTime = millis();  // The sender checks the new channel right away
+        protocolTimers.arm(nextSleepTimer, AWAKE_AFTER_COMMAND_MS);
+        break;
+      }
+        
       default: {
-        Serial.printf("Unknown message type: %d\n", message->type);
+        asyncLog.printf("Unknown message type: %d\n", message.type);
         break;
       }
     }
+    
+    // Survey and switch timing says nothing about the next transmission
+    if (message.type != SURVEY && message.type != CHANNEL_SWITCH) {
+      if (wakeHintValid) {
+        hintError.record(abs((long)(event.rxMs - wakeHintAt)));
+      }
+      driftEstimator.frame(event.rxMs, message.etaMs);
+      applyWakeHint(event.rxMs, message.etaMs);
+    }
+  }
+}
+
+CoStatus processChannelSurvey() {
+  CO_BEGIN(surveyFlow);
+  
+  // Same schedule as the sender, counted from when its request arrived
+  CO_WAIT_TIMER(surveyFlow, protocolTimers, surveyTimer, survey.msUntilStart(millis()));
+  while (survey.channelAt(millis()) != 0) {
+    esp_wifi_set_channel(survey.channelAt(millis()), WIFI_SECOND_CHAN_NONE);
+    survey.tunedTo(survey.channelAt(millis()));
+    CO_WAIT_TIMER(surveyFlow, protocolTimers, surveyTimer, survey.msUntilNextHop(millis()));
+  }
+  
+  survey.finish();
+  linkQuality.captureAll(false);
+  esp_wifi_set_channel(wifiChannel, WIFI_SECOND_CHAN_NONE);
+  asyncLog.println("Channel survey complete:");
+  survey.printStats(asyncLog);
+  
+  CO_END(surveyFlow);
+}
+
+void switchChannel(WheelTimer &timer, void *arg) {
+  esp_wifi_set_channel(pendingChannel, WIFI_SECOND_CHAN_NONE);
+  radioRecovery.setChannel(pendingChannel);
+  portENTER_CRITICAL(&prefMux);
+  wifiChannel = pendingChannel;
+  prefCache.markDirty(PREF_DIRTY_CHANNEL);
+  portEXIT_CRITICAL(&prefMux);
+  linkAdapter.reset();  // Start over from the robust setting on the new channel
+  asyncLog.printf("Now on WiFi channel %d\n", wifiChannel);
+}
+
+void applyWakeHint(uint32_t rxMs, uint16_t etaMs) {
+  if (etaMs == WAKE_HINT_NONE) {
+    wakeHintValid = false;
+    return;
+  }
+  
+  // The announced time is in the sender's clock, measure from when the frame arrived
+  wakeHintAt = rxMs + driftEstimator.toLocalMs(etaMs);
+  wakeHintValid = true;
+  asyncLog.printf("Sender transmits next in %u ms\n", etaMs);
+  
+  // Power-managed mode has no sleep length to pick, keep the radio on across the window instead
+  if (powerManager.active()) {
+    protocolTimers.arm(wakeWindowTimer, max((long)(wakeHintAt - millis()) - (long)wakeHintGuardMs(), 0L));
   }
 }
 
+void openWakeWindow(WheelTimer &timer, void *arg) {
+  powerManager.stayAwake(true);
+  protocolTimers.arm(nextSleepTimer, 2 * wakeHintGuardMs());
+}
+
+uint32_t wakeHintGuardMs() {
+  // Narrows from the fixed worst case as the drift estimate settles
+  long untilEta = max((long)(wakeHintAt - millis()), 0L);
+  return driftEstimator.guardMs(untilEta);
+}
+
+uint32_t nextSleepDurationMs() {
+  if (!wakeHintValid) {
+    return SLEEP_DURATION_MS;
+  }
+  
+  // Wake early enough to have the radio back up before the guard band opens
+  long sleepMs = (long)(wakeHintAt - millis()) - (long)wakeHintGuardMs() - SLEEP_REINIT_MS;
+  if (sleepMs < MIN_SLEEP_MS) {
+    return 0;
+  }
+  return min((unsigned long)sleepMs, WAKE_HINT_MAX_SLEEP_MS);
+}
+
 void handleLedCommand(uint8_t ledIndex, const uint8_t *senderAddr) {
   // Validate LED index
   if (ledIndex >= NUM_LEDS) {
-    Serial.println("Invalid LED index received");
+    asyncLog.println("Invalid LED index received");
     return;
   }
   
-  // Turn off current active LED if any
-  if (activeLedIndex >= 0) {
-    digitalWrite(LED_PINS[activeLedIndex], HIGH);  // Turn OFF
-  }
-  
-  // Turn on new LED
-  digitalWrite(LED_PINS[ledIndex], LOW);  // Turn ON (active LOW)
+  // Hand the new state to the LED task, which also ends a running self-test
   activeLedIndex = ledIndex;
+  setLedOutput(activeLedIndex);
+  warmStateDirty = true;
   
-  Serial.printf("Activated LED on pin: %d\n", LED_PINS[ledIndex]);
+  asyncLog.printf("Activated LED on pin: %d\n", LED_PINS[ledIndex]);
   
   // Start acknowledgment process
-  ackTargetAddr = senderAddr;
+  memcpy(ackTargetMac, senderAddr, 6);
+  ackTargetValid = true;
   ackState = ACK_INIT;
-  ackAttemptCount = 0;
+  CO_RESET(ackFlow);
   processAcknowledgment(); // Begin processing immediately
 }
 
-void processAcknowledgment() {
-  static unsigned long ackTimer = 0;
-  unsigned long currentTime = millis();
+esp_err_t registerPeer(const uint8_t *addr) {
+  esp_now_peer_info_t peerInfo = {};
+  memcpy(peerInfo.peer_addr, addr, 6);
+  peerInfo.channel = 0;  // Whatever channel the radio is on
+  peerInfo.encrypt = false;
   
-  switch (ackState) {
-    case ACK_INIT:
-      // Create peer info structure
-      ackTimer = currentTime;
-      ackState = ACK_PEER_SETUP;
-      // Fall through to next state
-      
-    case ACK_PEER_SETUP:
-      {
-        if (ackTargetAddr == NULL) {
-          ackState = ACK_COMPLETE;
-          break;
-        }
-        
-        esp_now_peer_info_t peerInfo = {};
-        memcpy(peerInfo.peer_addr, ackTargetAddr, 6);
-        peerInfo.channel = WIFI_CHANNEL;
-        peerInfo.encrypt = false;
-        
-        // More reliable peer management - check before deleting
-        if (esp_now_is_peer_exist(ackTargetAddr)) {
-          esp_now_del_peer(ackTargetAddr);
-        }
-        
-        // Add peer
-        esp_err_t result = esp_now_add_peer(&peerInfo);
-        
-        if (result != ESP_OK && currentTime - ackTimer < 10) {
-          // Need to wait a bit before retrying
-          break;
-        } else if (result != ESP_OK) {
-          // Retry once more if failed
-          result = esp_now_add_peer(&peerInfo);
-        }
-        
-        if (result != ESP_OK) {
-          Serial.printf("Peer management error: %d\n", result);
-          ackState = ACK_COMPLETE;
-        } else {
-          ackState = ACK_SEND;
-          ackTimer = currentTime;
-        }
-      }
-      break;
-      
-    case ACK_SEND:
-      {
-        message_t message;
-        message.type = ACKNOWLEDGMENT;
-        message.value = activeLedIndex;
-        
-        esp_err_t result = esp_now_send(ackTargetAddr, (uint8_t *)&message, sizeof(message));
-        if (result == ESP_OK) {
-          Serial.printf("Acknowledgment %d sent successfully\n", ackAttemptCount + 1);
-        } else {
-          Serial.printf("Error on attempt %d: %d\n", ackAttemptCount + 1, result);
-        }
-        
-        ackAttemptCount++;
-        ackTimer = currentTime;
-        ackState = ACK_WAIT;
-      }
-      break;
-      
-    case ACK_WAIT:
-      if (currentTime - ackTimer >= 20) {
-        // Wait is complete, check if we need more attempts
-        if (ackAttemptCount < 3) {
-          ackState = ACK_SEND;
-        } else {
-          Serial.printf("Completed acknowledgments for LED index: %d\n", activeLedIndex);
-          ackState = ACK_COMPLETE;
-        }
-      }
-      break;
-      
-    case ACK_COMPLETE:
-      // Reset for next time
-      ackState = ACK_INIT;
-      ackTargetAddr = NULL;
-      break;
+  // More reliable peer management - check before deleting
+  if (esp_now_is_peer_exist(addr)) {
+    esp_now_del_peer(addr);
+  }
+  
+  esp_err_t result = esp_now_add_peer(&peerInfo);
+  if (result != ESP_OK) {
+    peerAddFailures.inc();
   }
+  return result;
 }
 
-void processDiscoveryResponse() {
-  static unsigned long discoveryTimer = 0;
-  unsigned long currentTime = millis();
+CoStatus processAcknowledgment() {
+  esp_err_t result;
   
-  switch (discoveryState) {
-    case DISCOVERY_PEER_SETUP:
-      {
-        esp_now_peer_info_t peerInfo = {};
-        memcpy(peerInfo.peer_addr, lastSenderMac, 6);
-        peerInfo.channel = WIFI_CHANNEL;
-        peerInfo.encrypt = false;
-        
-        // More reliable peer management - check before deleting
-        if (esp_now_is_peer_exist(lastSenderMac)) {
-          esp_now_del_peer(lastSenderMac);
-        }
-        
-        // Add with error checking
-        esp_err_t result = esp_now_add_peer(&peerInfo);
-        
-        if (result != ESP_OK && currentTime - stateTimer < 10) {
-          // Need to wait a bit before retrying
-          break;
-        } else if (result != ESP_OK) {
-          // Retry once more
-          result = esp_now_add_peer(&peerInfo);
-        }
-        
-        if (result != ESP_OK) {
-          Serial.printf("Peer management error: %d\n", result);
-          discoveryState = DISCOVERY_COMPLETE;
-        } else {
-          discoveryState = DISCOVERY_SEND;
-        }
-      }
-      break;
-      
-    case DISCOVERY_SEND:
-      {
-        message_t message;
-        message.type = DISCOVERY;
-        message.value = 0;
-        
-        esp_err_t result = esp_now_send(lastSenderMac, (uint8_t *)&message, sizeof(message));
-        Serial.printf("Discovery response status: %s\n", 
-                      (result == ESP_OK) ? "Success" : "Failed");
-        
-        sendDiscoveryResponse = false;
-        discoveryState = DISCOVERY_COMPLETE;
+  CO_BEGIN(ackFlow);
+  
+  ackState = ACK_PEER_SETUP;
+  if (!ackTargetValid) {
+    ackState = ACK_COMPLETE;
+    CO_EXIT(ackFlow);
+  }
+  
+  result = registerPeer(ackTargetMac);
+  if (result != ESP_OK) {
+    // Wait a bit and retry once more
+    CO_WAIT_TIMER(ackFlow, protocolTimers, ackTimer, PEER_RETRY_MS);
+    result = registerPeer(ackTargetMac);
+  }
+  if (result != ESP_OK) {
+    asyncLog.printf("Peer management error: %d\n", result);
+    ackTargetValid = false;
+    ackState = ACK_COMPLETE;
+    CO_EXIT(ackFlow);
+  }
+  
+  ackSendOk = false;
+  for (ackAttemptCount = 0; ackAttemptCount < ACK_ATTEMPTS; ackAttemptCount++) {
+    ackState = ACK_SEND;
+    ackSendDone = false;
+    {
+      message_t message;
+      message.type = ACKNOWLEDGMENT;
+      message.value = activeLedIndex;
+      result = esp_now_send(ackTargetMac, (uint8_t *)&message, MESSAGE_BASE_LEN);
+    }
+    if (result == ESP_OK) {
+      asyncLog.printf("Acknowledgment %d sent successfully\n", ackAttemptCount + 1);
+    } else {
+      sendErrors.inc();
+      asyncLog.printf("Error on attempt %d: %d\n", ackAttemptCount + 1, result);
+      if (result == ESP_ERR_ESPNOW_NOT_INIT) {
+        radioRecovery.begin(result);
       }
+    }
+    
+    // Wait for the delivery report, once the sender has the ack there is no need to repeat it
+    ackState = ACK_WAIT;
+    protocolTimers.arm(ackTimer, ACK_INTERVAL_MS);
+    CO_AWAIT(ackFlow, (ackSendDone && ackSendOk) || !ackTimer.pending());
+    if (ackSendDone && ackSendOk) {
       break;
-      
-    case DISCOVERY_COMPLETE:
-      // Reset for next time
-      discoveryState = DISCOVERY_INIT;
-      break;
+    }
+  }
+  
+  if (ackSendOk) {
+    asyncLog.printf("Acknowledgment for LED index %d delivered\n", activeLedIndex);
+    ackAttempts.record(ackAttemptCount + 1);
+  } else {
+    acksUndelivered.inc();
+    asyncLog.printf("Completed acknowledgments for LED index: %d\n", activeLedIndex);
+  }
+  ackTargetValid = false;
+  ackState = ACK_COMPLETE;
+  
+  // The sender is listening right now, a good moment for telemetry
+  if (ackSendOk && millis() - lastTelemetryTime >= TELEMETRY_INTERVAL_MS) {
+    sendTelemetry(ackTargetMac);
+  }
+  
+  CO_END(ackFlow);
+}
+
+CoStatus processDiscoveryResponse() {
+  esp_err_t result;
+  
+  CO_BEGIN(discoveryFlow);
+  
+  discoveryState = DISCOVERY_PEER_SETUP;
+  result = registerPeer(discoveryTarget);
+  if (result != ESP_OK) {
+    // Wait a bit and retry once more
+    CO_WAIT_TIMER(discoveryFlow, protocolTimers, discoveryTimer, PEER_RETRY_MS);
+    result = registerPeer(discoveryTarget);
   }
+  
+  if (result != ESP_OK) {
+    asyncLog.printf("Peer management error: %d\n", result);
+  } else {
+    discoveryState = DISCOVERY_SEND;
+    message_t message;
+    message.type = DISCOVERY;
+    message.value = DISCOVERY_ANNOUNCE;
+    
+    result = esp_now_send(discoveryTarget, (uint8_t *)&message, MESSAGE_BASE_LEN);
+    if (result != ESP_OK) {
+      sendErrors.inc();
+    }
+    asyncLog.printf("Discovery response status: %s\n", 
+                    (result == ESP_OK) ? "Success" : "Failed");
+  }
+  
+  sendDiscoveryResponse = false;
+  discoveryState = DISCOVERY_COMPLETE;
+  
+  CO_END(discoveryFlow);
+}
+
+void printCoreStats() {
+  static TaskLoad *const loads[] = {&protocolLoad, &ledLoad, &appLoad};
+  
+  Serial.printf("\n--- CORE STATS (%lu ms) ---\n", CORE_STATS_INTERVAL_MS);
+  printCoreLoad(loads, sizeof(loads) / sizeof(loads[0]), CORE_STATS_INTERVAL_MS);
+  Serial.printf("Queues: radio %u/%d (max %u), log %u/%d (max %u)\n",
+                (unsigned)uxQueueMessagesWaiting(radioQueue), RADIO_QUEUE_LENGTH, radioQueueMaxDepth.value(),
+                asyncLog.depth(), LOG_QUEUE_LENGTH, asyncLog.maxDepth());
 }
 
 void printStatusUpdate() {
@@ -749,11 +1660,107 @@ void printStatusUpdate() {
   Serial.printf("Time since last command: %.2f seconds\n", 
                 (millis() - lastCommandTime) / 1000.0);
   Serial.printf("Consecutive sleep cycles: %d\n", consecutiveSleepCycles);
+  Serial.printf("Flash writes since boot: %u\n", prefCache.writes());
+  Serial.printf("Queue drops: radio=%u log=%u\n",
+                radioQueueDrops.value(), asyncLog.dropped());
+  Serial.printf("Known peers: %d\n", peerCount);
+  for (int i = 0; i < peerCount; i++) {
+    const peer_record_t &peer = peerTable[i];
+    Serial.printf("  %02X:%02X:%02X:%02X:%02X:%02X rx=%u txOk=%u txFail=%u\n",
+                  peer.mac[0], peer.mac[1], peer.mac[2], peer.mac[3], peer.mac[4], peer.mac[5],
+                  peer.rxFrames, peer.txOk, peer.txFail);
+  }
   Serial.printf("Current mode: %s\n", 
                 forceExtendedAwake ? "Extended awake" : 
                 ((millis() - lastCommandTime < AWAKE_AFTER_COMMAND_MS) ? 
                  "Post-command scanning" : "Normal sleep cycle"));
-  Serial.printf("MAC Address: %s\n", WiFi.macAddress().c_str());
-  Serial.printf("WiFi channel: %d\n", WIFI_CHANNEL);
+  Serial.printf("Power mode: %s\n", powerManager.active() ? "power-managed" : "manual sleep cycle");
+  Serial.printf("MAC Address: %02X:%02X:%02X:%02X:%02X:%02X\n",
+                ownMac[0], ownMac[1], ownMac[2], ownMac[3], ownMac[4], ownMac[5]);
+  Serial.printf("WiFi channel: %d\n", wifiChannel);
+  Serial.println("Clock drift:");
+  driftEstimator.printStats();
+  Serial.println("Link adaptation:");
+  linkAdapter.printStats();
+  Serial.println("Signal quality:");
+  linkQuality.printStats();
+  Serial.println("Radio recovery:");
+  radioRecovery.printStats();
+  Serial.println("Metrics:");
+  Metric::printAll();
+  protocolProfile.printReport();
+  appProfile.printReport();
   Serial.println("---------------------");
+}
+
+void fillTelemetry(telemetry_t &record) {
+  unsigned long currentTime = millis();
+  memset(&record, 0, sizeof(record));
+  record.type = TELEMETRY;
+  record.version = TELEMETRY_VERSION;
+  record.uptimeS = currentTime / 1000;
+  record.activeLed = activeLedIndex;
+  record.channel = wifiChannel;
+  record.flags = (powerManager.active() ? TELEMETRY_POWER_MANAGED : 0) |
+                 (forceExtendedAwake ? TELEMETRY_EXTENDED_AWAKE : 0) |
+                 (warmRestored ? TELEMETRY_WARM_RESTART : 0) |
+                 (driftEstimator.settled() ? TELEMETRY_DRIFT_SETTLED : 0);
+  record.peerCount = peerCount;
+  record.sleepCycles = telemetryCount(totalSleepCycles);
+  record.lastCommandS = telemetryCount((currentTime - lastCommandTime) / 1000);
+  
+  uint32_t rxFrames = 0, txOk = 0, txFail = 0;
+  for (int i = 0; i < peerCount; i++) {
+    rxFrames += peerTable[i].rxFrames;
+    txOk += peerTable[i].txOk;
+    txFail += peerTable[i].txFail;
+  }
+  record.rxFrames = telemetryCount(rxFrames);
+  record.txOk = telemetryCount(txOk);
+  record.txFail = telemetryCount(txFail);
+  record.queueDrops = telemetryCount(radioQueueDrops.value() + asyncLog.dropped());
+  record.prefWrites = telemetryCount(prefCache.writes());
+  
+  uint32_t recoveries = 0;
+  for (int level = 0; level < RECOVERY_LEVEL_COUNT; level++) {
+    recoveries += radioRecovery.stats((RecoveryLevel)level).attempts;
+  }
+  record.recoveries = telemetryCount(recoveries);
+  
+  const link_quality_t *sender = linkQuality.find(lastSenderMac);
+  if (sender != NULL) {
+    record.rssiAvg = sender->rssiAvg / 16;
+    record.rssiMin = sender->rssiMin;
+  }
+  record.phyRate = linkAdapter.rate();
+  record.txPowerDbm = linkAdapter.powerDbm();
+  record.skewPpm = max(min(driftEstimator.save().skewPpm, (int32_t)32767), (int32_t)-32768);
+  record.duplicates = telemetryCount(duplicateCommands.value());
+  record.txErrors = telemetryCount(sendErrors.value());
+  record.peerAddFails = telemetryCount(peerAddFailures.value());
+  record.initFails = telemetryCount(initFailures.value());
+}
+
+void sendTelemetry(const uint8_t *addr) {
+  telemetry_t record;
+  fillTelemetry(record);
+  record.sequence = telemetrySequence;
+  esp_err_t result = esp_now_send(addr, (uint8_t *)&record, sizeof(record));
+  if (result == ESP_OK) {
+    telemetrySequence++;  // Gaps the sender sees are records lost on the air
+    lastTelemetryTime = millis();
+  } else {
+    sendErrors.inc();
+  }
+  asyncLog.printf("Telemetry %u sent (%s)\n", record.sequence, (result == ESP_OK) ? "ok" : "failed");
+}
+
+void printTelemetry() {
+  telemetry_t record;
+  char line[TELEMETRY_LINE_LEN];
+  fillTelemetry(record);
+  record.sequence = localTelemetrySequence++;
+  record.flags |= TELEMETRY_LOCAL;
+  formatTelemetry(ownMac, record, line);
+  Serial.println(line);
 }
\ No newline at end of file
@@ -2,8 +2,8 @@
  * ESP32 ESP-NOW LED Indicator System - SENDER CODE
  * 
  * This file contains code specifically for the sender device.
- * It implements improved communication reliability, automatic
- * progression when acknowledgments are not received, and non-blocking operation.
+ * It implements improved communication reliability, a latest-wins
+ * command queue for the indicator, and non-blocking operation.
  */
 
 #include <Arduino.h>
@@ -11,6 +11,24 @@
 #include <WiFi.h>
 #include <esp_wifi.h>
 #include <Preferences.h>
+#include <esp_system.h>
+#include "warm_state.h"
+#include "radio_recovery.h"
+#include "async_log.h"
+#include "core_stats.h"
+#include "coroutine.h"
+#include "timer_wheel.h"
+#include "power_manager.h"
+#include "tdma_schedule.h"
+#include "channel_scan.h"
+#include "channel_survey.h"
+#include "link_adapter.h"
+#include "link_quality.h"
+#include "telemetry.h"
+#include "metrics.h"
+#include "state_trace.h"
+#include "loop_profiler.h"
+#include "command_queue.h"
 
 // Configuration constants
 const int NUM_LEDS = 3;
@@ -20,16 +38,51 @@ const char* PREF_NAMESPACE = "espnow-leds";
 
 // Timing constants - optimized for reliability
 const int RETRY_INTERVAL_MS = 500;      // 0.5 seconds between retry attempts
+const int RETRY_JITTER_MS = 100;        // Random extra spacing, so two senders that collided drift apart
 const int NEXT_LED_DELAY_MS = 10000;    // 10 seconds before switching to next LED
 const int MAX_RETRIES_BEFORE_WAIT = 12; // Maximum number of retries before waiting
+const unsigned long BACKOFF_MIN_MS = 2000;   // First pause after the retries went unanswered
+const unsigned long BACKOFF_MAX_MS = 60000;  // Pauses double up to this while the indicator stays silent
+const int HEARTBEAT_INTERVAL_MS = 5000; // Heartbeat spacing while holding an acknowledged LED
+const int BOOT_WIFI_SETTLE_MS = 20;     // Wait after WiFi mode change
+const int BOOT_CHANNEL_SETTLE_MS = 20;  // Wait after setting the channel
+
+// Channel scan - a whole sweep fits into one indicator wake window, so the first window
+// the indicator opens is the one that finds it
+const int INDICATOR_AWAKE_MS = 300;      // Indicator listen window (AWAKE_TIME_MS there)
+const int INDICATOR_CYCLE_MS = 2100;     // Window + light sleep + radio bring-up
+const int CHANNEL_DWELL_MS = 20;         // Longest stay on one channel, the probe result usually ends it sooner
+const unsigned long CHANNEL_SCAN_TIMEOUT_MS = 3 * INDICATOR_CYCLE_MS;
+static_assert((CHANNEL_COUNT + 1) * CHANNEL_DWELL_MS <= INDICATOR_AWAKE_MS,
+              "A channel sweep must fit into one indicator wake window");
+
+// Channel survey - run after an acknowledgment, while the indicator is awake anyway
+const unsigned long SURVEY_INTERVAL_MS = 3600000;  // Re-check the channels every hour
+const int SURVEY_MIN_FRAMES = 20;        // Hinted frames needed before delivery can trigger a survey
+const int SURVEY_TRIGGER_PERCENT = 80;   // Survey early when fewer of those were delivered
+const int SURVEY_PROBE_INTERVAL_MS = 20; // Probe spacing within a channel's dwell
+const int SURVEY_REQUEST_ATTEMPTS = 3;
+const int CHANNEL_SWITCH_DELAY_MS = 100; // Announced time until both sides retune
+const int CHANNEL_SWITCH_ATTEMPTS = 5;
+
+// Task runtime
+const int RADIO_QUEUE_LENGTH = 8;        // Radio events buffered between callbacks and protocol task
+const int RADIO_EVENT_MAX_LEN = 64;      // Largest frame payload carried through the queue
+const int PROTOCOL_CORE = PRO_CPU_NUM;   // Radio handling shares the core with the WiFi driver
+const int APP_CORE = APP_CPU_NUM;        // Logging and status output
+const int PROTOCOL_TASK_STACK = 4096;
+const int PROTOCOL_TASK_PRIORITY = 3;
+const int APP_TASK_STACK = 4096;
+const int APP_TASK_PRIORITY = 1;
+const int PROTOCOL_POLL_MS = 5;          // Wake interval while a state machine is mid-flight
 
 // Setup state machine states
 enum SetupState {
   SETUP_INIT,
-  SETUP_SERIAL_WAIT,
   SETUP_ESPNOW_START,
   SETUP_WIFI_DISCONNECT_WAIT,
   SETUP_WIFI_CHANNEL_WAIT,
+  SETUP_PAIRING,
   SETUP_PEER_ATTEMPT,
   SETUP_PEER_WAIT,
   SETUP_COMPLETE
@@ -43,45 +96,260 @@ enum PeerSetupState {
   PEER_COMPLETE
 };
 
+// State names for the transition trace (-D STATE_TRACE), in enum order
+const char *const SETUP_STATE_NAMES[SETUP_COMPLETE + 1] = {
+  "INIT", "ESPNOW_START", "WIFI_DISCONNECT_WAIT", "WIFI_CHANNEL_WAIT",
+  "PAIRING", "PEER_ATTEMPT", "PEER_WAIT", "COMPLETE"
+};
+const char *const PEER_STATE_NAMES[PEER_COMPLETE + 1] = {
+  "INIT", "ATTEMPT", "RETRY_WAIT", "COMPLETE"
+};
+const trace_machine_t SETUP_TRACE = {"setup", SETUP_STATE_NAMES, SETUP_COMPLETE + 1};
+const trace_machine_t PEER_TRACE = {"peer", PEER_STATE_NAMES, PEER_COMPLETE + 1};
+
 // Message types for communication protocol
 enum MessageType {
   LED_COMMAND = 1,
   ACKNOWLEDGMENT = 2,
-  DISCOVERY = 3
+  DISCOVERY = 3,
+  HEARTBEAT = 4,
+  BEACON = 5,       // Broadcast frame timing (value = slot in use, etaMs = next frame start)
+  SURVEY = 6,       // Channel survey (value = SurveyKind, etaMs = time until the first hop)
+  CHANNEL_SWITCH = 7,  // Move the pair (value = new channel, etaMs = time until both retune)
+  TELEMETRY = TELEMETRY_TYPE  // Indicator status record (telemetry_t), logged for the host decoder
+};
+
+// SURVEY values
+enum SurveyKind {
+  SURVEY_START = 0,
+  SURVEY_PROBE = 1
+};
+
+// DISCOVERY values
+enum DiscoveryKind {
+  DISCOVERY_REQUEST = 0,   // Broadcast by unpaired senders
+  DISCOVERY_ANNOUNCE = 1   // Indicator answering a request or announcing itself after boot
 };
 
 // ESP-NOW message structure
-typedef struct {
+typedef struct __attribute__((packed)) {
   uint8_t type;     // Message type (see MessageType enum)
   uint8_t value;    // LED index or acknowledgment value
+  uint16_t etaMs;   // Wake hint: time until we transmit next, so the indicator can sleep until then
 } message_t;
 
+const size_t MESSAGE_BASE_LEN = 2;  // type + value, all that firmware without wake hints sends
+
+// Radio event passed from the ESP-NOW callbacks to the protocol task
+enum RadioEventType {
+  RADIO_EVENT_RX,
+  RADIO_EVENT_TX_DONE,
+  RADIO_EVENT_COMMAND   // A producer queued an LED state, only wakes the task
+};
+
+typedef struct {
+  uint8_t type;      // RadioEventType
+  uint8_t mac[6];
+  uint8_t status;    // esp_now_send_status_t for RADIO_EVENT_TX_DONE
+  uint8_t len;       // Payload length for RADIO_EVENT_RX
+  uint8_t channel;   // Channel we were tuned to when the event was queued
+  int8_t rssi;       // dBm for RADIO_EVENT_RX, LINK_RSSI_NONE if it was not captured
+  uint32_t rxMs;     // millis() when the frame arrived, for RADIO_EVENT_RX
+  uint8_t data[RADIO_EVENT_MAX_LEN];
+} radio_event_t;
+
+// Runtime state mirrored in RTC memory so a warm reset resumes where it left off
+const uint16_t WARM_STATE_VERSION = 1;
+const unsigned long WARM_STATE_REFRESH_MS = 1000;  // Refresh elapsed time at least this often
+const unsigned long WARM_STATE_REFRESH_LOW_POWER_MS = 5000;  // Fewer wakeups while sleeping between commands
+
+typedef struct {
+  warm_state_header_t header;
+  uint8_t currentLedIndex;
+  uint8_t acknowledged;
+  uint8_t retryCount;
+  uint8_t reserved;
+  uint32_t sinceLastSuccess;  // ms elapsed in the current command phase
+} sender_warm_state_t;
+
+// Paired indicator, persisted in preferences so later boots skip discovery
+typedef struct {
+  uint8_t mac[6];
+  uint8_t slot;      // TDMA wake slot
+  uint8_t channel;   // Channel it was last reached on, 0 = WIFI_CHANNEL
+} indicator_record_t;
+
 // Global variables
 Preferences preferences;
 
-// IMPORTANT: Replace with the MAC address of your indicator device
-uint8_t indicatorMac[6] = {0xE8, 0x31, 0xCD, 0xC6, 0xFE, 0x68};
+// Paired indicator, found by discovery on the first boot
+uint8_t indicatorMac[6] = {0};
+bool paired = false;
+uint8_t indicatorChannel = WIFI_CHANNEL;
+volatile uint8_t currentChannel = WIFI_CHANNEL;  // Written by the protocol task only
+unsigned long firstAckTime = 0;   // Boot to first acknowledged command, 0 until then
+const uint8_t BROADCAST_MAC[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+uint8_t ownMac[6] = {0};
+
+// Desired LED state of the indicator, requestLed() replaces whatever was not delivered yet
+CommandQueue commandQueue;
+uint32_t commandTicket = 0;       // Queue ticket of the state being sent
+uint32_t ackedTicket = 0;         // Ticket of the state acknowledged last
 
 // Sender state variables
 int currentLedIndex = 0;
 bool acknowledged = false;
-unsigned long lastSendTime = 0;
 unsigned long lastSuccessTime = 0;
 int retryCount = 0;
+unsigned long lastFrameTime = 0;  // Last command or heartbeat sent, the next deadlines count from it
+bool linkDelivered = false;       // Any frame of the current command reached the indicator
+bool channelScanned = false;      // Channel scan already tried for the current command
+unsigned long backoffMs = 0;      // Last pause after unanswered retries, 0 once the indicator answers
+
+// Channel scan state
+uint8_t scanOrder[CHANNEL_COUNT];
+int scanStep = 0;
+uint8_t scanFound = 0;            // Channel the probe was delivered on, 0 while searching
+unsigned long scanStartTime = 0;
+bool probeDone = false;
+bool probeOk = false;
+
+// Channel survey and delivery of frames the indicator is awake for (heartbeats)
+ChannelSurvey survey;
+unsigned long lastSurveyTime = 0;
+int surveyAttempt = 0;
+uint8_t surveyChoice = 0;         // Channel the survey picked
+unsigned long switchSentTime = 0;
+bool hintedFramePending = false;  // Delivery report outstanding for a heartbeat
+uint32_t hintedSent = 0;          // Heartbeats since the last survey or channel switch
+uint32_t hintedOk = 0;
+bool reportAfterSwitch = false;   // Log the delivery ratio once the new channel has enough frames
+
+// Rate and TX power adaptation, fed with frames the indicator is awake for
+bool linkFramePending = false;    // Delivery report outstanding for a command or heartbeat
+bool linkFrameCounted = false;    // ...which the indicator was listening for
+bool indicatorListening = false;  // It heard the last hint, so it wakes for the next frame
 
-// Setup state variables
-SetupState setupState = SETUP_INIT;
-PeerSetupState peerState = PEER_INIT;
-unsigned long setupTimer = 0;
+// Time slots (-D TDMA_SLOTS) - the indicator is only addressed in its slot while it follows our hints
+TdmaSchedule tdma;
+uint8_t indicatorSlot = TDMA_NO_SLOT;
+bool indicatorSynced = false;     // Acknowledged a slotted frame, so it wakes for the slot
+
+// Setup state variables, their transitions are recorded with -D STATE_TRACE
+StateTrace stateTrace;
+TracedState<SetupState> setupState(stateTrace, SETUP_TRACE, SETUP_INIT);
+TracedState<PeerSetupState> peerState(stateTrace, PEER_TRACE, PEER_INIT);
 int peerAttemptCount = 0;
 
+// Coroutine resume points, the enums above mark their current phase
+co_state_t setupFlow;
+co_state_t peerFlow;
+co_state_t commandFlow;
+co_state_t pairingFlow;
+co_state_t scanFlow;
+co_state_t surveyFlow;
+
+// Protocol task timers - advanced once per pass, the task blocks until the next expiry
+TimerWheel protocolTimers;
+WheelTimer setupTimer;
+WheelTimer peerTimer;
+WheelTimer retryTimer;      // Next send of an unacknowledged command (unarmed = send now)
+WheelTimer nextLedTimer;    // End of the hold time after an acknowledgment
+WheelTimer warmStateTimer;  // Periodic refresh of the RTC copy
+WheelTimer heartbeatTimer;
+WheelTimer pairingTimer;    // Next discovery broadcast while unpaired
+WheelTimer scanTimer;       // End of the dwell on the channel being scanned
+WheelTimer surveyTimer;     // Next survey probe or hop
+void sendBeacon(WheelTimer &timer, void *arg);
+WheelTimer beaconTimer(sendBeacon);         // Time slots: frame timing broadcast in the beacon slot
+
+// Task runtime - callbacks queue radio events, the protocol task sleeps until it has work.
+// The protocol task runs on the radio core and hands log lines to the application
+// core through a lock-free queue, so Serial output never delays a send.
+QueueHandle_t radioQueue = NULL;
+TaskHandle_t protocolTaskHandle = NULL;
+TaskHandle_t appTaskHandle = NULL;
+MetricCounter radioQueueDrops("radio.queue_drops");
+MetricGauge radioQueueMaxDepth("radio.queue_max");
+AsyncLog asyncLog;
+
+// Metrics, printed every METRICS_INTERVAL_MS
+const unsigned long METRICS_INTERVAL_MS = 60000;
+const uint32_t RETRY_BOUNDS[] = {0, 1, 2, 4, 8};
+const uint32_t ACK_LATENCY_BOUNDS_MS[] = {10, 20, 50, 100, 200, 500, 1000, 5000};
+MetricCounter framesReceived("rx.frames");
+MetricCounter duplicateAcks("rx.duplicates");
+MetricCounter sendErrors("tx.errors");
+MetricCounter deliveryFailures("tx.failed");
+MetricCounter peerAddFailures("peer.add_failed");
+MetricCounter initFailures("espnow.init_failed");
+MetricCounter commandsAcked("cmd.acked");
+MetricCounter commandBackoffs("cmd.backoff");
+MetricCounter commandsSuperseded("cmd.superseded");
+MetricHistogram<5> commandRetries("cmd.retries", RETRY_BOUNDS);                 // Resends before the ack
+MetricHistogram<8> ackLatency("cmd.ack_ms", ACK_LATENCY_BOUNDS_MS);            // First send to ack
+unsigned long commandStartTime = 0;
+
+// Per-core load in measurement mode (-D CORE_STATS)
+TaskLoad protocolLoad("protocol", PROTOCOL_CORE);
+TaskLoad appLoad("app", APP_CORE);
+
+// Iteration time and wake lateness per task in measurement mode (-D LOOP_PROFILE)
+LoopProfiler protocolProfile("protocol", "protocol.loop_us", "protocol.late_us");
+LoopProfiler appProfile("app", "app.loop_us", "app.late_us");
+
+// Radio recovery ladder used instead of ESP.restart() on ESP-NOW errors
+RadioRecovery radioRecovery(WIFI_CHANNEL, asyncLog);
+
+// Rate and TX power, adapted on delivery to the indicator
+LinkAdapter linkAdapter(asyncLog);
+
+// Signal strength of received frames, captured in promiscuous mode
+LinkQuality linkQuality;
+
+// Light sleep between transmissions (-D POWER_MANAGED_SLEEP)
+PowerManager powerManager;
+
+// Warm restart state
+RTC_NOINIT_ATTR sender_warm_state_t warmState;
+volatile bool warmStateDirty = false;
+unsigned long restoredPhaseMs = 0;  // Time already spent in the restored command phase
+
 // Function prototypes
 void setupEspNow();
+void attachRadio();
 bool setupPeer(bool isInitialSetup = false);
+CoStatus processPeerSetup(bool isInitialSetup);
+CoStatus processSetup();
+CoStatus processCommandCycle();
+CoStatus processPairing();
+CoStatus processChannelScan();
+CoStatus processChannelSurvey();
+bool surveyDue();
+void sendControl(uint8_t type, uint8_t value, uint16_t etaMs);
+void pairWith(const uint8_t *mac, uint8_t channel);
+void tuneChannel(uint8_t channel);
+void buildScanOrder();
+void sendDiscoveryRequest(const uint8_t *addr);
 void printMacAddress(const uint8_t *addr);
+bool requestLed(uint8_t ledIndex);
 void sendLedCommand();
+void sendHeartbeat();
+void handleBeacon(const uint8_t *macAddr, uint8_t slot, uint16_t etaMs, uint32_t rxMs);
+void addBroadcastPeer();
+bool loadPairing();
+void savePairing();
 void onDataSent(const uint8_t *macAddr, esp_now_send_status_t status);
 void onDataReceived(const uint8_t *macAddr, const uint8_t *data, int dataLen);
+void onPromiscuous(void *buf, wifi_promiscuous_pkt_type_t type);
+void protocolTask(void *param);
+void appTask(void *param);
+void printCoreStats();
+void processProtocol();
+TickType_t protocolWaitTicks();
+void handleRadioEvent(const radio_event_t &event);
+bool restoreWarmState();
+void saveWarmState();
 
 void setup() {
   Serial.begin(115200);
@@ -89,301 +357,1031 @@ void setup() {
   // Set CPU frequency to 80MHz for power efficiency
   setCpuFrequencyMhz(80);
   
-  // Initialize setup state machine
-  setupState = SETUP_SERIAL_WAIT;
-  setupTimer = millis();
-  
   // Initialize preferences for storing paired MAC addresses
   preferences.begin(PREF_NAMESPACE, false);
+  paired = loadPairing();
+  
+  // Resume the command sequence if RTC memory survived a warm reset
+  esp_reset_reason_t reason = esp_reset_reason();
+  if (reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT && restoreWarmState()) {
+    Serial.printf("Warm restart: resuming at LED index %d\n", currentLedIndex);
+  }
+  
+  // Start the task runtime, the log consumer first so it is ready for the protocol task
+  radioQueue = xQueueCreate(RADIO_QUEUE_LENGTH, sizeof(radio_event_t));
+  xTaskCreatePinnedToCore(appTask, "app", APP_TASK_STACK, NULL,
+                          APP_TASK_PRIORITY, &appTaskHandle, APP_CORE);
+  asyncLog.begin(appTaskHandle);
+  xTaskCreatePinnedToCore(protocolTask, "protocol", PROTOCOL_TASK_STACK, NULL,
+                          PROTOCOL_TASK_PRIORITY, &protocolTaskHandle, PROTOCOL_CORE);
 }
 
 void loop() {
-  unsigned long currentTime = millis();
+  // All work happens in the protocol and app tasks
+  vTaskDelete(NULL);
+}
+
+void protocolTask(void *param) {
+  radio_event_t event;
   
-  // Handle setup state machine
-  if (setupState != SETUP_COMPLETE) {
-    switch (setupState) {
-      case SETUP_SERIAL_WAIT:
-        // Wait for serial to initialize (non-blocking)
-        if (currentTime - setupTimer >= 500) {
-          Serial.print("\n\n==== ESP32 ESP-NOW LED System ====\n");
-          Serial.println("SENDER MODE");
-          Serial.println("FW Version: 2.0 - Reliable Communication (Non-blocking)");
-          Serial.println("This device will send LED commands to the indicator");
-          
-          setupState = SETUP_ESPNOW_START;
-        }
-        break;
-        
-      case SETUP_ESPNOW_START:
-        // Initialize WiFi in Station mode
-        WiFi.mode(WIFI_STA);
-        WiFi.disconnect();
-        setupTimer = currentTime;
-        setupState = SETUP_WIFI_DISCONNECT_WAIT;
-        break;
-        
-      case SETUP_WIFI_DISCONNECT_WAIT:
-        if (currentTime - setupTimer >= 300) {
-          // Set WiFi channel
-          esp_wifi_set_channel(WIFI_CHANNEL, WIFI_SECOND_CHAN_NONE);
-          setupTimer = currentTime;
-          setupState = SETUP_WIFI_CHANNEL_WAIT;
-        }
-        break;
-        
-      case SETUP_WIFI_CHANNEL_WAIT:
-        if (currentTime - setupTimer >= 100) {
-          // Initialize ESP-NOW with error checking
-          esp_err_t result = esp_now_init();
-          if (result != ESP_OK) {
-            Serial.print("Error initializing ESP-NOW, code: ");
-            Serial.println(result);
-            setupTimer = currentTime;
-            // Wait 3 seconds before restart (we'll check in next iteration)
-            setupState = SETUP_PEER_ATTEMPT;
-            ESP.restart();  // Restart ESP32 if initialization fails
-            return;
-          }
-          
-          // Register callbacks
-          esp_now_register_recv_cb(onDataReceived);
-          esp_now_register_send_cb(onDataSent);
-          
-          Serial.print("Device MAC Address: ");
-          Serial.println(WiFi.macAddress());
-          Serial.print("Operating on WiFi channel: ");
-          Serial.println(WIFI_CHANNEL);
-          Serial.print("Target indicator MAC: ");
-          printMacAddress(indicatorMac);
-          
-          peerState = PEER_INIT;
-          setupState = SETUP_PEER_ATTEMPT;
-        }
-        break;
-        
-      case SETUP_PEER_ATTEMPT:
-        if (setupPeer(true)) {
-          setupState = SETUP_COMPLETE;
-          setupTimer = currentTime;
-          
-          Serial.println("Sender ready, will begin sending LED commands");
-          Serial.println("Target indicator MAC address:");
-          printMacAddress(indicatorMac);
-          Serial.print("Using enhanced retry logic: ");
-          Serial.print(MAX_RETRIES_BEFORE_WAIT);
-          Serial.print(" retries every ");
-          Serial.print(RETRY_INTERVAL_MS);
-          Serial.println("ms");
-        }
-        break;
-        
-      case SETUP_COMPLETE:
-        // Wait 1 second before starting
-        if (currentTime - setupTimer >= 1000) {
-          lastSuccessTime = currentTime;
-          setupState = SETUP_COMPLETE;
-        }
-        break;
+  // Kick off the boot sequence, from then on timers and radio events drive the loop
+  protocolProfile.start(false);
+  processProtocol();
+  protocolProfile.stop();
+  
+  for (;;) {
+    // Sleep until a radio event arrives or the next deadline is due
+    TickType_t wait = protocolWaitTicks();
+    protocolProfile.waiting(wait);
+    bool received = xQueueReceive(radioQueue, &event, wait) == pdTRUE;
+    protocolLoad.start();
+    protocolProfile.start(!received);
+    if (received) {
+      protocolProfile.section("radio");
+      do {
+        handleRadioEvent(event);
+      } while (xQueueReceive(radioQueue, &event, 0) == pdTRUE);
+    }
+    
+    processProtocol();
+    protocolLoad.stop();
+    protocolProfile.stop();
+  }
+}
+
+void appTask(void *param) {
+  unsigned long lastMetricsTime = millis();
+  unsigned long waitMs = METRICS_INTERVAL_MS;
+#ifdef CORE_STATS
+  unsigned long lastCoreStatsTime = millis();
+  waitMs = min(waitMs, CORE_STATS_INTERVAL_MS);
+#endif
+#ifdef STATE_TRACE
+  waitMs = min(waitMs, TRACE_DUMP_INTERVAL_MS);
+#endif
+  const TickType_t wait = pdMS_TO_TICKS(waitMs);
+  
+  for (;;) {
+    // Woken by queued log lines, otherwise by the report deadlines
+    appProfile.waiting(wait);
+    bool notified = ulTaskNotifyTake(pdTRUE, wait) > 0;
+    appLoad.start();
+    appProfile.start(!notified);
+    appProfile.section("log");
+    asyncLog.drain();
+#ifdef STATE_TRACE
+    appProfile.section("trace");
+    stateTrace.dump();
+#endif
+    
+    if (millis() - lastMetricsTime >= METRICS_INTERVAL_MS) {
+      appProfile.section("metrics");
+      Serial.println("\n--- METRICS ---");
+      Metric::printAll();
+      protocolProfile.printReport();
+      appProfile.printReport();
+      lastMetricsTime = millis();
     }
     
+#ifdef CORE_STATS
+    if (millis() - lastCoreStatsTime >= CORE_STATS_INTERVAL_MS) {
+      appProfile.section("core_stats");
+      printCoreStats();
+      lastCoreStatsTime = millis();
+    }
+#endif
+    appLoad.stop();
+    appProfile.stop();
+  }
+}
+
+void printCoreStats() {
+  static TaskLoad *const loads[] = {&protocolLoad, &appLoad};
+  
+  Serial.printf("\n--- CORE STATS (%lu ms) ---\n", CORE_STATS_INTERVAL_MS);
+  printCoreLoad(loads, sizeof(loads) / sizeof(loads[0]), CORE_STATS_INTERVAL_MS);
+  Serial.printf("Queues: radio %u/%d (max %u, dropped %u), log %u/%d (max %u, dropped %u)\n",
+                (unsigned)uxQueueMessagesWaiting(radioQueue), RADIO_QUEUE_LENGTH,
+                radioQueueMaxDepth.value(), radioQueueDrops.value(),
+                asyncLog.depth(), LOG_QUEUE_LENGTH, asyncLog.maxDepth(), asyncLog.dropped());
+}
+
+TickType_t protocolWaitTicks() {
+  // Poll while the recovery ladder steps through its own short waits
+  if (radioRecovery.active() || warmStateDirty) {
+    return pdMS_TO_TICKS(PROTOCOL_POLL_MS);
+  }
+  
+  // Otherwise sleep until the next send, retry, peer retry or state refresh
+  return pdMS_TO_TICKS(max(protocolTimers.msUntilNext(NEXT_LED_DELAY_MS), (uint32_t)1));
+}
+
+void processProtocol() {
+  protocolProfile.section("timers");
+  protocolTimers.advance();
+  
+  // Run the boot sequence until it completes
+  if (setupState != SETUP_COMPLETE) {
+    protocolProfile.section("setup");
+    processSetup();
     return; // Don't process the rest of the loop until setup is complete
   }
   
+  // Bring the radio back after a runtime ESP-NOW failure
+  if (radioRecovery.active()) {
+    protocolProfile.section("recovery");
+    if (radioRecovery.process()) {
+      attachRadio();
+      peerState = PEER_INIT;  // Peers are lost with esp_now_deinit()
+      protocolTimers.arm(retryTimer, 0);  // Resend right away
+    }
+    return;
+  }
+  
   // Normal operation (after setup complete)
+  protocolProfile.section("command");
+  processCommandCycle();
+  
+  // Handle peer setup state machine (non-blocking)
+  if (peerState != PEER_COMPLETE) {
+    protocolProfile.section("peer");
+    setupPeer();
+  }
+  
+  // Keep the RTC copy of the runtime state current
+  if (warmStateDirty || !warmStateTimer.pending()) {
+    protocolProfile.section("warm_state");
+    saveWarmState();
+    protocolTimers.arm(warmStateTimer, powerManager.active() ? WARM_STATE_REFRESH_LOW_POWER_MS
+                                                             : WARM_STATE_REFRESH_MS);
+  }
+}
+
+CoStatus processSetup() {
+  esp_err_t result;
+  
+  CO_BEGIN(setupFlow);
+  
+  // No need to wait for the UART - output is buffered
+  asyncLog.print("\n\n==== ESP32 ESP-NOW LED System ====\n");
+  asyncLog.println("SENDER MODE");
+  asyncLog.println("FW Version: 2.0 - Reliable Communication (Non-blocking)");
+  asyncLog.println("This device will send LED commands to the indicator");
+  
+  // Initialize WiFi in Station mode
+  setupState = SETUP_ESPNOW_START;
+  WiFi.mode(WIFI_STA);
+  WiFi.disconnect();
+  setupState = SETUP_WIFI_DISCONNECT_WAIT;
+  CO_WAIT_TIMER(setupFlow, protocolTimers, setupTimer, BOOT_WIFI_SETTLE_MS);
+  
+  // Set WiFi channel, where the paired indicator was last found
+  tuneChannel(indicatorChannel);
+  setupState = SETUP_WIFI_CHANNEL_WAIT;
+  CO_WAIT_TIMER(setupFlow, protocolTimers, setupTimer, BOOT_CHANNEL_SETTLE_MS);
+  
+  // Initialize ESP-NOW, escalating through the recovery ladder on failure
+  result = esp_now_init();
+  if (result != ESP_OK) {
+    initFailures.inc();
+    asyncLog.print("Error initializing ESP-NOW, code: ");
+    asyncLog.println(result);
+    radioRecovery.begin(result);
+    CO_AWAIT(setupFlow, radioRecovery.process());
+  }
+  
+  // Register callbacks
+  attachRadio();
+  esp_wifi_get_mac(WIFI_IF_STA, ownMac);
+  
+  {
+    char macStr[18];
+    snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
+             ownMac[0], ownMac[1], ownMac[2], ownMac[3], ownMac[4], ownMac[5]);
+    asyncLog.print("Device MAC Address: ");
+    asyncLog.println(macStr);
+  }
+  asyncLog.print("Operating on WiFi channel: ");
+  asyncLog.println(currentChannel);
+  
+  // Look for an indicator unless an earlier boot already paired with one
+  if (!paired) {
+    setupState = SETUP_PAIRING;
+    CO_AWAIT(setupFlow, processPairing() == CO_DONE);
+  }
+  asyncLog.print("Target indicator MAC: ");
+  printMacAddress(indicatorMac);
+  
+  peerState = PEER_INIT;
+  setupState = SETUP_PEER_ATTEMPT;
+  CO_AWAIT(setupFlow, setupPeer(true));
+  
+  asyncLog.println("Sender ready, will begin sending LED commands");
+  asyncLog.println("Target indicator MAC address:");
+  printMacAddress(indicatorMac);
+  asyncLog.print("Using enhanced retry logic: ");
+  asyncLog.print(MAX_RETRIES_BEFORE_WAIT);
+  asyncLog.print(" retries every ");
+  asyncLog.print(RETRY_INTERVAL_MS);
+  asyncLog.println("ms");
+  
+  // Sleep between transmissions when the build enables the power manager
+  result = powerManager.begin(0, 0);
+  if (result == ESP_OK) {
+    powerManager.stayAwake(true);
+    asyncLog.println("Low-power mode: light sleep between commands");
+  }
+#ifdef POWER_MANAGED_SLEEP
+  else {
+    asyncLog.printf("Power manager unavailable (%d), staying awake\n", result);
+  }
+#endif
+  
+  // Own frame timing until a beacon from a lower address takes over
+  tdma.begin(millis());
+  if (tdma.active()) {
+    asyncLog.printf("Time slots: slot %u of %u, %lu ms frames\n",
+                    indicatorSlot, TDMA_SLOT_COUNT, (unsigned long)TDMA_FRAME_MS);
+    protocolTimers.arm(beaconTimer, tdma.nextSlot(TDMA_BEACON_SLOT, millis(), 0) - millis());
+  }
+  
+  // Keep the restored phase timing, otherwise start the delay now
+  lastSuccessTime = millis() - restoredPhaseMs;
+  protocolTimers.arm(nextLedTimer, NEXT_LED_DELAY_MS - min(restoredPhaseMs, (unsigned long)NEXT_LED_DELAY_MS));
+  
+  // An acknowledged LED is held until its time is up, anything else is sent (again)
   if (acknowledged) {
-    // If acknowledged, wait the delay time then proceed to next LED
-    if (currentTime - lastSuccessTime >= NEXT_LED_DELAY_MS) {
-      Serial.println("Moving to next LED");
-      currentLedIndex = (currentLedIndex + 1) % NUM_LEDS;
-      acknowledged = false;
-      retryCount = 0;
-      lastSendTime = 0;
-      lastSuccessTime = currentTime;
-      
-      // Force peer re-registration periodically
-      esp_now_del_peer(indicatorMac);
-      peerState = PEER_INIT; // Reset peer setup state
-    }
+    commandQueue.restore(indicatorMac, currentLedIndex);
   } else {
-    // Not acknowledged yet, try sending again after interval
-    if (currentTime - lastSendTime >= RETRY_INTERVAL_MS) {
-      if (retryCount < MAX_RETRIES_BEFORE_WAIT) {
-        // Check if peer setup is complete before sending
-        if (peerState == PEER_COMPLETE) {
-          sendLedCommand();
-          lastSendTime = currentTime;
-          retryCount++;
-        } else {
-          // Try to set up peer if not complete
-          setupPeer();
-        }
-      } else {
-        // Force progression after max retries
-        Serial.println("Forcing progression after maximum retries");
-        currentLedIndex = (currentLedIndex + 1) % NUM_LEDS;
-        retryCount = 0;
-        lastSendTime = currentTime;
-        
-        // Force peer re-registration
-        esp_now_del_peer(indicatorMac);
-        peerState = PEER_INIT; // Reset peer setup state
+    requestLed(currentLedIndex);
+  }
+  warmStateDirty = true;
+  setupState = SETUP_COMPLETE;
+  
+  CO_END(setupFlow);
+}
+
+CoStatus processCommandCycle() {
+  uint32_t heartbeatAt;
+  uint8_t ledIndex;
+  
+  CO_BEGIN(commandFlow);
+  
+  // Hold the acknowledged LED until the next one is due, or until a producer asks for another.
+  // Nothing is expected over the air meanwhile, so the chip may sleep until the timer.
+  // Long holds are split by heartbeats that tell the indicator when we are back.
+  while (nextLedTimer.pending() && !commandQueue.pending(indicatorMac)) {
+    heartbeatAt = tdma.nextSlot(indicatorSlot, lastFrameTime, HEARTBEAT_INTERVAL_MS);
+    if ((long)(nextLedTimer.expiry() - heartbeatAt) > 0) {
+      protocolTimers.arm(heartbeatTimer, max((long)(heartbeatAt - millis()), 0L));
+      CO_AWAIT(commandFlow, !heartbeatTimer.pending() || commandQueue.pending(indicatorMac));
+      if (!heartbeatTimer.pending()) {
+        sendHeartbeat();
       }
+    } else {
+      CO_AWAIT(commandFlow, !nextLedTimer.pending() || commandQueue.pending(indicatorMac));
     }
   }
+  protocolTimers.cancel(heartbeatTimer);
   
-  // Handle peer setup state machine (non-blocking)
-  if (peerState != PEER_COMPLETE) {
-    setupPeer();
+  // The built-in sequence steps on when nobody asked for anything else
+  if (!commandQueue.pending(indicatorMac)) {
+    asyncLog.println("Moving to next LED");
+    requestLed((currentLedIndex + 1) % NUM_LEDS);
+  }
+  if (!commandQueue.peek(indicatorMac, ledIndex, commandTicket)) {
+    protocolTimers.arm(nextLedTimer, NEXT_LED_DELAY_MS);  // Nothing new to show
+    CO_EXIT(commandFlow);
   }
+  currentLedIndex = ledIndex;
+  acknowledged = false;
+  retryCount = 0;
+  linkDelivered = false;
+  // While backing off, a scan that found nothing is repeated at most once per longest pause
+  channelScanned = (backoffMs != 0 && millis() - scanStartTime < BACKOFF_MAX_MS);
+  lastSuccessTime = millis();
+  warmStateDirty = true;
+  
+  // Send it every RETRY_INTERVAL_MS until its acknowledgment arrives or a newer state replaces it
+  for (;;) {
+    CO_AWAIT(commandFlow, acknowledged || !retryTimer.pending() ||
+                          commandQueue.superseded(indicatorMac, commandTicket));
+    if (!acknowledged && commandQueue.superseded(indicatorMac, commandTicket)) {
+      break;  // The newer state goes out on the next retry
+    }
+    if (!acknowledged && retryCount >= MAX_RETRIES_BEFORE_WAIT && !linkDelivered && !channelScanned) {
+      // Not one frame got through, the indicator may be on another channel
+      channelScanned = true;
+      linkAdapter.reset();
+      CO_AWAIT(commandFlow, processChannelScan() == CO_DONE);
+      if (scanFound != 0) {
+        retryCount = 0;  // Start the retries over on the new channel
+      }
+    }
+    if (acknowledged || retryCount >= MAX_RETRIES_BEFORE_WAIT) {
+      break;
+    }
+    
+    // Radio on for the send and the acknowledgment it should bring back
+    powerManager.stayAwake(true);
+    
+    // Check if peer setup is complete before sending
+    CO_AWAIT(commandFlow, setupPeer());
+    if (retryCount >= TDMA_SLOT_RETRIES && indicatorSynced) {
+      // Missed slots mean the indicator fell back to its regular cycle, reach it any time
+      asyncLog.println("Indicator not answering in its slot, retrying outside it");
+      indicatorSynced = false;
+    }
+    if (retryCount == 0) {
+      commandStartTime = millis();
+    }
+    sendLedCommand();
+    protocolTimers.arm(retryTimer, indicatorSynced
+                       ? tdma.nextSlot(indicatorSlot, lastFrameTime, RETRY_INTERVAL_MS) - millis()
+                       : RETRY_INTERVAL_MS + esp_random() % RETRY_JITTER_MS);
+    retryCount++;
+    warmStateDirty = true;
+  }
+  
+  if (acknowledged) {
+    // A state submitted while this one was in flight stays queued and is sent next
+    commandQueue.delivered(indicatorMac, commandTicket, currentLedIndex);
+    protocolTimers.cancel(retryTimer);  // The next state goes out right away
+    backoffMs = 0;
+    if (surveyDue()) {
+      CO_AWAIT(commandFlow, processChannelSurvey() == CO_DONE);
+    }
+    powerManager.stayAwake(false);
+  } else if (commandQueue.superseded(indicatorMac, commandTicket)) {
+    asyncLog.printf("LED index %d replaced before delivery\n", currentLedIndex);
+  } else {
+    // The state stays queued, try again after a pause unless a newer one replaces it.
+    // Nothing is expected over the air meanwhile, so the chip may sleep.
+    backoffMs = backoffMs ? min(backoffMs * 2, BACKOFF_MAX_MS) : BACKOFF_MIN_MS;
+    asyncLog.printf("Backing off for %lu ms after maximum retries, LED index %d stays queued\n",
+                    backoffMs, currentLedIndex);
+    commandBackoffs.inc();
+    indicatorSynced = false;
+    indicatorListening = false;
+    protocolTimers.arm(retryTimer, backoffMs + esp_random() % (backoffMs / 2));  // Spread like the retries
+    powerManager.stayAwake(false);
+  }
+  
+  // Force peer re-registration periodically
+  esp_now_del_peer(indicatorMac);
+  peerState = PEER_INIT; // Reset peer setup state
+  
+  CO_END(commandFlow);
 }
 
 void setupEspNow() {
   // This function is now handled by the setup state machine
 }
 
+void addBroadcastPeer() {
+  // Discovery requests and beacons go to everyone in range
+  if (esp_now_is_peer_exist(BROADCAST_MAC)) {
+    return;
+  }
+  esp_now_peer_info_t peerInfo = {};
+  memcpy(peerInfo.peer_addr, BROADCAST_MAC, 6);
+  peerInfo.channel = 0;  // Follow the current channel, it changes while scanning
+  peerInfo.encrypt = false;
+  if (esp_now_add_peer(&peerInfo) != ESP_OK) {
+    asyncLog.println("Failed to add broadcast peer");
+    peerAddFailures.inc();
+  }
+}
+
+bool loadPairing() {
+  indicator_record_t record;
+  if (preferences.getBytesLength("indicator") != sizeof(record)) {
+    return false;
+  }
+  preferences.getBytes("indicator", &record, sizeof(record));
+  
+  memcpy(indicatorMac, record.mac, 6);
+  if (record.channel >= 1 && record.channel <= CHANNEL_COUNT) {
+    indicatorChannel = record.channel;
+  }
+  if (record.slot != TDMA_BEACON_SLOT && record.slot < TDMA_SLOT_COUNT) {
+    indicatorSlot = record.slot;
+  } else {
+    indicatorSlot = TdmaSchedule::preferredSlot(indicatorMac);
+  }
+  return true;
+}
+
+void pairWith(const uint8_t *mac, uint8_t channel) {
+  memcpy(indicatorMac, mac, 6);
+  indicatorChannel = channel;
+  indicatorSlot = TdmaSchedule::preferredSlot(indicatorMac);  // Start from the slot its address maps to
+  paired = true;
+  savePairing();
+  asyncLog.printf("Paired with indicator on channel %u, %lu ms after boot\n", channel, millis());
+}
+
+CoStatus processPairing() {
+  CO_BEGIN(pairingFlow);
+  
+  asyncLog.println("No paired indicator, searching all channels");
+  addBroadcastPeer();
+  buildScanOrder();
+  scanStep = 0;
+  while (!paired) {
+    // One request per channel, answers come back within the dwell
+    tuneChannel(scanOrder[scanStep]);
+    scanStep = (scanStep + 1) % CHANNEL_COUNT;
+    sendDiscoveryRequest(BROADCAST_MAC);
+    protocolTimers.arm(pairingTimer, CHANNEL_DWELL_MS);
+    CO_AWAIT(pairingFlow, paired || !pairingTimer.pending());
+  }
+  protocolTimers.cancel(pairingTimer);
+  tuneChannel(indicatorChannel);
+  
+  CO_END(pairingFlow);
+}
+
+CoStatus processChannelScan() {
+  CO_BEGIN(scanFlow);
+  
+  asyncLog.printf("Nothing delivered on channel %u, scanning for the indicator\n", indicatorChannel);
+  buildScanOrder();
+  scanStep = 0;
+  scanFound = 0;
+  scanStartTime = millis();
+  while (scanFound == 0 && millis() - scanStartTime < CHANNEL_SCAN_TIMEOUT_MS) {
+    // A probe the indicator's radio acknowledged means it listens on this channel
+    tuneChannel(scanOrder[scanStep]);
+    scanStep = (scanStep + 1) % CHANNEL_COUNT;
+    probeDone = false;
+    probeOk = false;
+    sendDiscoveryRequest(indicatorMac);
+    protocolTimers.arm(scanTimer, CHANNEL_DWELL_MS);
+    CO_AWAIT(scanFlow, probeDone || !scanTimer.pending());
+    if (probeOk) {
+      scanFound = currentChannel;
+    }
+  }
+  protocolTimers.cancel(scanTimer);
+  
+  if (scanFound != 0) {
+    asyncLog.printf("Indicator found on channel %u after %lu ms\n", scanFound, millis() - scanStartTime);
+    if (scanFound != indicatorChannel) {
+      indicatorChannel = scanFound;
+      savePairing();
+    }
+  } else {
+    asyncLog.println("Indicator not found on any channel");
+    tuneChannel(indicatorChannel);
+  }
+  
+  CO_END(scanFlow);
+}
+
+bool surveyDue() {
+  if (millis() - lastSurveyTime >= SURVEY_INTERVAL_MS) {
+    return true;
+  }
+  // Heartbeats go out while the indicator is known to listen, losing them means a bad channel
+  return hintedSent >= (uint32_t)SURVEY_MIN_FRAMES && hintedOk * 100 < hintedSent * SURVEY_TRIGGER_PERCENT;
+}
+
+CoStatus processChannelSurvey() {
+  CO_BEGIN(surveyFlow);
+  
+  asyncLog.printf("Channel survey, heartbeats delivered on channel %u: %lu/%lu\n",
+                  indicatorChannel, (unsigned long)hintedOk, (unsigned long)hintedSent);
+  lastSurveyTime = millis();
+  
+  // The indicator has to follow the schedule, don't start without it
+  for (surveyAttempt = 0; surveyAttempt < SURVEY_REQUEST_ATTEMPTS; surveyAttempt++) {
+    probeDone = false;
+    probeOk = false;
+    sendControl(SURVEY, SURVEY_START, SURVEY_START_DELAY_MS);
+    switchSentTime = millis();
+    protocolTimers.arm(surveyTimer, CHANNEL_DWELL_MS);
+    CO_AWAIT(surveyFlow, probeDone || !surveyTimer.pending());
+    if (probeOk) {
+      break;
+    }
+  }
+  if (!probeOk) {
+    asyncLog.println("Indicator did not take the survey request, skipping the survey");
+    CO_EXIT(surveyFlow);
+  }
+  
+  // Hop with the indicator and probe it on every channel
+  survey.begin(switchSentTime + SURVEY_START_DELAY_MS);
+  linkQuality.captureAll(true);
+  protocolTimers.arm(surveyTimer, survey.msUntilStart(millis()));
+  CO_AWAIT(surveyFlow, !surveyTimer.pending());
+  while (survey.channelAt(millis()) != 0) {
+    if (survey.channelAt(millis()) != currentChannel) {
+      tuneChannel(survey.channelAt(millis()));
+      survey.tunedTo(currentChannel);
+    }
+    sendControl(SURVEY, SURVEY_PROBE, 0);
+    protocolTimers.arm(surveyTimer, min(survey.msUntilNextHop(millis()), (uint32_t)SURVEY_PROBE_INTERVAL_MS));
+    CO_AWAIT(surveyFlow, !surveyTimer.pending());
+  }
+  survey.finish();
+  linkQuality.captureAll(false);
+  tuneChannel(indicatorChannel);
+  survey.printStats(asyncLog);
+  
+  surveyChoice = survey.best(indicatorChannel);
+  hintedSent = 0;
+  hintedOk = 0;
+  if (surveyChoice == indicatorChannel) {
+    asyncLog.printf("Staying on channel %u\n", indicatorChannel);
+    CO_EXIT(surveyFlow);
+  }
+  
+  // Both sides retune at the announced time, the indicator only if it got the request
+  for (surveyAttempt = 0; surveyAttempt < CHANNEL_SWITCH_ATTEMPTS; surveyAttempt++) {
+    probeDone = false;
+    probeOk = false;
+    sendControl(CHANNEL_SWITCH, surveyChoice, CHANNEL_SWITCH_DELAY_MS);
+    switchSentTime = millis();
+    protocolTimers.arm(surveyTimer, CHANNEL_DWELL_MS);
+    CO_AWAIT(surveyFlow, probeDone || !surveyTimer.pending());
+    if (probeOk) {
+      break;
+    }
+  }
+  if (!probeOk) {
+    asyncLog.println("Channel switch not delivered, staying");
+    CO_EXIT(surveyFlow);
+  }
+  
+  protocolTimers.arm(surveyTimer, max((long)(switchSentTime + CHANNEL_SWITCH_DELAY_MS - millis()), 0L));
+  CO_AWAIT(surveyFlow, !surveyTimer.pending());
+  asyncLog.printf("Moving from channel %u to %u\n", indicatorChannel, surveyChoice);
+  indicatorChannel = surveyChoice;
+  tuneChannel(indicatorChannel);
+  linkAdapter.reset();  // Start over from the robust setting on the new channel
+  savePairing();
+  reportAfterSwitch = true;
+  
+  CO_END(surveyFlow);
+}
+
+void sendControl(uint8_t type, uint8_t value, uint16_t etaMs) {
+  message_t message;
+  message.type = type;
+  message.value = value;
+  message.etaMs = etaMs;
+  if (esp_now_send(indicatorMac, (uint8_t *)&message, sizeof(message)) != ESP_OK) {
+    sendErrors.inc();
+  }
+}
+
+void tuneChannel(uint8_t channel) {
+  esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+  currentChannel = channel;
+  radioRecovery.setChannel(channel);
+}
+
+void buildScanOrder() {
+  channelScanOrder(scanOrder, indicatorChannel, WIFI_CHANNEL);
+}
+
+void sendDiscoveryRequest(const uint8_t *addr) {
+  message_t message;
+  message.type = DISCOVERY;
+  message.value = DISCOVERY_REQUEST;
+  message.etaMs = 0;  // Not a wake hint, the indicator should stay up for the first command
+  if (esp_now_send(addr, (uint8_t *)&message, sizeof(message)) != ESP_OK) {
+    sendErrors.inc();
+  }
+}
+
+void savePairing() {
+  indicator_record_t record = {};
+  memcpy(record.mac, indicatorMac, 6);
+  record.slot = indicatorSlot;
+  record.channel = indicatorChannel;
+  preferences.putBytes("indicator", &record, sizeof(record));
+}
+
+void attachRadio() {
+  esp_now_register_recv_cb(onDataReceived);
+  esp_now_register_send_cb(onDataSent);
+  linkQuality.begin(onPromiscuous);
+  linkAdapter.apply();
+}
+
 bool setupPeer(bool isInitialSetup) {
-  static unsigned long peerTimer = 0;
-  unsigned long currentTime = millis();
-  
-  switch (peerState) {
-    case PEER_INIT:
-      peerAttemptCount = 0;
-      peerTimer = currentTime;
-      peerState = PEER_ATTEMPT;
-      return false;
+  if (peerState == PEER_COMPLETE) {
+    return true;
+  }
+  
+  // Setting peerState back to PEER_INIT restarts registration from the top
+  if (peerState == PEER_INIT) {
+    CO_RESET(peerFlow);
+  }
+  processPeerSetup(isInitialSetup);
+  return peerState == PEER_COMPLETE;
+}
+
+CoStatus processPeerSetup(bool isInitialSetup) {
+  CO_BEGIN(peerFlow);
+  
+  peerAttemptCount = 0;
+  for (;;) {
+    peerState = PEER_ATTEMPT;
+    {
+      esp_now_peer_info_t peerInfo = {};
+      memcpy(peerInfo.peer_addr, indicatorMac, 6);
+      peerInfo.channel = 0;  // Follow the current channel, it changes while scanning
+      peerInfo.encrypt = false;
       
-    case PEER_ATTEMPT:
-      {
-        esp_now_peer_info_t peerInfo = {};
-        memcpy(peerInfo.peer_addr, indicatorMac, 6);
-        peerInfo.channel = WIFI_CHANNEL;
-        peerInfo.encrypt = false;
+      esp_err_t result = esp_now_add_peer(&peerInfo);
+      if (result == ESP_OK) {
+        asyncLog.println("Successfully added indicator as peer");
         
-        esp_err_t result = esp_now_add_peer(&peerInfo);
-        if (result == ESP_OK) {
-          Serial.println("Successfully added indicator as peer");
-          
-          // Verify peer registration
-          if (esp_now_is_peer_exist(indicatorMac)) {
-            Serial.println("Peer verification: Successfully registered indicator");
-            peerState = PEER_COMPLETE;
-            return true;
-          } else {
-            Serial.println("ERROR: Peer verification failed - indicator not registered");
+        // Verify peer registration
+        if (esp_now_is_peer_exist(indicatorMac)) {
+          asyncLog.println("Peer verification: Successfully registered indicator");
+          if (tdma.active()) {
+            addBroadcastPeer();
           }
+          peerState = PEER_COMPLETE;
+          CO_EXIT(peerFlow);
         } else {
-          Serial.println("Failed to add peer, will retry...");
-        }
-        
-        peerAttemptCount++;
-        if (peerAttemptCount >= 3) {
-          if (isInitialSetup) {
-            // For initial setup, reset to retry
-            peerAttemptCount = 0;
-            Serial.println("ERROR: Failed to add peer after multiple attempts. Continuing to retry...");
-          } else {
-            Serial.println("ERROR: Failed to add peer after multiple attempts");
-            peerState = PEER_COMPLETE; // Consider it complete even though it failed
-            return false;
-          }
+          asyncLog.println("ERROR: Peer verification failed - indicator not registered");
         }
-        
-        peerTimer = currentTime;
-        peerState = PEER_RETRY_WAIT;
-        return false;
+      } else {
+        asyncLog.println("Failed to add peer, will retry...");
+        peerAddFailures.inc();
       }
-      
-    case PEER_RETRY_WAIT:
-      if (currentTime - peerTimer >= 500) {
-        peerState = PEER_ATTEMPT;
+    }
+    
+    peerAttemptCount++;
+    if (peerAttemptCount >= 3) {
+      if (isInitialSetup) {
+        // For initial setup, reset to retry
+        peerAttemptCount = 0;
+        asyncLog.println("ERROR: Failed to add peer after multiple attempts. Continuing to retry...");
+      } else {
+        asyncLog.println("ERROR: Failed to add peer after multiple attempts");
+        peerState = PEER_COMPLETE; // Consider it complete even though it failed
+        CO_EXIT(peerFlow);
       }
-      return false;
-      
-    case PEER_COMPLETE:
-      return true;
+    }
+    
+    peerState = PEER_RETRY_WAIT;
+    CO_WAIT_TIMER(peerFlow, protocolTimers, peerTimer, 500);
   }
   
-  return false;
+  CO_END(peerFlow);
+}
+
+bool restoreWarmState() {
+  if (!warmStateValid(warmState, WARM_STATE_VERSION) || warmState.currentLedIndex >= NUM_LEDS) {
+    warmStateInvalidate(warmState);
+    return false;
+  }
+  
+  currentLedIndex = warmState.currentLedIndex;
+  acknowledged = warmState.acknowledged;
+  retryCount = warmState.retryCount;
+  restoredPhaseMs = warmState.sinceLastSuccess;  // Applied once setup completes
+  return true;
+}
+
+void saveWarmState() {
+  warmStateDirty = false;
+  warmState.currentLedIndex = currentLedIndex;
+  warmState.acknowledged = acknowledged;
+  warmState.retryCount = retryCount;
+  warmState.sinceLastSuccess = millis() - lastSuccessTime;
+  warmStateSeal(warmState, WARM_STATE_VERSION);
 }
 
 void printMacAddress(const uint8_t *addr) {
   char macStr[18];
   snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
            addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
-  Serial.println(macStr);
+  asyncLog.println(macStr);
+}
+
+// Ask the indicator to show ledIndex, from any task. Replaces a state that was not delivered yet.
+bool requestLed(uint8_t ledIndex) {
+  if (!paired || ledIndex >= NUM_LEDS) {
+    return false;
+  }
+  CommandSubmit result = commandQueue.submit(indicatorMac, ledIndex);
+  if (result == COMMAND_FULL) {
+    return false;
+  }
+  if (result == COMMAND_SUPERSEDED) {
+    commandsSuperseded.inc();
+  }
+  
+  // Other tasks wake the protocol task through its event queue
+  if (result != COMMAND_UNCHANGED && xTaskGetCurrentTaskHandle() != protocolTaskHandle) {
+    radio_event_t event;
+    event.type = RADIO_EVENT_COMMAND;
+    event.len = 0;
+    if (xQueueSend(radioQueue, &event, 0) != pdTRUE) {
+      radioQueueDrops.inc();  // Picked up on the next pass anyway
+    }
+  }
+  return true;
 }
 
 void sendLedCommand() {
   message_t message;
   message.type = LED_COMMAND;
   message.value = currentLedIndex;
+  // Once acknowledged, the next frame is the first heartbeat or the next command
+  lastFrameTime = millis();
+  message.etaMs = tdma.nextSlot(indicatorSlot, lastFrameTime, min(NEXT_LED_DELAY_MS, HEARTBEAT_INTERVAL_MS)) -
+                  lastFrameTime;
   
-  Serial.print("Sending command to activate LED index: ");
-  Serial.print(currentLedIndex);
-  Serial.print(" (pin: ");
-  Serial.print(LED_PINS[currentLedIndex]);
-  Serial.println(")");
-  Serial.print("Target MAC: ");
+  asyncLog.print("Sending command to activate LED index: ");
+  asyncLog.print(currentLedIndex);
+  asyncLog.print(" (pin: ");
+  asyncLog.print(LED_PINS[currentLedIndex]);
+  asyncLog.println(")");
+  asyncLog.print("Target MAC: ");
   printMacAddress(indicatorMac);
   
   esp_err_t result = esp_now_send(indicatorMac, (uint8_t *)&message, sizeof(message));
+  linkFramePending = (result == ESP_OK);
+  linkFrameCounted = indicatorListening;
   
   if (result != ESP_OK) {
-    Serial.print("Error sending message, code: ");
-    Serial.println(result);
+    sendErrors.inc();
+    asyncLog.print("Error sending message, code: ");
+    asyncLog.println(result);
+    
+    if (result == ESP_ERR_ESPNOW_NOT_INIT) {
+      radioRecovery.begin(result);
+      return;
+    }
     
     // Check if peer still exists, re-add if needed
     if (!esp_now_is_peer_exist(indicatorMac)) {
-      Serial.println("Peer lost, attempting to re-add");
+      asyncLog.println("Peer lost, attempting to re-add");
       peerState = PEER_INIT; // Reset peer setup state
     }
   } else {
-    Serial.println("Message sent successfully to transport layer");
+    asyncLog.println("Message sent successfully to transport layer");
+  }
+}
+
+void sendHeartbeat() {
+  message_t message;
+  message.type = HEARTBEAT;
+  message.value = currentLedIndex;
+  lastFrameTime = millis();
+  message.etaMs = min(max((long)(nextLedTimer.expiry() - lastFrameTime), 0L),
+                      (long)(tdma.nextSlot(indicatorSlot, lastFrameTime, HEARTBEAT_INTERVAL_MS) - lastFrameTime));
+  
+  esp_err_t result = esp_now_send(indicatorMac, (uint8_t *)&message, sizeof(message));
+  hintedFramePending = (result == ESP_OK);
+  if (result != ESP_OK) {
+    sendErrors.inc();
+  }
+  linkFramePending = (result == ESP_OK);
+  linkFrameCounted = indicatorListening;
+  asyncLog.printf("Heartbeat sent, next transmission in %u ms (%s)\n",
+                  message.etaMs, (result == ESP_OK) ? "ok" : "failed");
+}
+
+void sendBeacon(WheelTimer &timer, void *arg) {
+  // Runs from the timer wheel at the start of a frame
+  uint32_t nowMs = millis();
+  message_t message;
+  message.type = BEACON;
+  message.value = indicatorSlot;
+  message.etaMs = tdma.nextSlot(TDMA_BEACON_SLOT, nowMs, 0) - nowMs;
+  esp_now_send(BROADCAST_MAC, (uint8_t *)&message, sizeof(message));
+  
+  protocolTimers.arm(timer, tdma.nextSlot(TDMA_BEACON_SLOT, nowMs, TDMA_BEACON_INTERVAL_MS) - nowMs);
+}
+
+void handleBeacon(const uint8_t *macAddr, uint8_t slot, uint16_t etaMs, uint32_t rxMs) {
+  if (!tdma.active()) {
+    return;
+  }
+  if (slot == TDMA_NO_SLOT) {
+    tdma.slotsExhausted(rxMs);  // More pairs than slots, nobody uses theirs for now
+  }
+  // Lower addresses set the timing and keep their slot
+  if (memcmp(macAddr, ownMac, 6) >= 0) {
+    return;
+  }
+  
+  uint32_t frameStart = rxMs + etaMs;
+  int32_t offset = tdma.offsetFrom(frameStart);
+  if (abs(offset) > TDMA_ALIGN_TOLERANCE_MS) {
+    asyncLog.printf("Frame timing adjusted by %ld ms to match beacon\n", (long)offset);
+    tdma.align(frameStart);
+    protocolTimers.arm(beaconTimer, tdma.nextSlot(TDMA_BEACON_SLOT, millis(), 0) - millis());
+  }
+  
+  uint8_t newSlot = tdma.slotAfterBeacon(slot, indicatorSlot, rxMs);
+  if (newSlot != indicatorSlot) {
+    if (newSlot == TDMA_NO_SLOT) {
+      asyncLog.println("All slots taken by other senders, indicator runs without a slot");
+      indicatorSynced = false;
+    } else if (indicatorSlot == TDMA_NO_SLOT) {
+      asyncLog.printf("Slot %u is free, indicator uses slots again\n", newSlot);
+    } else {
+      asyncLog.printf("Slot taken by another sender, moving indicator to slot %u\n", newSlot);
+    }
+    indicatorSlot = newSlot;
+    savePairing();
   }
 }
 
 void onDataSent(const uint8_t *macAddr, esp_now_send_status_t status) {
-  Serial.print("Last packet send status: ");
-  Serial.println(status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
+  // Runs in the WiFi task - hand the result to the protocol task and return
+  radio_event_t event;
+  event.type = RADIO_EVENT_TX_DONE;
+  memcpy(event.mac, macAddr, 6);
+  event.status = status;
+  event.len = 0;
+  event.channel = currentChannel;
   
-  // Note: We only consider it acknowledged when we receive the actual
-  // acknowledgment message, not just on delivery success
+  if (xQueueSend(radioQueue, &event, 0) != pdTRUE) {
+    radioQueueDrops.inc();
+  }
+}
+
+void onPromiscuous(void *buf, wifi_promiscuous_pkt_type_t type) {
+  // Runs in the WiFi task ahead of the ESP-NOW receive callback for the same frame
+  const wifi_promiscuous_pkt_t *packet = (const wifi_promiscuous_pkt_t *)buf;
+  linkQuality.capture(packet, type);
+  survey.frame(packet);
 }
 
 void onDataReceived(const uint8_t *macAddr, const uint8_t *data, int dataLen) {
+  // Runs in the WiFi task - hand the frame to the protocol task and return
+  radio_event_t event;
+  if (dataLen > RADIO_EVENT_MAX_LEN) {
+    radioQueueDrops.inc();
+    return;
+  }
+  event.type = RADIO_EVENT_RX;
+  memcpy(event.mac, macAddr, 6);
+  event.len = dataLen;
+  event.channel = currentChannel;
+  event.rssi = LINK_RSSI_NONE;
+  event.rxMs = millis();
+  rx_capture_t capture;
+  if (linkQuality.lookup(macAddr, capture)) {
+    event.rssi = capture.rssi;
+  }
+  memcpy(event.data, data, dataLen);
+  
+  if (xQueueSend(radioQueue, &event, 0) != pdTRUE) {
+    radioQueueDrops.inc();
+  }
+  radioQueueMaxDepth.raise(uxQueueMessagesWaiting(radioQueue));
+}
+
+void handleRadioEvent(const radio_event_t &event) {
+  const uint8_t *macAddr = event.mac;
+  
+  if (event.type == RADIO_EVENT_COMMAND) {
+    return;  // processCommandCycle() picks the new state up
+  }
+  
+  if (event.type == RADIO_EVENT_TX_DONE) {
+    asyncLog.print("Last packet send status: ");
+    asyncLog.println(event.status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
+    if (event.status != ESP_NOW_SEND_SUCCESS) {
+      deliveryFailures.inc();
+    }
+    
+    // The indicator's radio received it, which tells the channel scan where it is
+    if (memcmp(macAddr, indicatorMac, 6) == 0) {
+      bool ok = (event.status == ESP_NOW_SEND_SUCCESS);
+      probeOk = ok && event.channel == currentChannel;
+      probeDone = true;
+      if (ok) {
+        linkDelivered = true;
+      }
+      if (survey.active()) {
+        survey.recordProbe(event.channel, ok);
+      }
+      
+      // A sleeping indicator says nothing about the link, only count frames it was awake for
+      if (linkFramePending) {
+        linkFramePending = false;
+        if (linkFrameCounted) {
+          linkAdapter.delivered(ok);
+        }
+        indicatorListening = ok;
+      }
+      
+      // Delivery ratio of heartbeats, before and after a channel change
+      if (hintedFramePending) {
+        hintedFramePending = false;
+        hintedSent++;
+        hintedOk += ok;
+        if (reportAfterSwitch && hintedSent >= (uint32_t)SURVEY_MIN_FRAMES) {
+          asyncLog.printf("Heartbeats delivered on channel %u since the switch: %lu/%lu\n",
+                          indicatorChannel, (unsigned long)hintedOk, (unsigned long)hintedSent);
+          reportAfterSwitch = false;
+        }
+      }
+    }
+    
+    // Note: We only consider it acknowledged when we receive the actual
+    // acknowledgment message, not just on delivery success
+    return;
+  }
+  
+  framesReceived.inc();
+  linkQuality.record(macAddr, event.rssi, event.channel, event.rxMs);
+  if (memcmp(macAddr, indicatorMac, 6) == 0 && event.rssi != LINK_RSSI_NONE) {
+    linkAdapter.rssi(event.rssi);
+  }
+  
+  // Telemetry goes to the serial log as one line per record, in whichever version the indicator sent
+  if (event.len >= 2 && event.data[0] == TELEMETRY && event.len == telemetryLength(event.data[1])) {
+    static_assert(TELEMETRY_LINE_LEN < LOG_LINE_LEN, "A telemetry line must fit into one log line");
+    telemetry_t record;
+    char line[TELEMETRY_LINE_LEN];
+    memcpy(&record, event.data, event.len);
+    formatTelemetry(macAddr, record, line, event.len);
+    asyncLog.println(line);
+    return;
+  }
+  
   // Print who sent this data
   char macStr[18];
   snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
            macAddr[0], macAddr[1], macAddr[2], macAddr[3], macAddr[4], macAddr[5]);
   
-  Serial.print("Received data from: ");
-  Serial.println(macStr);
+  asyncLog.print("Received data from: ");
+  asyncLog.println(macStr);
   
   // Process all incoming messages without strict MAC filtering for better reliability
-  if (dataLen == sizeof(message_t)) {
-    message_t *message = (message_t *)data;
+  if (event.len == sizeof(message_t) || event.len == MESSAGE_BASE_LEN) {
+    const message_t *message = (const message_t *)event.data;
     
     switch (message->type) {
       case ACKNOWLEDGMENT: {
-        Serial.println("Received acknowledgment");
-        Serial.print("Confirmed LED index: ");
-        Serial.println(message->value);
+        asyncLog.println("Received acknowledgment");
+        asyncLog.print("Confirmed LED index: ");
+        asyncLog.println(message->value);
+        if (event.rssi != LINK_RSSI_NONE) {
+          asyncLog.printf("Signal %d dBm, average %d dBm\n", event.rssi, linkQuality.averageOf(macAddr));
+        }
+        // Only the first acknowledgment of the state in flight starts its hold time, repeats
+        // and late ones for a state a newer request replaced must not push it back
+        if ((acknowledged && ackedTicket == commandTicket) || message->value != currentLedIndex) {
+          duplicateAcks.inc();  // The indicator repeats its ack until one is delivered
+          break;
+        }
+        commandsAcked.inc();
+        commandRetries.record(max(retryCount - 1, 0));
+        ackLatency.record(millis() - commandStartTime);
         acknowledged = true;
+        ackedTicket = commandTicket;
+        indicatorSynced = tdma.active() && indicatorSlot != TDMA_NO_SLOT && !tdma.crowded(millis());
         lastSuccessTime = millis();
+        if (firstAckTime == 0) {
+          firstAckTime = lastSuccessTime;
+          asyncLog.printf("First command acknowledged %lu ms after boot\n", firstAckTime);
+        }
+        // The hint sent with the command counts from the send, so does the hold
+        protocolTimers.arm(nextLedTimer, max((long)(tdma.nextSlot(indicatorSlot, lastFrameTime, NEXT_LED_DELAY_MS) -
+                                                    lastSuccessTime), 0L));
+        warmStateDirty = true;
         break;
       }
         
       case DISCOVERY: {
-        Serial.println("Received discovery response");
+        // Requests come from other unpaired senders, only announcements are indicators
+        if (message->value == DISCOVERY_ANNOUNCE) {
+          asyncLog.println("Received indicator announcement");
+          if (!paired) {
+            pairWith(macAddr, event.channel);
+          }
+        }
+        break;
+      }
+        
+      case BEACON: {
+        if (event.len == sizeof(message_t)) {
+          handleBeacon(macAddr, message->value, message->etaMs, event.rxMs);
+        }
         break;
       }
         
       default: {
-        Serial.print("Unknown message type: ");
-        Serial.println(message->type);
+        asyncLog.print("Unknown message type: ");
+        asyncLog.println(message->type);
         break;
       }
     }
   }
-}
\ No newline at end of file
+}
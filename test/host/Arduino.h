@@ -0,0 +1,65 @@
+/**
+ * ESP32 ESP-NOW LED Indicator System - HOST ARDUINO SHIM
+ *
+ * Just enough of the Arduino core for the header-only modules in include/ to
+ * build in the native test environment. Time does not pass by itself: tests
+ * set and advance the simulated clock with hostSetMillis()/hostAdvanceMs()/
+ * hostAdvanceUs(). There is one thread, so critical sections do nothing.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+// Simulated clock in microseconds, millis() and micros() wrap like on the chip
+inline uint64_t &hostClockUs() {
+  static uint64_t us = 0;
+  return us;
+}
+inline void hostSetMillis(uint32_t ms) { hostClockUs() = (uint64_t)ms * 1000; }
+inline void hostAdvanceMs(uint32_t ms) { hostClockUs() += (uint64_t)ms * 1000; }
+inline void hostAdvanceUs(uint32_t us) { hostClockUs() += us; }
+inline unsigned long millis() { return (uint32_t)(hostClockUs() / 1000); }
+inline unsigned long micros() { return (uint32_t)hostClockUs(); }
+inline void delay(unsigned long ms) { hostAdvanceMs(ms); }
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+inline void portENTER_CRITICAL(portMUX_TYPE *) {}
+inline void portEXIT_CRITICAL(portMUX_TYPE *) {}
+
+class HostSerial {
+ public:
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, format);
+    int written = vprintf(format, args);
+    va_end(args);
+    return written < 0 ? 0 : written;
+  }
+  size_t print(const char *text) { return fputs(text, stdout) < 0 ? 0 : strlen(text); }
+  size_t println(const char *text = "") { return print(text) + print("\n"); }
+  void flush() { fflush(stdout); }
+};
+
+static HostSerial Serial __attribute__((unused));
+
+#endif // HOST_ARDUINO_H
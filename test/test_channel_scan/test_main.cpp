@@ -0,0 +1,152 @@
+/**
+ * Time for the sender's channel scan (processChannelScan() in sender.cpp,
+ * order from channel_scan.h) to find an indicator that moved to another
+ * channel. The indicator listens for INDICATOR_AWAKE_MS out of every
+ * INDICATOR_CYCLE_MS and the scan starts at a random point of that cycle.
+ * A probe is found when it goes out on the indicator's channel while the
+ * indicator listens and is not lost on the air. Otherwise its failed
+ * delivery report ends the dwell, at the latest after CHANNEL_DWELL_MS.
+ *
+ * The sweep is compared against staying a whole indicator cycle on each
+ * channel and probing it throughout, which needs no timing assumption
+ * about the indicator.
+ *
+ *   pio test -e native -f test_channel_scan -v
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "channel_scan.h"
+
+// The sender's timing (sender.cpp)
+const uint8_t WIFI_CHANNEL = 6;
+const double INDICATOR_AWAKE_MS = 300;
+const double INDICATOR_CYCLE_MS = 2100;
+const double CHANNEL_DWELL_MS = 20;
+const double CHANNEL_SCAN_TIMEOUT_MS = 3 * INDICATOR_CYCLE_MS;
+
+const double TUNE_MS = 1;          // Channel switch before the probe goes out
+const double AIRTIME_MS = 0.5;     // The probe has to fit into the listen window
+const int TRIALS = 200000;
+
+struct ScanResult {
+  double meanMs;
+  double p95Ms;
+  double worstMs;
+  uint32_t notFound;    // Scans that ran into CHANNEL_SCAN_TIMEOUT_MS
+};
+
+struct Strategy {
+  double dwellMs;       // Longest stay on a channel
+  double reportMs;      // Failed delivery report after a probe
+  bool fullDwell;       // Keep probing until the dwell ends instead of moving on after the report
+  double timeoutMs;
+};
+
+const Strategy SWEEP = {CHANNEL_DWELL_MS, CHANNEL_DWELL_MS, false, CHANNEL_SCAN_TIMEOUT_MS};
+
+ScanResult simulate(const Strategy &strategy, double loss, bool commonChannels, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> unit(0, 1);
+  const uint8_t common[] = {1, 6, 11};
+  std::vector<double> found;
+  ScanResult result = {0, 0, 0, 0};
+
+  for (int trial = 0; trial < TRIALS; trial++) {
+    // The indicator left the channel the sender knows
+    uint8_t lastChannel = 1 + rng() % CHANNEL_COUNT;
+    uint8_t channel;
+    do {
+      channel = commonChannels ? common[rng() % 3] : 1 + rng() % CHANNEL_COUNT;
+    } while (channel == lastChannel);
+    double phase = unit(rng) * INDICATOR_CYCLE_MS;  // Start of a listen window, from the scan start
+
+    uint8_t order[CHANNEL_COUNT];
+    channelScanOrder(order, lastChannel, WIFI_CHANNEL);
+    double t = 0;
+    bool ok = false;
+    for (int step = 0; !ok && t < strategy.timeoutMs; step++) {
+      double dwellEnd = t + strategy.dwellMs;
+      double probeAt = t + TUNE_MS;
+      do {
+        double intoCycle = fmod(probeAt - phase + INDICATOR_CYCLE_MS, INDICATOR_CYCLE_MS);
+        if (order[step % CHANNEL_COUNT] == channel && intoCycle <= INDICATOR_AWAKE_MS - AIRTIME_MS &&
+            unit(rng) >= loss) {
+          found.push_back(probeAt + AIRTIME_MS);
+          ok = true;
+          break;
+        }
+        probeAt += strategy.reportMs;
+      } while (strategy.fullDwell && probeAt < dwellEnd);
+      t = strategy.fullDwell ? dwellEnd : min(probeAt, dwellEnd);
+    }
+    result.notFound += !ok;
+  }
+
+  std::sort(found.begin(), found.end());
+  double sum = 0;
+  for (size_t i = 0; i < found.size(); i++) {
+    sum += found[i];
+  }
+  if (!found.empty()) {
+    result.meanMs = sum / found.size();
+    result.p95Ms = found[found.size() * 95 / 100];
+    result.worstMs = found.back();
+  }
+  return result;
+}
+
+void report(const char *name, const ScanResult &r) {
+  char line[160];
+  snprintf(line, sizeof(line), "%-34s mean %6.0f ms, p95 %6.0f ms, worst %6.0f ms, not found %5.2f%%",
+           name, r.meanMs, r.p95Ms, r.worstMs, 100.0 * r.notFound / TRIALS);
+  TEST_MESSAGE(line);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_sweep_fits_a_listen_window() {
+  // Even with every dwell running to its end the first window finds the indicator
+  Strategy fastReports = SWEEP;
+  fastReports.reportMs = 4;
+  ScanResult dwellEnd = simulate(SWEEP, 0, false, 1);
+  ScanResult early = simulate(fastReports, 0, false, 2);
+  ScanResult common = simulate(SWEEP, 0, true, 3);
+  report("sweep, reports at dwell end:", dwellEnd);
+  report("sweep, reports after 4 ms:", early);
+  report("sweep, moved to 1/6/11:", common);
+  TEST_ASSERT_EQUAL_UINT32(0, dwellEnd.notFound);
+  TEST_ASSERT_TRUE(dwellEnd.worstMs <= INDICATOR_CYCLE_MS);
+  TEST_ASSERT_TRUE(dwellEnd.meanMs < INDICATOR_CYCLE_MS / 2 + CHANNEL_COUNT * CHANNEL_DWELL_MS);
+  TEST_ASSERT_TRUE(early.meanMs <= dwellEnd.meanMs);
+  TEST_ASSERT_TRUE(common.meanMs <= dwellEnd.meanMs);
+}
+
+void test_sweep_with_lost_probes() {
+  // A lost probe costs a cycle, the timeout leaves room for two
+  ScanResult r = simulate(SWEEP, 0.1, false, 4);
+  report("sweep, 10% probes lost:", r);
+  TEST_ASSERT_TRUE(r.notFound <= TRIALS / 100);
+}
+
+void test_sweep_against_a_cycle_per_channel() {
+  Strategy cyclePerChannel = {INDICATOR_CYCLE_MS, CHANNEL_DWELL_MS, true, CHANNEL_COUNT * INDICATOR_CYCLE_MS};
+  ScanResult sweep = simulate(SWEEP, 0, false, 5);
+  ScanResult slow = simulate(cyclePerChannel, 0, false, 5);
+  report("one channel per indicator cycle:", slow);
+  TEST_ASSERT_EQUAL_UINT32(0, slow.notFound);
+  TEST_ASSERT_TRUE(sweep.meanMs * 3 < slow.meanMs);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_sweep_fits_a_listen_window);
+  RUN_TEST(test_sweep_with_lost_probes);
+  RUN_TEST(test_sweep_against_a_cycle_per_channel);
+  return UNITY_END();
+}
@@ -0,0 +1,155 @@
+/**
+ * Cost of resuming a coroutine (coroutine.h) against the hand-written switch
+ * machines it replaced. Both versions of the indicator's acknowledgment
+ * burst below send three acks 20 ms apart. They are polled once per
+ * simulated millisecond, like the protocol task did before the timer wheel,
+ * so most calls only check that nothing is due yet. Both must produce the
+ * same sends at the same times before their timings are compared.
+ *
+ *   pio test -e native -f test_coroutine_bench -v
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include "coroutine.h"
+
+const int ACK_ATTEMPTS = 3;
+const int ACK_INTERVAL_MS = 20;
+const int BURSTS = 20000;
+const int POLLS_PER_BURST = ACK_ATTEMPTS * ACK_INTERVAL_MS + 5;
+
+// What the flows do to the outside world
+struct Radio {
+  uint32_t sends;
+  uint32_t sendTimeSum;  // Sum of millis() at each send, compares the timing of both versions
+};
+
+volatile bool burstRequested = false;
+
+// Switch machine, as processAcknowledgment() was written before the coroutines
+enum AckState { ACK_INIT, ACK_SEND, ACK_WAIT, ACK_COMPLETE };
+AckState ackState = ACK_INIT;
+int switchAttempts = 0;
+
+__attribute__((noinline)) void switchAck(Radio &radio) {
+  static unsigned long ackTimer = 0;
+  unsigned long currentTime = millis();
+
+  switch (ackState) {
+    case ACK_INIT:
+      if (!burstRequested) {
+        break;
+      }
+      burstRequested = false;
+      switchAttempts = 0;
+      ackState = ACK_SEND;
+      // Fall through
+
+    case ACK_SEND:
+      radio.sends++;
+      radio.sendTimeSum += currentTime;
+      switchAttempts++;
+      ackTimer = currentTime;
+      ackState = ACK_WAIT;
+      break;
+
+    case ACK_WAIT:
+      if (currentTime - ackTimer >= (unsigned long)ACK_INTERVAL_MS) {
+        ackState = (switchAttempts < ACK_ATTEMPTS) ? ACK_SEND : ACK_COMPLETE;
+        if (ackState == ACK_SEND) {
+          radio.sends++;
+          radio.sendTimeSum += currentTime;
+          switchAttempts++;
+          ackTimer = currentTime;
+          ackState = ACK_WAIT;
+        }
+      }
+      break;
+
+    case ACK_COMPLETE:
+      ackState = ACK_INIT;
+      break;
+  }
+}
+
+// The same flow as a coroutine
+co_state_t ackFlow;
+int coAttempts = 0;
+
+__attribute__((noinline)) CoStatus coroutineAck(Radio &radio) {
+  CO_BEGIN(ackFlow);
+
+  CO_AWAIT(ackFlow, burstRequested);
+  burstRequested = false;
+  for (coAttempts = 0; coAttempts < ACK_ATTEMPTS; coAttempts++) {
+    radio.sends++;
+    radio.sendTimeSum += millis();
+    CO_DELAY(ackFlow, ACK_INTERVAL_MS);
+  }
+
+  CO_END(ackFlow);
+}
+
+// Runs all bursts through one version, returns nanoseconds per call
+template <typename Step>
+double run(Step step, Radio &radio, uint32_t &calls) {
+  radio.sends = 0;
+  radio.sendTimeSum = 0;
+  calls = 0;
+  hostSetMillis(1000);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int burst = 0; burst < BURSTS; burst++) {
+    burstRequested = true;
+    for (int poll = 0; poll < POLLS_PER_BURST; poll++) {
+      step(radio);
+      calls++;
+      hostAdvanceMs(1);
+    }
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / calls;
+}
+
+void setUp() {
+  ackState = ACK_INIT;
+  CO_RESET(ackFlow);
+  burstRequested = false;
+}
+
+void tearDown() {}
+
+void test_both_versions_send_the_same() {
+  Radio switchRadio, coRadio;
+  uint32_t switchCalls, coCalls;
+  run(switchAck, switchRadio, switchCalls);
+  run(coroutineAck, coRadio, coCalls);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)BURSTS * ACK_ATTEMPTS, switchRadio.sends);
+  TEST_ASSERT_EQUAL_UINT32(switchRadio.sends, coRadio.sends);
+  TEST_ASSERT_EQUAL_UINT32(switchRadio.sendTimeSum, coRadio.sendTimeSum);
+}
+
+void test_resume_cost() {
+  Radio radio;
+  uint32_t calls;
+  double switchNs = 1e9, coNs = 1e9;
+  for (int round = 0; round < 5; round++) {  // Best of five, the host is not idle
+    switchNs = min(switchNs, run(switchAck, radio, calls));
+    coNs = min(coNs, run(coroutineAck, radio, calls));
+  }
+
+  char line[128];
+  snprintf(line, sizeof(line), "%lu calls per version: switch machine %.1f ns/call, coroutine %.1f ns/call",
+           (unsigned long)calls, switchNs, coNs);
+  TEST_MESSAGE(line);
+  snprintf(line, sizeof(line), "state: coroutine %u bytes, switch machine %u bytes (enum + static timer)",
+           (unsigned)sizeof(co_state_t), (unsigned)(sizeof(AckState) + sizeof(unsigned long)));
+  TEST_MESSAGE(line);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_both_versions_send_the_same);
+  RUN_TEST(test_resume_cost);
+  return UNITY_END();
+}
@@ -0,0 +1,142 @@
+/**
+ * Drift estimator (drift_estimator.h) in a simulated sender/indicator pair
+ * with injected clock skew. The sender transmits every HINT_INTERVAL_MS of
+ * its own clock and announces the next frame. The indicator's clock runs
+ * off by the injected skew, and every arrival gets radio and wake-up jitter.
+ * Like the indicator, the simulation expects each announced frame within
+ * guardMs() of the predicted time and reports a miss otherwise. A frame
+ * lost on the air is not counted as a miss here, but the estimator is told
+ * about the empty window just as the indicator would tell it.
+ *
+ *   pio test -e native -f test_drift_sim -v
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include <random>
+#include "drift_estimator.h"
+
+const uint16_t HINT_INTERVAL_MS = 5000;
+const int FRAMES = 2000;               // About 2.8 hours of hints
+const int SETTLE_FRAMES = 20;          // Frames left out of the settled statistics
+const uint32_t JITTER_US = 8000;       // Arrival jitter, uniform, unless a test asks for more
+const double LOSS = 0.02;              // Frames lost on the air
+
+struct SimResult {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t settledMisses;     // Misses after the first SETTLE_FRAMES frames
+  double settledGuardMs;      // Mean guard after the first SETTLE_FRAMES frames
+  uint32_t maxErrorMs;        // Largest prediction error after settling
+  int32_t finalSkewPpm;
+};
+
+// skewPpm: indicator clock rate minus sender clock rate, rampPpmPerHour: how fast it changes
+SimResult simulate(double skewPpm, double rampPpmPerHour, uint32_t seed, uint32_t jitterUs = JITTER_US) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> jitter(0, jitterUs);
+  std::uniform_real_distribution<double> chance(0, 1);
+
+  DriftEstimator estimator;
+  SimResult result = {0, 0, 0, 0, 0, 0};
+  double senderUs = 0;
+  double localUs = 1000000;          // Indicator clock, skewed
+  double guardSum = 0;
+  uint32_t guardCount = 0;
+  bool predicted = false;
+  uint32_t predictedMs = 0, guardMs = 0;
+
+  for (int frame = 0; frame < FRAMES; frame++) {
+    double skew = skewPpm + rampPpmPerHour * senderUs / 3600e6;
+    senderUs += HINT_INTERVAL_MS * 1000.0;
+    localUs += HINT_INTERVAL_MS * 1000.0 * (1 + skew / 1e6);
+    if (chance(rng) < LOSS) {
+      // Lost: the indicator waits out the guard and gives up on this window
+      if (predicted) {
+        estimator.miss();
+      }
+      predicted = false;
+      continue;
+    }
+    uint32_t rxMs = (uint32_t)((localUs + jitter(rng)) / 1000);
+
+    if (predicted) {
+      uint32_t error = (uint32_t)abs((int32_t)(rxMs - predictedMs));
+      if (error <= guardMs) {
+        result.hits++;
+      } else {
+        result.misses++;
+        if (frame >= SETTLE_FRAMES) {
+          result.settledMisses++;
+        }
+        estimator.miss();
+      }
+      if (frame >= SETTLE_FRAMES) {
+        result.maxErrorMs = max(result.maxErrorMs, error);
+        guardSum += guardMs;
+        guardCount++;
+      }
+    }
+
+    estimator.frame(rxMs, HINT_INTERVAL_MS);
+    predictedMs = rxMs + estimator.toLocalMs(HINT_INTERVAL_MS);
+    guardMs = estimator.guardMs(HINT_INTERVAL_MS);
+    predicted = true;
+  }
+  result.settledGuardMs = guardCount ? guardSum / guardCount : 0;
+  result.finalSkewPpm = estimator.save().skewPpm;
+  return result;
+}
+
+void report(const char *name, double skewPpm, double rampPpmPerHour, const SimResult &r) {
+  char line[160];
+  snprintf(line, sizeof(line),
+           "%-9s skew %+7.0f ppm%+5.0f/h: estimate %+6ld ppm, guard %5.1f ms (fixed %lu), "
+           "max error %3lu ms, misses %lu (%lu settled)",
+           name, skewPpm, rampPpmPerHour, (long)r.finalSkewPpm, r.settledGuardMs,
+           (unsigned long)DriftEstimator().guardMs(HINT_INTERVAL_MS), (unsigned long)r.maxErrorMs,
+           (unsigned long)r.misses, (unsigned long)r.settledMisses);
+  TEST_MESSAGE(line);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_constant_skew() {
+  const double skews[] = {-20000, -3000, 0, 800, 15000};
+  for (size_t i = 0; i < sizeof(skews) / sizeof(skews[0]); i++) {
+    SimResult r = simulate(skews[i], 0, i + 1);
+    report("constant", skews[i], 0, r);
+    TEST_ASSERT_EQUAL_UINT32(0, r.settledMisses);
+    TEST_ASSERT_LESS_THAN((int32_t)DriftEstimator().guardMs(HINT_INTERVAL_MS) / 2, (int32_t)r.settledGuardMs);
+    TEST_ASSERT_LESS_OR_EQUAL(100, abs(r.finalSkewPpm - (int32_t)skews[i]));
+  }
+}
+
+void test_skew_ramp() {
+  // Temperature changes move the RTC slow clock by a few hundred ppm per hour
+  const double ramps[] = {-400, 400};
+  for (size_t i = 0; i < sizeof(ramps) / sizeof(ramps[0]); i++) {
+    SimResult r = simulate(1000, ramps[i], 10 + i);
+    report("ramp", 1000, ramps[i], r);
+    TEST_ASSERT_EQUAL_UINT32(0, r.settledMisses);
+    TEST_ASSERT_LESS_THAN((int32_t)DriftEstimator().guardMs(HINT_INTERVAL_MS), (int32_t)r.settledGuardMs);
+  }
+}
+
+void test_wake_jitter() {
+  // A slow light-sleep wake-up adds tens of milliseconds, the guard has to follow the spread
+  SimResult quiet = simulate(800, 0, 20);
+  SimResult noisy = simulate(800, 0, 20, 30000);
+  report("jitter", 800, 0, noisy);
+  TEST_ASSERT_EQUAL_UINT32(0, noisy.settledMisses);
+  TEST_ASSERT_GREATER_THAN((int32_t)quiet.settledGuardMs, (int32_t)noisy.settledGuardMs);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_constant_skew);
+  RUN_TEST(test_skew_ramp);
+  RUN_TEST(test_wake_jitter);
+  return UNITY_END();
+}
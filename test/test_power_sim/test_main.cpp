@@ -0,0 +1,287 @@
+/**
+ * The indicator's manual sleep cycle against power-managed sleep
+ * (power_manager.h), driven by the same command trace on the simulated clock.
+ *
+ * Manual mode follows processSleepWakeup() in indicator.cpp: after the
+ * listen time a brief scan, then light sleep with the radio off and its
+ * bring-up on waking, and every MAX_SLEEP_CYCLES cycles a short extended
+ * awake period. Power-managed mode keeps ESP-NOW up and listens for
+ * AWAKE_TIME_MS out of every AWAKE_TIME_MS + SLEEP_DURATION_MS at a phase of
+ * its own. Both stay fully awake for AWAKE_AFTER_COMMAND_MS after a command.
+ * Wake hints are left out, so this is the cycle a sender without a hint
+ * (a first command, a lost hint) has to hit.
+ *
+ * The sender retries the way processCommandCycle() does until a command
+ * goes out while the indicator listens. Latency is the time from the first
+ * send to that delivery. Current is counted at ACTIVE_MA while the radio is
+ * on or being brought up, TX_MA for each acknowledgment, and LIGHT_SLEEP_MA
+ * otherwise. The LEDs draw the same in both modes and are left out.
+ *
+ *   pio test -e native -f test_power_sim -v
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// The indicator's timing (indicator.cpp)
+const uint32_t AWAKE_TIME_MS = 300;
+const uint32_t SLEEP_DURATION_MS = 1700;
+const uint32_t AWAKE_AFTER_COMMAND_MS = 3000;
+const uint32_t SLEEP_REINIT_MS = 80;
+const int MAX_SLEEP_CYCLES = 10;
+const uint32_t EXTENDED_AWAKE_MS = 100;   // The forced period ends on its first check, long after a command
+const uint32_t LISTEN_INTERVAL_MS = AWAKE_TIME_MS + SLEEP_DURATION_MS;
+
+// The sender's timing (sender.cpp)
+const uint32_t RETRY_INTERVAL_MS = 500;
+const uint32_t RETRY_JITTER_MS = 100;
+const int MAX_RETRIES_BEFORE_WAIT = 12;
+const uint32_t BACKOFF_MIN_MS = 2000;
+const uint32_t BACKOFF_MAX_MS = 60000;
+
+// ESP32 datasheet figures
+const double ACTIVE_MA = 95;          // CPU running, radio receiving
+const double TX_MA = 180;
+const double LIGHT_SLEEP_MA = 0.8;
+const uint32_t ACK_MS = 1;
+
+const uint32_t DURATION_MS = 12 * 3600000UL;
+
+enum Mode { MANUAL, MANAGED };
+
+// Manual cycle, as sleepState moves through it
+enum Phase { LISTEN, PRE_SLEEP, SLEEP, REINIT };
+
+struct Indicator {
+  Mode mode;
+  Phase phase;
+  unsigned long phaseEnd;
+  int cycles;
+  unsigned long lastCommand;
+  uint32_t windowOffset;   // Power-managed listen windows, relative to the simulated clock
+
+  void begin(Mode m, uint32_t offset) {
+    mode = m;
+    lastCommand = millis();  // Setup starts awake
+    phase = LISTEN;
+    phaseEnd = lastCommand + AWAKE_AFTER_COMMAND_MS;
+    cycles = 0;
+    windowOffset = offset;
+  }
+
+  bool afterCommand() const { return millis() - lastCommand < AWAKE_AFTER_COMMAND_MS; }
+
+  bool listening() const {
+    if (afterCommand()) {
+      return true;
+    }
+    if (mode == MANAGED) {
+      return (millis() + windowOffset) % LISTEN_INTERVAL_MS < AWAKE_TIME_MS;
+    }
+    return phase == LISTEN || phase == PRE_SLEEP;
+  }
+
+  double currentMa() const {
+    if (mode == MANUAL && !afterCommand()) {
+      return (phase == SLEEP) ? LIGHT_SLEEP_MA : ACTIVE_MA;
+    }
+    return listening() ? ACTIVE_MA : LIGHT_SLEEP_MA;
+  }
+
+  void receive() {
+    lastCommand = millis();
+    cycles = 0;
+    phase = LISTEN;  // A command during the brief scan calls the sleep off
+    phaseEnd = lastCommand + AWAKE_AFTER_COMMAND_MS;
+  }
+
+  // Manual cycle, once per simulated millisecond
+  void step() {
+    if (mode == MANAGED || afterCommand() || (long)(millis() - phaseEnd) < 0) {
+      return;
+    }
+    switch (phase) {
+      case LISTEN:
+        phase = PRE_SLEEP;
+        phaseEnd = millis() + AWAKE_TIME_MS;
+        break;
+      case PRE_SLEEP:
+        phase = SLEEP;
+        phaseEnd = millis() + SLEEP_DURATION_MS;
+        break;
+      case SLEEP:
+        phase = REINIT;
+        phaseEnd = millis() + SLEEP_REINIT_MS;
+        break;
+      case REINIT:
+        phase = LISTEN;
+        if (++cycles >= MAX_SLEEP_CYCLES) {
+          cycles = 0;
+          phaseEnd = millis() + EXTENDED_AWAKE_MS;
+        } else {
+          phaseEnd = millis() + AWAKE_TIME_MS;
+        }
+        break;
+    }
+  }
+};
+
+struct SimResult {
+  double averageMa;
+  double listeningShare;
+  uint32_t delivered;
+  uint32_t replaced;        // Superseded by the next command before delivery
+  uint32_t sends;
+  double meanLatencyMs;
+  double medianLatencyMs;
+  double p95LatencyMs;
+  double p99LatencyMs;
+  double worstLatencyMs;
+};
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double> &sorted, double p) {
+  size_t rank = (size_t)ceil(p / 100 * sorted.size());
+  return sorted[max(rank, (size_t)1) - 1];
+}
+
+// Commands at exponentially distributed intervals
+std::vector<unsigned long> commandTrace(double meanIntervalMs, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::exponential_distribution<double> interval(1 / meanIntervalMs);
+  std::vector<unsigned long> trace;
+  for (double t = interval(rng); t < DURATION_MS; t += interval(rng)) {
+    trace.push_back((unsigned long)t);
+  }
+  return trace;
+}
+
+SimResult simulate(Mode mode, const std::vector<unsigned long> &trace, uint32_t seed) {
+  std::mt19937 rng(seed);
+  Indicator indicator;
+  SimResult result = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  std::vector<double> latencies;
+  double chargeMaMs = 0;
+  uint32_t listeningMs = 0;
+  size_t next = 0;
+  bool pending = false;
+  unsigned long firstSend = 0, sendAt = 0;
+  int retries = 0;
+  uint32_t backoffMs = 0;
+
+  hostSetMillis(0);
+  indicator.begin(mode, rng() % LISTEN_INTERVAL_MS);
+  for (uint32_t t = 0; t < DURATION_MS; t++, hostAdvanceMs(1)) {
+    if (next < trace.size() && trace[next] == millis()) {
+      result.replaced += pending;
+      pending = true;
+      firstSend = sendAt = millis();
+      retries = 0;
+      next++;
+    }
+    indicator.step();
+
+    if (pending && millis() == sendAt) {
+      result.sends++;
+      if (indicator.listening()) {
+        indicator.receive();
+        latencies.push_back(millis() - firstSend);
+        chargeMaMs += (TX_MA - ACTIVE_MA) * ACK_MS;
+        pending = false;
+        backoffMs = 0;
+      } else if (++retries >= MAX_RETRIES_BEFORE_WAIT) {
+        backoffMs = backoffMs ? min(backoffMs * 2, BACKOFF_MAX_MS) : BACKOFF_MIN_MS;
+        sendAt = millis() + backoffMs + rng() % (backoffMs / 2);
+        retries = 0;
+      } else {
+        sendAt = millis() + RETRY_INTERVAL_MS + rng() % RETRY_JITTER_MS;
+      }
+    }
+
+    chargeMaMs += indicator.currentMa();
+    listeningMs += indicator.listening();
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  double sum = 0;
+  for (size_t i = 0; i < latencies.size(); i++) {
+    sum += latencies[i];
+  }
+  result.averageMa = chargeMaMs / DURATION_MS;
+  result.listeningShare = (double)listeningMs / DURATION_MS;
+  result.delivered = latencies.size();
+  if (!latencies.empty()) {
+    result.meanLatencyMs = sum / latencies.size();
+    result.medianLatencyMs = percentile(latencies, 50);
+    result.p95LatencyMs = percentile(latencies, 95);
+    result.p99LatencyMs = percentile(latencies, 99);
+    result.worstLatencyMs = latencies.back();
+  }
+  return result;
+}
+
+void report(const char *trace, Mode mode, const SimResult &r) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "%-9s %-8s %6.2f mA (%5.0f mAh/day), listening %4.1f%%, %5lu delivered, %4.2f sends each, "
+           "latency mean %5.0f median %4.0f p95 %5.0f p99 %5.0f worst %5.0f ms",
+           trace, mode == MANUAL ? "manual:" : "managed:", r.averageMa, r.averageMa * 24,
+           r.listeningShare * 100, (unsigned long)r.delivered,
+           r.delivered ? (double)r.sends / r.delivered : 0, r.meanLatencyMs, r.medianLatencyMs,
+           r.p95LatencyMs, r.p99LatencyMs, r.worstLatencyMs);
+  TEST_MESSAGE(line);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_sparse_commands() {
+  // A command every few minutes, the indicator spends nearly all its time in the idle cycle
+  std::vector<unsigned long> trace = commandTrace(300000, 1);
+  SimResult manual = simulate(MANUAL, trace, 2);
+  SimResult managed = simulate(MANAGED, trace, 2);
+  report("sparse", MANUAL, manual);
+  report("sparse", MANAGED, managed);
+  TEST_ASSERT_EQUAL_UINT32(trace.size(), manual.delivered + manual.replaced);
+  TEST_ASSERT_EQUAL_UINT32(trace.size(), managed.delivered + managed.replaced);
+  TEST_ASSERT_TRUE(managed.averageMa < manual.averageMa);
+  // Either cycle is hit before the retries run out and the sender pauses
+  const double retriesMs = MAX_RETRIES_BEFORE_WAIT * (RETRY_INTERVAL_MS + RETRY_JITTER_MS);
+  TEST_ASSERT_TRUE(manual.worstLatencyMs < retriesMs);
+  TEST_ASSERT_TRUE(managed.worstLatencyMs < retriesMs);
+}
+
+void test_busy_commands() {
+  // A command every ten seconds on average, like the sender's built-in sequence
+  std::vector<unsigned long> trace = commandTrace(10000, 3);
+  SimResult manual = simulate(MANUAL, trace, 4);
+  SimResult managed = simulate(MANAGED, trace, 4);
+  report("busy", MANUAL, manual);
+  report("busy", MANAGED, managed);
+  TEST_ASSERT_TRUE(managed.averageMa < manual.averageMa);
+}
+
+void test_idle_current() {
+  // Without commands only the cycles differ: bring-up and the brief scan against listen windows
+  std::vector<unsigned long> none;
+  SimResult manual = simulate(MANUAL, none, 5);
+  SimResult managed = simulate(MANAGED, none, 5);
+  report("idle", MANUAL, manual);
+  report("idle", MANAGED, managed);
+  double managedMa = ACTIVE_MA * AWAKE_TIME_MS / LISTEN_INTERVAL_MS +
+                     LIGHT_SLEEP_MA * SLEEP_DURATION_MS / LISTEN_INTERVAL_MS;
+  TEST_ASSERT_FLOAT_WITHIN(0.2, managedMa, managed.averageMa);
+  TEST_ASSERT_TRUE(managed.averageMa < manual.averageMa);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_sparse_commands);
+  RUN_TEST(test_busy_commands);
+  RUN_TEST(test_idle_current);
+  return UNITY_END();
+}
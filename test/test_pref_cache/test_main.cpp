@@ -0,0 +1,170 @@
+/**
+ * Flash write coalescing (pref_cache.h) under a discovery flood. The loop
+ * below mirrors the indicator: every received frame marks the peer table
+ * dirty, the app task flushes whenever it wakes, and only blobs that differ
+ * from flash are written.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "pref_cache.h"
+
+const uint32_t FLUSH_INTERVAL_MS = 5000;
+const uint32_t KEY_PEERS = 1 << 0;
+
+struct FakeFlash {
+  uint8_t peers[6];
+  uint32_t writes;
+};
+
+FakeFlash flash;
+PrefCoalescer *cache;
+PrefShadow<6> *shadow;
+uint8_t ramPeer[6];
+
+void setUp() {
+  static const uint8_t stored[6] = {0x24, 0x6F, 0x28, 0x01, 0x02, 0x03};
+  memcpy(flash.peers, stored, 6);
+  flash.writes = 0;
+  memcpy(ramPeer, stored, 6);
+  cache = new PrefCoalescer(FLUSH_INTERVAL_MS);
+  shadow = new PrefShadow<6>();
+  shadow->stored(flash.peers, 6);  // Loaded at boot
+  hostSetMillis(1000);
+}
+
+void tearDown() {
+  delete cache;
+  delete shadow;
+}
+
+// A discovery frame from mac, what updatePeer() does to the persisted state
+void receive(const uint8_t *mac) {
+  memcpy(ramPeer, mac, 6);
+  cache->markDirty(KEY_PEERS);
+}
+
+// What flushPreferences() does
+void flush() {
+  uint32_t dirty = cache->collect(millis());
+  if ((dirty & KEY_PEERS) && shadow->differs(ramPeer, 6)) {
+    memcpy(flash.peers, ramPeer, 6);
+    shadow->stored(ramPeer, 6);
+    cache->wrote();
+    flash.writes++;
+  }
+}
+
+// frames spread over durationMs, the app task flushes every pollMs
+void flood(const uint8_t macs[][6], int macCount, uint32_t frames, uint32_t durationMs, uint32_t pollMs) {
+  uint32_t start = millis();
+  uint32_t nextPoll = start;
+  for (uint32_t i = 0; i < frames; i++) {
+    hostSetMillis(start + (uint64_t)i * durationMs / frames);
+    receive(macs[i % macCount]);
+    while ((int32_t)(millis() - nextPoll) >= 0) {
+      flush();
+      nextPoll += pollMs;
+    }
+  }
+  hostSetMillis(start + durationMs + FLUSH_INTERVAL_MS);
+  flush();
+}
+
+void test_flood_from_stored_sender_writes_nothing() {
+  const uint8_t macs[1][6] = {{0x24, 0x6F, 0x28, 0x01, 0x02, 0x03}};
+  flood(macs, 1, 100000, 60000, 1);
+  TEST_ASSERT_EQUAL_UINT32(0, flash.writes);
+  TEST_ASSERT_FALSE(cache->dirty());
+}
+
+void test_flood_from_new_sender_writes_once() {
+  const uint8_t macs[1][6] = {{0x24, 0x6F, 0x28, 0xAA, 0xBB, 0xCC}};
+  flood(macs, 1, 100000, 60000, 1);
+  TEST_ASSERT_EQUAL_UINT32(1, flash.writes);
+  TEST_ASSERT_EQUAL_MEMORY(macs[0], flash.peers, 6);
+}
+
+void test_alternating_senders_write_at_most_once_per_interval() {
+  const uint8_t macs[2][6] = {{0x24, 0x6F, 0x28, 0xAA, 0xBB, 0xCC}, {0x24, 0x6F, 0x28, 0xDD, 0xEE, 0xFF}};
+  const uint32_t durationMs = 60000;
+  flood(macs, 2, 100001, durationMs, 1);
+
+  char line[64];
+  snprintf(line, sizeof(line), "100001 frames in %lu ms: %lu flash writes",
+           (unsigned long)durationMs, (unsigned long)flash.writes);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(durationMs / FLUSH_INTERVAL_MS + 2, flash.writes);
+  TEST_ASSERT_EQUAL_MEMORY(macs[0], flash.peers, 6);  // The last frame's sender ends up in flash
+  TEST_ASSERT_EQUAL_UINT32(flash.writes, cache->writes());
+}
+
+void test_change_is_written_within_one_interval() {
+  const uint8_t mac[6] = {0x24, 0x6F, 0x28, 0xAA, 0xBB, 0xCC};
+  hostSetMillis(20000);
+  flush();  // Nothing dirty, the interval does not start
+  receive(mac);
+  TEST_ASSERT_EQUAL_UINT32(0, cache->msUntilFlush(millis()));
+  flush();
+  TEST_ASSERT_EQUAL_UINT32(1, flash.writes);
+
+  // A second change right after waits for the interval, not longer
+  const uint8_t other[6] = {0x24, 0x6F, 0x28, 0xDD, 0xEE, 0xFF};
+  hostAdvanceMs(10);
+  receive(other);
+  TEST_ASSERT_EQUAL_UINT32(FLUSH_INTERVAL_MS - 10, cache->msUntilFlush(millis()));
+  hostAdvanceMs(FLUSH_INTERVAL_MS - 11);
+  flush();
+  TEST_ASSERT_EQUAL_UINT32(1, flash.writes);
+  hostAdvanceMs(1);
+  flush();
+  TEST_ASSERT_EQUAL_UINT32(2, flash.writes);
+}
+
+void test_change_and_change_back_writes_nothing() {
+  const uint8_t stored[6] = {0x24, 0x6F, 0x28, 0x01, 0x02, 0x03};
+  const uint8_t other[6] = {0x24, 0x6F, 0x28, 0xDD, 0xEE, 0xFF};
+  hostSetMillis(20000);
+  flush();
+  hostAdvanceMs(1);
+  receive(other);
+  receive(stored);
+  hostAdvanceMs(FLUSH_INTERVAL_MS);
+  flush();
+  TEST_ASSERT_EQUAL_UINT32(0, flash.writes);
+}
+
+void test_shadow_compares_length() {
+  PrefShadow<16> blob;
+  const uint8_t bytes[16] = {1, 2, 3, 4};
+  blob.stored(bytes, 8);
+  TEST_ASSERT_FALSE(blob.differs(bytes, 8));
+  TEST_ASSERT_TRUE(blob.differs(bytes, 16));  // A peer was added, even if it is all zeros
+  TEST_ASSERT_TRUE(blob.differs(bytes, 4));
+}
+
+void test_interval_survives_millis_wrap() {
+  const uint8_t mac[6] = {0x24, 0x6F, 0x28, 0xAA, 0xBB, 0xCC};
+  hostSetMillis(0xFFFFFFFFUL - 1000);
+  cache->markDirty(KEY_PEERS);
+  flush();
+  receive(mac);
+  hostAdvanceMs(FLUSH_INTERVAL_MS - 1);
+  flush();
+  TEST_ASSERT_EQUAL_UINT32(0, flash.writes);
+  hostAdvanceMs(1);
+  flush();
+  TEST_ASSERT_EQUAL_UINT32(1, flash.writes);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_flood_from_stored_sender_writes_nothing);
+  RUN_TEST(test_flood_from_new_sender_writes_once);
+  RUN_TEST(test_alternating_senders_write_at_most_once_per_interval);
+  RUN_TEST(test_change_is_written_within_one_interval);
+  RUN_TEST(test_change_and_change_back_writes_nothing);
+  RUN_TEST(test_shadow_compares_length);
+  RUN_TEST(test_interval_survives_millis_wrap);
+  return UNITY_END();
+}
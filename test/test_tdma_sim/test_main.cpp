@@ -0,0 +1,333 @@
+/**
+ * Time slots (tdma_schedule.h) in a simulated installation of 50 to 200
+ * sender/indicator pairs sharing one channel, against the same pairs
+ * sending whenever their own timers say.
+ *
+ * Each pair exchanges a command or heartbeat and its acknowledgment about
+ * every HEARTBEAT_INTERVAL_MS, and a failed exchange is retried the way
+ * processCommandCycle() does it, up to MAX_RETRIES_BEFORE_WAIT times, then
+ * again after a pause that doubles from BACKOFF_MIN_MS to BACKOFF_MAX_MS.
+ * Retries outside a slot and pauses get the same random spread as there.
+ * Carrier sense makes a sender wait for a busy channel, but two senders
+ * starting within CARRIER_SENSE_MS of each other, or pairs out of each
+ * other's range (HIDDEN of them), overlap and lose both exchanges. Every
+ * sender runs its own TdmaSchedule on a clock with crystal skew and boots
+ * at a random time. Beacons follow sendBeacon()/handleBeacon(), each heard
+ * by a given sender with BEACON_HEARD probability, and take no part in the
+ * collision count. Pairs the beacons leave without a slot run uncoordinated.
+ *
+ * Latency is the time from when an exchange was due to its acknowledgment,
+ * through all its retries and pauses. The few exchanges that go into a
+ * pause wait seconds to minutes, which can put the mean above the 99th
+ * percentile, so the report gives the share of exchanges that paused and
+ * the 99.9th percentile as well.
+ *
+ *   pio test -e native -f test_tdma_sim -v
+ */
+
+#define TDMA_SLOTS
+#include <Arduino.h>
+#include <unity.h>
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <random>
+#include <vector>
+#include "tdma_schedule.h"
+
+// The sender's timing (sender.cpp)
+const uint32_t RETRY_INTERVAL_MS = 500;
+const double RETRY_JITTER_MS = 100;
+const uint32_t HEARTBEAT_INTERVAL_MS = 5000;
+const int MAX_RETRIES_BEFORE_WAIT = 12;
+const double BACKOFF_MIN_MS = 2000;
+const double BACKOFF_MAX_MS = 60000;
+
+const double EXCHANGE_MS = 2.0;           // Command, indicator turnaround and acknowledgment
+const double WAKE_JITTER_MS = 1.0;        // Task wake-up after the timer, uniform
+const double CARRIER_SENSE_MS = 0.05;     // Starts closer than this don't see each other
+const double BUSY_BACKOFF_MS = 0.3;       // Random wait after a busy channel clears
+const double HIDDEN = 0.2;                // Pairs of pairs that can't hear each other
+const double CLOCK_SKEW_PPM = 20;         // Crystal tolerance, uniform in +-
+const double BEACON_HEARD = 0.8;
+const double WARMUP_MS = 120000;          // Beacons spread the timing before statistics start
+const double DURATION_MS = 3600000;
+
+struct Pair {
+  uint8_t mac[6];
+  double rate;        // Local clock ms per simulated ms
+  double offsetMs;    // Local clock at simulated time 0
+  TdmaSchedule tdma;
+  uint8_t slot;
+  bool synced;        // Indicator follows the slot, false after TDMA_SLOT_RETRIES misses
+  int retries;
+  double backoffMs;   // Pause after the last unanswered retries, 0 once acknowledged
+  bool paused;        // The current exchange went into a pause
+  double dueAt;       // When the current exchange was first due
+
+  uint32_t local(double t) const { return (uint32_t)(t * rate + offsetMs); }
+  double global(uint32_t localMs) const { return (localMs - offsetMs) / rate; }
+};
+
+enum EventType { EXCHANGE_START, EXCHANGE_END, BEACON };
+
+struct Event {
+  double at;
+  EventType type;
+  int pair;
+  bool operator>(const Event &other) const { return at > other.at; }
+};
+
+struct OnAir {
+  int pair;
+  double end;
+  bool collided;
+};
+
+struct SimResult {
+  uint32_t attempts;
+  uint32_t collided;
+  uint32_t delivered;
+  uint32_t paused;          // Delivered exchanges that went through a pause
+  uint32_t unslotted;       // Pairs without a slot at the end
+  double meanLatencyMs;
+  double medianLatencyMs;
+  double p99LatencyMs;
+  double p999LatencyMs;
+  double worstLatencyMs;
+  double deliveredPerPairMin;
+};
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double> &sorted, double p) {
+  size_t rank = (size_t)ceil(p / 100 * sorted.size());
+  return sorted[max(rank, (size_t)1) - 1];
+}
+
+SimResult simulate(int pairs, bool slotted, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> unit(0, 1);
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events;
+  std::vector<Pair> fleet(pairs);
+  std::vector<std::vector<bool> > hidden(pairs, std::vector<bool>(pairs, false));
+  std::vector<OnAir> air;
+  std::vector<double> latencies;
+  SimResult result = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+  for (int i = 0; i < pairs; i++) {
+    Pair &p = fleet[i];
+    for (int b = 0; b < 6; b++) {
+      p.mac[b] = rng();
+    }
+    p.rate = 1 + (unit(rng) * 2 - 1) * CLOCK_SKEW_PPM / 1e6;
+    p.offsetMs = unit(rng) * 1000000;
+    p.slot = TdmaSchedule::preferredSlot(p.mac);
+    p.synced = slotted;
+    p.retries = 0;
+    p.backoffMs = 0;
+    p.paused = false;
+    double boot = unit(rng) * HEARTBEAT_INTERVAL_MS;
+    if (slotted) {
+      p.tdma.begin(p.local(boot));
+      Event beacon = {p.global(p.tdma.nextSlot(TDMA_BEACON_SLOT, p.local(boot), 0)), BEACON, i};
+      events.push(beacon);
+    }
+    for (int j = 0; j < i; j++) {
+      hidden[i][j] = hidden[j][i] = unit(rng) < HIDDEN;
+    }
+    p.dueAt = boot;
+    Event start = {boot, EXCHANGE_START, i};
+    events.push(start);
+  }
+
+  while (!events.empty() && events.top().at < DURATION_MS) {
+    Event event = events.top();
+    events.pop();
+    Pair &p = fleet[event.pair];
+    bool counted = event.at >= WARMUP_MS;
+
+    if (event.type == EXCHANGE_START) {
+      // Wait for a busy channel unless the other exchange started too recently to be heard
+      double busyUntil = 0;
+      for (size_t j = 0; j < air.size();) {
+        if (air[j].end <= event.at) {
+          air[j] = air.back();
+          air.pop_back();
+          continue;
+        }
+        if (!hidden[event.pair][air[j].pair] && air[j].end - EXCHANGE_MS + CARRIER_SENSE_MS <= event.at) {
+          busyUntil = max(busyUntil, air[j].end);
+        }
+        j++;
+      }
+      if (busyUntil > 0) {
+        Event retry = {busyUntil + unit(rng) * BUSY_BACKOFF_MS, EXCHANGE_START, event.pair};
+        events.push(retry);
+        continue;
+      }
+      // Whatever is still on the air collides with this exchange, and this one with it
+      OnAir exchange = {event.pair, event.at + EXCHANGE_MS, false};
+      for (size_t j = 0; j < air.size(); j++) {
+        air[j].collided = true;
+        exchange.collided = true;
+      }
+      air.push_back(exchange);
+      Event end = {exchange.end, EXCHANGE_END, event.pair};
+      events.push(end);
+
+    } else if (event.type == EXCHANGE_END) {
+      bool ok = true;
+      for (size_t j = 0; j < air.size(); j++) {
+        if (air[j].pair == event.pair && air[j].end == event.at) {
+          ok = !air[j].collided;
+        }
+      }
+      uint32_t now = p.local(event.at);
+      uint32_t next;
+      if (counted) {
+        result.attempts++;
+        result.collided += !ok;
+      }
+      if (ok) {
+        double latency = event.at - p.dueAt;
+        if (counted) {
+          latencies.push_back(latency);
+          result.delivered++;
+          result.paused += p.paused;
+        }
+        p.retries = 0;
+        p.backoffMs = 0;
+        p.paused = false;
+        p.synced = slotted && p.slot != TDMA_NO_SLOT && !p.tdma.crowded(now);
+        next = p.tdma.nextSlot(p.slot, now, HEARTBEAT_INTERVAL_MS);
+        p.dueAt = p.global(next);
+      } else {
+        p.retries++;
+        if (p.retries >= TDMA_SLOT_RETRIES) {
+          p.synced = false;  // Reach the indicator on its regular cycle
+        }
+        if (p.retries >= MAX_RETRIES_BEFORE_WAIT) {
+          // The state stays queued and goes out again after the pause
+          p.backoffMs = p.backoffMs ? min(p.backoffMs * 2, BACKOFF_MAX_MS) : BACKOFF_MIN_MS;
+          p.paused = true;
+          p.retries = 0;
+          next = now + (uint32_t)(p.backoffMs * (1 + unit(rng) / 2));
+        } else {
+          next = p.synced ? p.tdma.nextSlot(p.slot, now, RETRY_INTERVAL_MS) : now + RETRY_INTERVAL_MS + (uint32_t)(unit(rng) * RETRY_JITTER_MS);
+        }
+      }
+      Event start = {p.global(next) + unit(rng) * WAKE_JITTER_MS, EXCHANGE_START, event.pair};
+      events.push(start);
+
+    } else {
+      // sendBeacon() at the start of our frame, handleBeacon() on every sender that hears it
+      uint32_t now = p.local(event.at);
+      uint16_t etaMs = p.tdma.nextSlot(TDMA_BEACON_SLOT, now, 0) - now;
+      for (int j = 0; j < pairs; j++) {
+        Pair &q = fleet[j];
+        if (j == event.pair || unit(rng) >= BEACON_HEARD) {
+          continue;
+        }
+        if (p.slot == TDMA_NO_SLOT) {
+          q.tdma.slotsExhausted(q.local(event.at));
+        }
+        if (memcmp(p.mac, q.mac, 6) >= 0) {
+          continue;
+        }
+        uint32_t frameStart = q.local(event.at) + etaMs;
+        if (abs(q.tdma.offsetFrom(frameStart)) > TDMA_ALIGN_TOLERANCE_MS) {
+          q.tdma.align(frameStart);
+        }
+        q.slot = q.tdma.slotAfterBeacon(p.slot, q.slot, q.local(event.at));
+        if (q.slot == TDMA_NO_SLOT) {
+          q.synced = false;
+        }
+      }
+      Event beacon = {p.global(p.tdma.nextSlot(TDMA_BEACON_SLOT, now, TDMA_BEACON_INTERVAL_MS)), BEACON,
+                      event.pair};
+      events.push(beacon);
+    }
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  double sum = 0;
+  for (size_t i = 0; i < latencies.size(); i++) {
+    sum += latencies[i];
+  }
+  for (int i = 0; i < pairs; i++) {
+    result.unslotted += slotted && fleet[i].slot == TDMA_NO_SLOT;
+  }
+  if (!latencies.empty()) {
+    result.meanLatencyMs = sum / latencies.size();
+    result.medianLatencyMs = percentile(latencies, 50);
+    result.p99LatencyMs = percentile(latencies, 99);
+    result.p999LatencyMs = percentile(latencies, 99.9);
+    result.worstLatencyMs = latencies.back();
+  }
+  result.deliveredPerPairMin = result.delivered / (double)pairs / ((DURATION_MS - WARMUP_MS) / 60000);
+  return result;
+}
+
+double collisionRate(const SimResult &r) {
+  return r.attempts ? (double)r.collided / r.attempts : 0;
+}
+
+void report(int pairs, bool slotted, const SimResult &r) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "%3d pairs %-13s collisions %5.2f%%, paused %5.3f%%, latency mean %6.1f median %4.1f "
+           "p99 %6.1f p99.9 %7.1f worst %8.1f ms, %4.1f exchanges/pair/min, %3lu pairs without slot",
+           pairs, slotted ? "slotted:" : "uncoordinated:", collisionRate(r) * 100,
+           r.delivered ? 100.0 * r.paused / r.delivered : 0, r.meanLatencyMs, r.medianLatencyMs,
+           r.p99LatencyMs, r.p999LatencyMs, r.worstLatencyMs, r.deliveredPerPairMin,
+           (unsigned long)r.unslotted);
+  TEST_MESSAGE(line);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_slots_against_uncoordinated() {
+  // Up to one pair per slot, 99 pairs are 198 nodes on the channel
+  const int sizes[] = {50, 75, TDMA_SLOT_COUNT - 1};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    SimResult free = simulate(sizes[i], false, i + 1);
+    SimResult slotted = simulate(sizes[i], true, i + 1);
+    report(sizes[i], false, free);
+    report(sizes[i], true, slotted);
+    TEST_ASSERT_TRUE(collisionRate(slotted) < collisionRate(free));
+    TEST_ASSERT_TRUE(slotted.meanLatencyMs < free.meanLatencyMs);
+    TEST_ASSERT_TRUE(slotted.worstLatencyMs < free.worstLatencyMs);
+  }
+}
+
+void test_more_pairs_than_slots() {
+  // The pairs beyond the slot count find no slot, and their beacons make the whole
+  // fleet run uncoordinated rather than partly on slots
+  const int sizes[] = {150, 200};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    SimResult free = simulate(sizes[i], false, i + 1);
+    SimResult slotted = simulate(sizes[i], true, i + 1);
+    report(sizes[i], false, free);
+    report(sizes[i], true, slotted);
+    TEST_ASSERT_TRUE(slotted.unslotted > 0);
+    TEST_ASSERT_TRUE(collisionRate(slotted) < collisionRate(free) + 0.001);
+    TEST_ASSERT_TRUE(slotted.p99LatencyMs < free.p99LatencyMs * 1.1);
+  }
+}
+
+void test_no_collisions_while_slots_last() {
+  // Once the beacons have spread, every pair owns its slot
+  for (uint32_t seed = 1; seed <= 5; seed++) {
+    SimResult r = simulate(TDMA_SLOT_COUNT / 2, true, seed);
+    TEST_ASSERT_EQUAL_UINT32(0, r.collided);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_slots_against_uncoordinated);
+  RUN_TEST(test_more_pairs_than_slots);
+  RUN_TEST(test_no_collisions_while_slots_last);
+  return UNITY_END();
+}
@@ -0,0 +1,183 @@
+/**
+ * Timer wheel (timer_wheel.h) against a brute-force model. Random arms,
+ * cancels and clock jumps, with delays on every level and beyond the wheel
+ * and millis() wrapping. After every step nextExpiry() has to name the
+ * earliest pending deadline, since the protocol task sleeps until then.
+ * Every timer has to fire at the first advance() at or after its deadline,
+ * never before.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include <vector>
+#include <random>
+#include "timer_wheel.h"
+
+struct Model {
+  bool armed;
+  uint32_t due;
+  bool fired;
+  uint32_t firedAt;
+};
+
+std::vector<Model> model;
+
+void onFire(WheelTimer &, void *arg) {
+  Model &m = *(Model *)arg;
+  m.fired = true;
+  m.firedAt = millis();
+}
+
+bool earliest(uint32_t &due) {
+  bool found = false;
+  for (size_t i = 0; i < model.size(); i++) {
+    if (model[i].armed && (!found || (int32_t)(model[i].due - due) < 0)) {
+      due = model[i].due;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_long_timer_does_not_hide_earlier_ones() {
+  // A timer beyond the wheel armed first, a shorter one after the wheel moved on
+  hostSetMillis(1000);
+  TimerWheel wheel;
+  WheelTimer longTimer, shortTimer;
+  wheel.arm(longTimer, 1000000);
+  hostAdvanceMs(200000);
+  wheel.advance();
+  wheel.arm(shortTimer, 100000);
+
+  uint32_t expires = 0;
+  TEST_ASSERT_TRUE(wheel.nextExpiry(expires));
+  TEST_ASSERT_EQUAL_UINT32(shortTimer.expiry(), expires);
+  TEST_ASSERT_EQUAL_UINT32(100000, wheel.msUntilNext(600000));
+
+  wheel.cancel(shortTimer);
+  TEST_ASSERT_TRUE(wheel.nextExpiry(expires));
+  TEST_ASSERT_EQUAL_UINT32(longTimer.expiry(), expires);
+}
+
+void test_timer_beyond_the_wheel_fires_on_time() {
+  hostSetMillis(0xFFFFFFFFUL - 100000);  // Wraps on the way
+  TimerWheel wheel;
+  WheelTimer timer;
+  wheel.arm(timer, 1000000);
+  uint32_t due = timer.expiry();
+  while (timer.pending()) {
+    hostAdvanceMs(min(wheel.msUntilNext(10000), (uint32_t)10000));
+    wheel.advance();
+  }
+  TEST_ASSERT_EQUAL_UINT32(due, millis());
+}
+
+void fuzz(uint32_t seed, uint32_t startMs) {
+  std::mt19937 rng(seed);
+  const int TIMERS = 300;
+  const int STEPS = 20000;
+  hostSetMillis(startMs);
+  TimerWheel wheel;
+  std::vector<WheelTimer> timers(TIMERS);
+  model.assign(TIMERS, Model());
+  for (int i = 0; i < TIMERS; i++) {
+    timers[i] = WheelTimer(onFire, &model[i]);
+  }
+
+  uint32_t wrongNext = 0, early = 0, late = 0, lost = 0;
+  uint32_t lastAdvance = millis();
+  for (int step = 0; step < STEPS; step++) {
+    int op = rng() % 10;
+    int i = rng() % TIMERS;
+    if (op < 4) {
+      // Mostly protocol-sized delays, some on the upper levels and beyond the wheel
+      uint32_t delay;
+      switch (rng() % 4) {
+        case 0: delay = rng() % 64; break;
+        case 1: delay = rng() % 4096; break;
+        case 2: delay = rng() % 262144; break;
+        default: delay = rng() % 2000000; break;
+      }
+      wheel.arm(timers[i], delay);
+      model[i].armed = true;
+      model[i].fired = false;
+      model[i].due = millis() + delay;
+      if (model[i].due == lastAdvance) {
+        model[i].due++;  // Same rule as TimerWheel::arm()
+      }
+    } else if (op < 5) {
+      wheel.cancel(timers[i]);
+      model[i].armed = false;
+    } else {
+      // Either sleep until the next deadline the wheel reports, as the tasks do, or jump
+      uint32_t next;
+      bool pending = earliest(next);
+      if (op < 8 && pending) {
+        hostAdvanceMs(wheel.msUntilNext(0x7FFFFFFF));
+      } else {
+        hostAdvanceMs((rng() % 3 == 0) ? rng() % 300000 : rng() % 100);
+      }
+      wheel.advance();
+      lastAdvance = millis();
+      for (int j = 0; j < TIMERS; j++) {
+        if (model[j].fired) {
+          if ((int32_t)(model[j].firedAt - model[j].due) < 0) {
+            early++;
+          }
+          model[j].fired = false;
+          model[j].armed = false;
+        } else if (model[j].armed && (int32_t)(millis() - model[j].due) >= 0) {
+          late++;  // Due but not fired by this advance()
+          model[j].armed = false;
+          wheel.cancel(timers[j]);
+        }
+      }
+    }
+
+    uint32_t expected = 0, reported = 0;
+    bool hasExpected = earliest(expected);
+    bool hasReported = wheel.nextExpiry(reported);
+    if (hasExpected != hasReported || (hasExpected && expected != reported)) {
+      wrongNext++;
+    }
+    uint32_t pending = 0;
+    for (int j = 0; j < TIMERS; j++) {
+      pending += model[j].armed;
+      if (model[j].armed != timers[j].pending()) {
+        lost++;
+      }
+    }
+    if (pending != wheel.size()) {
+      lost++;
+    }
+  }
+
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, wrongNext, "nextExpiry() is not the earliest deadline");
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, early, "timer fired before its deadline");
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, late, "timer not fired by the first advance() after its deadline");
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, lost, "pending() or size() disagree with the model");
+}
+
+void test_fuzz_from_boot() {
+  for (uint32_t seed = 1; seed <= 20; seed++) {
+    fuzz(seed, 0);
+  }
+}
+
+void test_fuzz_across_millis_wrap() {
+  for (uint32_t seed = 1; seed <= 20; seed++) {
+    fuzz(seed, 0xFFFFFFFFUL - seed * 100000);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_long_timer_does_not_hide_earlier_ones);
+  RUN_TEST(test_timer_beyond_the_wheel_fires_on_time);
+  RUN_TEST(test_fuzz_from_boot);
+  RUN_TEST(test_fuzz_across_millis_wrap);
+  return UNITY_END();
+}
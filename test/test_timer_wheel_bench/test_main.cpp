@@ -0,0 +1,140 @@
+/**
+ * Timer wheel (timer_wheel.h) cost with fleet-sized timer counts, against
+ * the deadlines it replaced: timestamps compared with millis() on every
+ * pass. Each round re-arms a random timer, cancels another, advances the
+ * clock by a millisecond and asks for the next deadline, which is what the
+ * protocol task does per wake-up.
+ *
+ *   pio test -e native -f test_timer_wheel_bench -v
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "timer_wheel.h"
+
+const int ROUNDS = 200000;
+
+uint32_t fired = 0;
+volatile uint32_t sink;  // Keeps the next-deadline queries from being optimized away
+
+void onFire(WheelTimer &, void *) {
+  fired++;
+}
+
+// The old way: one timestamp per deadline, all of them checked on every pass
+struct ScanTimers {
+  std::vector<uint32_t> due;
+  std::vector<bool> armed;
+
+  explicit ScanTimers(int count) : due(count, 0), armed(count, false) {}
+
+  void arm(int i, uint32_t delayMs) {
+    due[i] = millis() + delayMs;
+    armed[i] = true;
+  }
+  void cancel(int i) { armed[i] = false; }
+
+  // Fire what is due and return the next deadline
+  bool pass(uint32_t &next) {
+    uint32_t now = millis();
+    bool found = false;
+    for (size_t i = 0; i < due.size(); i++) {
+      if (!armed[i]) {
+        continue;
+      }
+      if ((int32_t)(now - due[i]) >= 0) {
+        armed[i] = false;
+        fired++;
+      } else if (!found || (int32_t)(due[i] - next) < 0) {
+        next = due[i];
+        found = true;
+      }
+    }
+    return found;
+  }
+};
+
+uint32_t randomDelay(std::mt19937 &rng) {
+  // Retry intervals, sleep cycles and the odd long persistence timer
+  switch (rng() % 8) {
+    case 0: return 10000 + rng() % 600000;
+    case 1:
+    case 2: return 1000 + rng() % 3000;
+    default: return 5 + rng() % 300;
+  }
+}
+
+double benchWheel(int count) {
+  std::mt19937 rng(count);
+  hostSetMillis(1000);
+  TimerWheel wheel;
+  std::vector<WheelTimer> timers(count, WheelTimer(onFire));
+  for (int i = 0; i < count; i++) {
+    wheel.arm(timers[i], randomDelay(rng));
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int round = 0; round < ROUNDS; round++) {
+    wheel.arm(timers[rng() % count], randomDelay(rng));
+    wheel.cancel(timers[rng() % count]);
+    hostAdvanceMs(1);
+    wheel.advance();
+    uint32_t next = 0;
+    if (wheel.nextExpiry(next)) {
+      sink = next;
+    }
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / ROUNDS;
+}
+
+double benchScan(int count) {
+  std::mt19937 rng(count);
+  hostSetMillis(1000);
+  ScanTimers timers(count);
+  for (int i = 0; i < count; i++) {
+    timers.arm(i, randomDelay(rng));
+  }
+  int rounds = ROUNDS / max(1, count / 100);  // Full scans get slow, run fewer of them
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int round = 0; round < rounds; round++) {
+    timers.arm(rng() % count, randomDelay(rng));
+    timers.cancel(rng() % count);
+    hostAdvanceMs(1);
+    uint32_t next = 0;
+    if (timers.pass(next)) {
+      sink = next;
+    }
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / rounds;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_cost_per_round() {
+  const int counts[] = {10, 100, 1000, 10000};
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    double wheelNs = benchWheel(counts[i]);
+    double scanNs = benchScan(counts[i]);
+    char line[128];
+    snprintf(line, sizeof(line), "%5d timers: wheel %8.1f ns/round, millis() scan %10.1f ns/round",
+             counts[i], wheelNs, scanNs);
+    TEST_MESSAGE(line);
+  }
+}
+
+void test_wheel_beats_scan_for_fleets() {
+  TEST_ASSERT_LESS_THAN(benchScan(1000), benchWheel(1000));
+  TEST_ASSERT_LESS_THAN(benchScan(10000), benchWheel(10000));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_cost_per_round);
+  RUN_TEST(test_wheel_beats_scan_for_fleets);
+  return UNITY_END();
+}
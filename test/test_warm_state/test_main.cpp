@@ -0,0 +1,166 @@
+/**
+ * Warm restart state (warm_state.h) across simulated resets. A byte array
+ * stands in for RTC_NOINIT memory: it keeps its contents when the "device"
+ * resets and holds random bytes after power-on. boot() is the restore path
+ * both firmwares run from setup().
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include <stdlib.h>
+#include "warm_state.h"
+
+const uint16_t STATE_VERSION = 2;
+
+typedef struct {
+  warm_state_header_t header;
+  int8_t activeLedIndex;
+  uint8_t peerCount;
+  uint8_t peers[4][6];
+  uint16_t sequence;
+} test_warm_state_t;
+
+// The next layout version, one field longer
+typedef struct {
+  warm_state_header_t header;
+  int8_t activeLedIndex;
+  uint8_t peerCount;
+  uint8_t peers[4][6];
+  uint16_t sequence;
+  uint32_t schedulePhase;
+} test_warm_state_v3_t;
+
+// RTC_NOINIT memory, large enough for either layout
+union {
+  test_warm_state_t v2;
+  test_warm_state_v3_t v3;
+  uint8_t bytes[sizeof(test_warm_state_v3_t)];
+} rtc;
+
+// What the firmware runs with after boot()
+struct Runtime {
+  bool restored;
+  int8_t activeLedIndex;
+  uint8_t peerCount;
+  uint16_t sequence;
+};
+
+void powerOn() {
+  for (size_t i = 0; i < sizeof(rtc.bytes); i++) {
+    rtc.bytes[i] = rand();
+  }
+}
+
+Runtime boot() {
+  Runtime runtime = {false, -1, 0, 0};
+  if (warmStateValid(rtc.v2, STATE_VERSION)) {
+    runtime.restored = true;
+    runtime.activeLedIndex = rtc.v2.activeLedIndex;
+    runtime.peerCount = rtc.v2.peerCount;
+    runtime.sequence = rtc.v2.sequence;
+  }
+  return runtime;
+}
+
+void saveRunning(int8_t ledIndex, uint8_t peerCount, uint16_t sequence) {
+  rtc.v2.activeLedIndex = ledIndex;
+  rtc.v2.peerCount = peerCount;
+  memset(rtc.v2.peers, 0, sizeof(rtc.v2.peers));
+  for (int i = 0; i < peerCount; i++) {
+    rtc.v2.peers[i][5] = i + 1;
+  }
+  rtc.v2.sequence = sequence;
+  warmStateSeal(rtc.v2, STATE_VERSION);
+}
+
+void setUp() {
+  srand(1);
+  powerOn();
+}
+
+void tearDown() {}
+
+void test_power_on_garbage_is_rejected() {
+  for (int i = 0; i < 10000; i++) {
+    powerOn();
+    TEST_ASSERT_FALSE(boot().restored);
+  }
+}
+
+void test_valid_state_is_restored_after_reset() {
+  saveRunning(2, 3, 4711);
+  Runtime runtime = boot();  // Reset: RAM is gone, rtc is not
+  TEST_ASSERT_TRUE(runtime.restored);
+  TEST_ASSERT_EQUAL_INT(2, runtime.activeLedIndex);
+  TEST_ASSERT_EQUAL_UINT8(3, runtime.peerCount);
+  TEST_ASSERT_EQUAL_UINT16(4711, runtime.sequence);
+
+  // Restoring does not consume the state, a reset loop keeps restoring it
+  TEST_ASSERT_TRUE(boot().restored);
+}
+
+void test_latest_seal_wins() {
+  saveRunning(0, 1, 1);
+  saveRunning(1, 2, 2);
+  Runtime runtime = boot();
+  TEST_ASSERT_TRUE(runtime.restored);
+  TEST_ASSERT_EQUAL_INT(1, runtime.activeLedIndex);
+  TEST_ASSERT_EQUAL_UINT16(2, runtime.sequence);
+}
+
+void test_crc_failure_is_rejected() {
+  saveRunning(2, 3, 4711);
+  for (size_t i = sizeof(warm_state_header_t); i < sizeof(test_warm_state_t); i++) {
+    for (int bit = 0; bit < 8; bit++) {
+      rtc.bytes[i] ^= 1 << bit;
+      TEST_ASSERT_FALSE(boot().restored);
+      rtc.bytes[i] ^= 1 << bit;
+    }
+  }
+  TEST_ASSERT_TRUE(boot().restored);
+}
+
+void test_write_torn_by_reset_is_rejected() {
+  // A reset between changing a field and sealing leaves a stale CRC
+  saveRunning(2, 3, 4711);
+  rtc.v2.activeLedIndex = 0;
+  TEST_ASSERT_FALSE(boot().restored);
+}
+
+void test_version_bump_is_rejected() {
+  // Same layout written by firmware that declared another version
+  saveRunning(2, 3, 4711);
+  warmStateSeal(rtc.v2, STATE_VERSION + 1);
+  TEST_ASSERT_FALSE(boot().restored);
+
+  // Newer firmware with a longer layout left its state behind
+  rtc.v3.schedulePhase = 1234;
+  warmStateSeal(rtc.v3, STATE_VERSION);
+  TEST_ASSERT_FALSE(boot().restored);
+  TEST_ASSERT_TRUE(warmStateValid(rtc.v3, STATE_VERSION));
+}
+
+void test_invalidated_state_is_rejected() {
+  saveRunning(2, 3, 4711);
+  warmStateInvalidate(rtc.v2);
+  TEST_ASSERT_FALSE(boot().restored);
+}
+
+void test_crc_matches_reference() {
+  // CRC-32 (IEEE) check value
+  const char *check = "123456789";
+  TEST_ASSERT_EQUAL_UINT32(0xCBF43926, warmStateCrc((const uint8_t *)check, 9));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_power_on_garbage_is_rejected);
+  RUN_TEST(test_valid_state_is_restored_after_reset);
+  RUN_TEST(test_latest_seal_wins);
+  RUN_TEST(test_crc_failure_is_rejected);
+  RUN_TEST(test_write_torn_by_reset_is_rejected);
+  RUN_TEST(test_version_bump_is_rejected);
+  RUN_TEST(test_invalidated_state_is_rejected);
+  RUN_TEST(test_crc_matches_reference);
+  return UNITY_END();
+}
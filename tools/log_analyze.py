@@ -0,0 +1,342 @@
+#!/usr/bin/env python3
+"""
+ESP32 ESP-NOW LED Indicator System - serial log analyzer
+
+Reads timestamped serial logs of a sender and its indicator, matches the
+commands the sender logs against what the indicator logs about them, and
+reports command latency, retries per delivery, missed commands and the
+indicator's sleep/wake cycles. Files are streamed and merged by timestamp,
+so multi-hour captures need little memory. Which device wrote a file does
+not matter, both print different lines.
+
+    python3 tools/log_analyze.py sender.log indicator.log
+
+Timestamps come from the capture program and are expected at the start of
+each line, as "HH:MM:SS[.fff]" (optionally after a date, in brackets or
+followed by " >" like pio device monitor --filter time) or as seconds since
+the epoch. Lines without one take the time of the event before. One-way
+latencies need both logs captured against the same clock.
+"""
+
+import argparse
+import heapq
+import re
+import sys
+from collections import deque
+from datetime import date
+
+TIMESTAMP = re.compile(r"^\[?(?:(\d{4})-(\d{2})-(\d{2})[ T])?(\d{1,2}):(\d{2}):(\d{2}(?:\.\d+)?)\]?|^\[?(\d{9,10}(?:\.\d+)?)\]?")
+DAY = 24 * 3600.0
+
+MATCH_WINDOW_S = 30.0    # Longest a command may take from the first send to the indicator
+CLOCK_SLACK_S = 1.0      # Indicator lines may carry a slightly earlier time than the send
+
+# Sender lines
+SEND = re.compile(r"Sending command to activate LED index: (\d+)")
+ACK_RECEIVED = "Received acknowledgment"
+ACK_CONFIRMED = re.compile(r"Confirmed LED index: (\d+)")
+FORCED = "after maximum retries"   # "Forcing progression" or "Backing off", depending on the firmware
+REPLACED = "replaced before delivery"
+NEXT_LED = "Moving to next LED"
+SENDER_BOOT = "SENDER MODE"
+
+# Indicator lines
+RECEIVED = re.compile(r"Received LED command: (\d+)")
+ACK_SENT = re.compile(r"Acknowledgment (\d+) sent successfully")
+ACK_DELIVERED = re.compile(r"Acknowledgment for LED index (\d+) delivered")
+ACK_GAVE_UP = re.compile(r"Completed acknowledgments for LED index: (\d+)")
+SLEEP = re.compile(r"Entering light sleep for (\d+) ms")
+WOKE = "Woke up from light sleep"
+HINT_MISSED = "Hinted transmission missed"
+EXTENDED_AWAKE = "Forcing extended awake period"
+INDICATOR_BOOT = "INDICATOR MODE"
+
+# Every line above contains one of these, the rest of the log is skipped unparsed
+KEYWORDS = re.compile(r"LED|cknowledg|Forcing|light sleep|Hinted|MODE")
+
+
+def read_events(path, wanted=KEYWORDS):
+    """Yields (seconds, line) of the lines matching wanted, seconds is None until the first timestamp."""
+    stream = sys.stdin if path == "-" else open(path, errors="replace")
+    last = None
+    offset = 0.0  # Days added to time-only stamps after midnight
+    with stream:
+        for line in stream:
+            if wanted.search(line) is None:
+                continue
+            match = TIMESTAMP.match(line)
+            if match is not None:
+                year, month, day, hours, minutes, seconds, epoch = match.groups()
+                if epoch is not None:
+                    t = float(epoch)
+                else:
+                    t = int(hours) * 3600 + int(minutes) * 60 + float(seconds)
+                    if year is not None:
+                        t += date(int(year), int(month), int(day)).toordinal() * DAY
+                    elif last is not None and t + offset < last - DAY / 2:
+                        offset += DAY
+                    t += offset
+                last = t
+            yield last, line
+
+
+class Command:
+    def __init__(self, index, t):
+        self.index = index
+        self.first_send = t
+        self.sends = 1
+        self.acked = None       # Time of the first acknowledgment at the sender
+        self.forced = False
+        self.replaced = False   # A newer state was requested before this one got through
+        self.received = None    # Time the indicator first logged it
+        self.receipts = 0
+
+
+class Stats:
+    def __init__(self):
+        self.commands = deque(maxlen=16)  # Recent commands, indicator lines are matched against them
+        self.current = None
+        self.closed = []                  # Finished commands, reduced to what the report needs
+        self.ack_pending = False
+        self.sender_boots = 0
+        self.indicator_boots = 0
+        self.unmatched_receipts = 0
+        self.ack_attempts = []
+        self.ack_attempt = 0
+        self.acks_undelivered = 0
+        self.sleep_requested = []
+        self.sleep_actual = []
+        self.awake = []
+        self.sleep_start = None
+        self.sleep_ms = None
+        self.woke_at = None
+        self.hints_missed = 0
+        self.extended_awake = 0
+        self.untimed = 0
+
+    # Sender
+
+    def close(self, command):
+        # (sends, ack latency or None, gave up, one-way latency or None, receipts, replaced)
+        self.closed.append((command.sends, None if command.acked is None else command.acked - command.first_send,
+                            command.forced, None if command.received is None else command.received - command.first_send,
+                            command.receipts, command.replaced))
+
+    def finish(self):
+        for command in self.commands:
+            self.close(command)
+        self.commands.clear()
+        self.current = None
+
+    def send(self, t, index):
+        current = self.current
+        if current is not None and current.index == index and current.acked is None and not current.forced:
+            current.sends += 1
+            return
+        if len(self.commands) == self.commands.maxlen:
+            self.close(self.commands[0])
+        self.current = Command(index, t)
+        self.commands.append(self.current)
+
+    def confirmed(self, t, index):
+        current = self.current
+        if current is not None and current.index == index and current.acked is None:
+            current.acked = t
+
+    def forced(self):
+        if self.current is not None:
+            self.current.forced = True
+
+    def replaced(self):
+        if self.current is not None:
+            self.current.replaced = True
+
+    # Indicator
+
+    def received(self, t, index):
+        self.record_ack_attempts()
+        for command in reversed(self.commands):
+            if command.index == index and command.first_send - CLOCK_SLACK_S <= t <= command.first_send + MATCH_WINDOW_S:
+                command.receipts += 1
+                if command.received is None:
+                    command.received = t
+                return
+        self.unmatched_receipts += 1
+
+    def record_ack_attempts(self):
+        if self.ack_attempt:
+            self.ack_attempts.append(self.ack_attempt)
+            self.ack_attempt = 0
+
+    def sleep(self, t, ms):
+        if self.woke_at is not None:
+            self.awake.append(t - self.woke_at)
+        self.sleep_start = t
+        self.sleep_ms = ms
+        self.woke_at = None
+
+    def woke(self, t):
+        if self.sleep_start is not None:
+            self.sleep_requested.append(self.sleep_ms / 1000.0)
+            self.sleep_actual.append(t - self.sleep_start)
+        self.sleep_start = None
+        self.woke_at = t
+
+    def indicator_boot(self):
+        self.indicator_boots += 1
+        self.record_ack_attempts()
+        self.sleep_start = None
+        self.woke_at = None
+
+
+def analyze(stats, lines):
+    for t, line in lines:
+        if t is None:
+            stats.untimed += 1
+            continue
+        # Cheap substring tests first, nearly every line is something else
+        if "LED" in line:
+            if "Sending command" in line:
+                match = SEND.search(line)
+                if match:
+                    stats.send(t, int(match.group(1)))
+            elif "Confirmed LED index" in line:
+                match = ACK_CONFIRMED.search(line)
+                if match and stats.ack_pending:
+                    stats.confirmed(t, int(match.group(1)))
+                stats.ack_pending = False
+            elif "Received LED command" in line:
+                match = RECEIVED.search(line)
+                if match:
+                    stats.received(t, int(match.group(1)))
+            elif ACK_DELIVERED.search(line):
+                stats.record_ack_attempts()
+            elif ACK_GAVE_UP.search(line):
+                stats.acks_undelivered += 1
+                stats.record_ack_attempts()
+            elif NEXT_LED in line:
+                stats.current = None
+            elif REPLACED in line:
+                stats.replaced()
+            elif FORCED in line:
+                stats.forced()
+        elif ACK_RECEIVED in line:
+            stats.ack_pending = True
+        elif "sent successfully" in line:
+            match = ACK_SENT.search(line)
+            if match:
+                stats.ack_attempt = max(stats.ack_attempt, int(match.group(1)))
+        elif FORCED in line:
+            stats.forced()
+        elif "light sleep" in line:
+            match = SLEEP.search(line)
+            if match:
+                stats.sleep(t, int(match.group(1)))
+            elif WOKE in line:
+                stats.woke(t)
+        elif HINT_MISSED in line:
+            stats.hints_missed += 1
+        elif EXTENDED_AWAKE in line:
+            stats.extended_awake += 1
+        elif SENDER_BOOT in line:
+            stats.sender_boots += 1
+            stats.finish()
+        elif INDICATOR_BOOT in line:
+            stats.indicator_boot()
+    stats.finish()
+    stats.record_ack_attempts()
+
+
+def percentiles(values, scale=1.0, unit="ms"):
+    if not values:
+        return "-"
+    values = sorted(values)
+
+    def at(p):
+        return values[min(len(values) - 1, int(p * len(values)))] * scale
+
+    return "p50 %.0f %s  p90 %.0f %s  p99 %.0f %s  max %.0f %s  (n=%d)" % (
+        at(0.5), unit, at(0.9), unit, at(0.99), unit, values[-1] * scale, unit, len(values))
+
+
+def distribution(values, top):
+    counts = {}
+    for value in values:
+        key = min(value, top)
+        counts[key] = counts.get(key, 0) + 1
+    return "  ".join("%s%s:%d" % (key, "+" if key == top else "", counts[key]) for key in sorted(counts))
+
+
+def percent(part, whole):
+    return "%d (%.1f%%)" % (part, 100.0 * part / whole) if whole else str(part)
+
+
+def report(stats):
+    commands = stats.closed
+    rows = []
+    if commands:
+        delivered = [c for c in commands if c[1] is not None]
+        forced = [c for c in commands if c[2]]
+        replaced = [c for c in commands if c[5] and c[1] is None and not c[2]]
+        seen = [c for c in commands if c[3] is not None]
+        rows += [
+            ("Commands", ""),
+            ("  sent", str(len(commands))),
+            ("  acknowledged", percent(len(delivered), len(commands))),
+            ("  missed (max retries)", percent(len(forced), len(commands))),
+            ("  replaced undelivered", percent(len(replaced), len(commands))),
+            ("  still open at the end", str(len(commands) - len(delivered) - len(forced) - len(replaced))),
+            ("  sends per delivery", "avg %.2f  %s" % (sum(c[0] for c in delivered) / float(len(delivered)),
+                                                     distribution([c[0] for c in delivered], 5))
+             if delivered else "-"),
+            ("  ack latency", percentiles([c[1] for c in delivered], 1000.0)),
+        ]
+        if seen or stats.ack_attempts:
+            lost_acks = [c for c in forced if c[3] is not None]
+            rows += [
+                ("Indicator", ""),
+                ("  commands received", percent(len(seen), len(commands))),
+                ("  missed but received", "%d (acknowledgments lost)" % len(lost_acks)),
+                ("  repeated receipts", str(sum(c[4] - 1 for c in seen))),
+                ("  one-way latency", percentiles([c[3] for c in seen], 1000.0)),
+                ("  ack attempts", distribution(stats.ack_attempts, 5) or "-"),
+                ("  acks undelivered", str(stats.acks_undelivered)),
+                ("  unmatched receipts", str(stats.unmatched_receipts)),
+            ]
+    if stats.sleep_actual or stats.awake:
+        overslept = [a - r for a, r in zip(stats.sleep_actual, stats.sleep_requested)]
+        rows += [
+            ("Wake cycles", ""),
+            ("  sleeps", str(len(stats.sleep_actual))),
+            ("  sleep requested", percentiles(stats.sleep_requested, 1000.0)),
+            ("  sleep actual", percentiles(stats.sleep_actual, 1000.0)),
+            ("  past the request", percentiles(overslept, 1000.0)),
+            ("  awake periods", percentiles(stats.awake, 1000.0)),
+            ("  hints missed", str(stats.hints_missed)),
+            ("  extended awake", str(stats.extended_awake)),
+        ]
+    if not rows:
+        print("No command or sleep lines found")
+        return
+    rows.append(("Boots", "sender %d, indicator %d" % (stats.sender_boots, stats.indicator_boots)))
+    width = max(len(label) for label, _ in rows)
+    for label, value in rows:
+        print(("%-*s  %s" % (width, label, value)).rstrip())
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Command latency and loss from sender and indicator serial logs")
+    parser.add_argument("logs", nargs="*", default=["-"], help="log files (default: standard input)")
+    args = parser.parse_args()
+
+    stats = Stats()
+    # Lines before the first timestamp of a file sort first and are skipped
+    analyze(stats, heapq.merge(*(read_events(path) for path in args.logs),
+                               key=lambda event: float("-inf") if event[0] is None else event[0]))
+    report(stats)
+    if stats.untimed:
+        print("%d line(s) before the first timestamp skipped" % stats.untimed)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+"""
+ESP32 ESP-NOW LED Indicator System - telemetry decoder
+
+Reads serial logs of senders (which forward every telemetry record their
+indicators send) or of indicators built with -D TELEMETRY_SERIAL, decodes
+the "TLM <mac> <hex>" lines and summarizes each indicator: latest state,
+lost records, reboots and link figures. Lines may carry any prefix, and
+several logs can be given at once to cover an installation with many
+senders. Logs are merged by the timestamps the capture program puts at
+the start of each line (formats as in log_analyze.py), so an indicator
+that moved between senders reads as one history. Logs without timestamps
+are read one after the other.
+
+Records an indicator prints itself (-D TELEMETRY_SERIAL) are numbered
+apart from the ones it sends, and each numbering is followed on its own.
+A sequence that goes back while the uptime does not is a 16-bit wrap, not
+a reboot.
+
+    python3 tools/telemetry_decode.py sender1.log sender2.log
+    python3 tools/telemetry_decode.py --records < capture.log
+
+The record layout mirrors telemetry_t in include/telemetry.h.
+"""
+
+import argparse
+import heapq
+import re
+import struct
+
+from log_analyze import read_events
+
+TELEMETRY_TYPE = 8
+SEQUENCE_MOD = 1 << 16
+LOCAL = 1 << 4  # TELEMETRY_LOCAL: printed by the indicator, numbered apart from the radio records
+FIELDS_V1 = (
+    "type", "version", "sequence", "uptime_s", "active_led", "channel", "flags",
+    "peer_count", "sleep_cycles", "last_command_s", "rx_frames", "tx_ok", "tx_fail",
+    "queue_drops", "pref_writes", "recoveries", "rssi_avg", "rssi_min", "phy_rate",
+    "tx_power_dbm", "skew_ppm",
+)
+FIELDS = FIELDS_V1 + ("duplicates", "tx_errors", "peer_add_fails", "init_fails")
+# Version -> layout, older indicators keep sending their version until updated
+LAYOUTS = {
+    1: (struct.Struct("<BBHIbBBBHHHHHHHHbbBbh"), FIELDS_V1),
+    2: (struct.Struct("<BBHIbBBBHHHHHHHHbbBbhHHHH"), FIELDS),
+}
+FLAGS = ("power-managed", "extended-awake", "warm-restart", "drift-settled", "local")
+RATES = ("1M", "2M", "6M", "12M", "24M", "54M")  # LINK_RATES in include/link_adapter.h
+
+LINE = re.compile(r"TLM ([0-9A-F]{12}) ([0-9A-F]+)")
+
+
+def decode(hex_record):
+    data = bytes.fromhex(hex_record)
+    if len(data) < 2 or data[0] != TELEMETRY_TYPE or data[1] not in LAYOUTS:
+        return None
+    layout, fields = LAYOUTS[data[1]]
+    if len(data) != layout.size:
+        return None
+    record = dict.fromkeys(FIELDS, 0)  # Fields a version lacks read as 0
+    record.update(zip(fields, layout.unpack(data)))
+    return record
+
+
+def format_mac(mac):
+    return ":".join(mac[i:i + 2] for i in range(0, 12, 2))
+
+
+def format_flags(flags):
+    names = [name for bit, name in enumerate(FLAGS) if flags & (1 << bit)]
+    return ",".join(names) if names else "-"
+
+
+class Indicator:
+    def __init__(self, mac):
+        self.mac = mac
+        self.records = 0
+        self.lost = 0
+        self.reboots = {}    # Per numbering, radio or local
+        self.latest = {}     # Last record of each numbering
+        self.last = None
+        self.rssi_min = None
+        self.rssi_sum = 0
+        self.rssi_count = 0
+
+    def add(self, record):
+        numbering = record["flags"] & LOCAL
+        last = self.latest.get(numbering)
+        if last is not None:
+            ahead = (record["sequence"] - last["sequence"]) % SEQUENCE_MOD  # Across a wrap too
+            if record["uptime_s"] < last["uptime_s"]:
+                self.reboots[numbering] = self.reboots.get(numbering, 0) + 1
+            elif ahead == 0:
+                return  # Same record seen through another sender
+            elif ahead >= SEQUENCE_MOD // 2:
+                return  # Older than the last one, from a log whose clock runs ahead
+            else:
+                self.lost += ahead - 1
+        self.records += 1
+        self.latest[numbering] = record
+        self.last = record
+        if record["rssi_avg"] != 0:
+            self.rssi_sum += record["rssi_avg"]
+            self.rssi_count += 1
+            self.rssi_min = record["rssi_min"] if self.rssi_min is None else min(self.rssi_min, record["rssi_min"])
+
+    def summary(self):
+        r = self.last
+        sent = r["tx_ok"] + r["tx_fail"]
+        delivery = "%.1f%%" % (100.0 * r["tx_ok"] / sent) if sent else "-"
+        rssi = "%.0f/%d dBm" % (self.rssi_sum / self.rssi_count, self.rssi_min) if self.rssi_count else "-"
+        rate = RATES[r["phy_rate"]] if r["phy_rate"] < len(RATES) else "?"
+        return [
+            format_mac(self.mac),
+            str(self.records),
+            str(self.lost),
+            str(max(self.reboots.values()) if self.reboots else 0),  # Both numberings see the same reboots
+            "%.1fh" % (r["uptime_s"] / 3600.0),
+            str(r["active_led"]) if r["active_led"] >= 0 else "-",
+            str(r["channel"]),
+            delivery,
+            rssi,
+            "%s/%ddBm" % (rate, r["tx_power_dbm"]),
+            str(r["sleep_cycles"]),
+            str(r["queue_drops"]),
+            str(r["tx_errors"]),
+            str(r["duplicates"]),
+            str(r["recoveries"]),
+            format_flags(r["flags"]),
+        ]
+
+
+HEADER = ["indicator", "records", "lost", "reboots", "uptime", "led", "ch", "delivery",
+          "rssi avg/min", "rate/power", "sleeps", "drops", "txerr", "dupes", "recov", "flags"]
+
+
+def read_lines(paths):
+    # Lines before the first timestamp of a log sort first, untimed logs keep their order
+    return (line for _, line in heapq.merge(*(read_events(path, LINE) for path in paths or ["-"]),
+                                            key=lambda event: float("-inf") if event[0] is None else event[0]))
+
+
+def print_table(rows):
+    widths = [max(len(row[i]) for row in rows) for i in range(len(rows[0]))]
+    for row in rows:
+        print("  ".join(cell.ljust(width) for cell, width in zip(row, widths)).rstrip())
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode indicator telemetry from serial logs")
+    parser.add_argument("logs", nargs="*", help="log files (default: standard input)")
+    parser.add_argument("--records", action="store_true", help="print every record as CSV")
+    args = parser.parse_args()
+
+    indicators = {}
+    invalid = 0
+    if args.records:
+        print("mac," + ",".join(FIELDS[2:]))
+    for line in read_lines(args.logs):
+        match = LINE.search(line)
+        if match is None:
+            continue
+        record = decode(match.group(2))
+        if record is None:
+            invalid += 1
+            continue
+        mac = match.group(1)
+        if args.records:
+            print(format_mac(mac) + "," + ",".join(str(record[name]) for name in FIELDS[2:]))
+        if mac not in indicators:
+            indicators[mac] = Indicator(mac)
+        indicators[mac].add(record)
+
+    if args.records:
+        return
+    if not indicators:
+        print("No telemetry found")
+    else:
+        print_table([HEADER] + [indicators[mac].summary() for mac in sorted(indicators)])
+    if invalid:
+        print("%d line(s) with an unknown record version or length skipped" % invalid)
+
+
+if __name__ == "__main__":
+    main()
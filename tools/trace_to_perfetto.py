@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""
+ESP32 ESP-NOW LED Indicator System - state trace converter
+
+Reads serial logs of firmware built with -D STATE_TRACE and writes the
+"TRC" transition lines as Chrome trace JSON, which ui.perfetto.dev and
+chrome://tracing open as a timeline. Every log becomes one process per
+boot, every state machine one track on it, and every state one slice from
+the transition into it to the transition out of it. Lines may carry any
+prefix, e.g. a timestamp added by the capture program.
+
+    python3 tools/trace_to_perfetto.py indicator.log sender.log -o trace.json
+
+The line format is described in include/state_trace.h.
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+LINE = re.compile(r"TRC (\d+) (\d+) (\d+) (\d+) (\S+) (\S+) (\S+)")
+WRAP = 1 << 32  # micros() and CCOUNT are 32 bits
+
+
+class Boot:
+    def __init__(self, pid, label):
+        self.pid = pid
+        self.label = label
+        self.tracks = {}   # machine -> tid
+        self.open = {}     # machine -> (state, start us, args) of the slice in progress
+        self.last_us = None
+        self.last_seq = None
+        self.last_cycles = {}  # core -> CCOUNT of the previous transition
+        self.lost = 0
+
+    def track(self, machine, events):
+        if machine not in self.tracks:
+            tid = len(self.tracks) + 1
+            self.tracks[machine] = tid
+            events.append({"ph": "M", "name": "thread_name", "pid": self.pid, "tid": tid,
+                           "args": {"name": machine}})
+        return self.tracks[machine]
+
+    def add(self, seq, us, cycles, core, machine, old, new, events):
+        if self.last_us is not None:
+            # Transitions recorded on both cores can come a few microseconds out of order
+            while us < self.last_us - WRAP // 2:
+                us += WRAP
+        if self.last_seq is not None and seq > self.last_seq + 1:
+            missing = seq - self.last_seq - 1
+            self.lost += missing
+            events.append({"ph": "i", "s": "p", "name": "%d transition(s) overwritten" % missing,
+                           "pid": self.pid, "tid": 0, "ts": us})
+        self.last_seq = seq
+        self.last_us = max(us, self.last_us or 0)
+
+        args = {"seq": seq, "core": core, "from": old, "ccount": cycles}
+        if core in self.last_cycles:
+            args["cycles_since_previous"] = (cycles - self.last_cycles[core]) % WRAP
+        self.last_cycles[core] = cycles
+
+        tid = self.track(machine, events)
+        self.close(machine, us, events)
+        self.open[machine] = (new, us, args)
+        return tid
+
+    def close(self, machine, us, events):
+        if machine in self.open:
+            state, start, args = self.open.pop(machine)
+            events.append({"ph": "X", "name": state, "pid": self.pid, "tid": self.tracks[machine],
+                           "ts": start, "dur": max(us - start, 0), "args": args})
+
+    def finish(self, events):
+        # States still active when the log ends run up to the last transition seen
+        for machine in list(self.open):
+            self.close(machine, self.last_us, events)
+
+
+def convert(paths, events):
+    boots = []
+    for path in paths:
+        name = os.path.basename(path) if path != "-" else "stdin"
+        stream = sys.stdin if path == "-" else open(path, errors="replace")
+        boot = None
+        with stream:
+            for line in stream:
+                match = LINE.search(line)
+                if match is None:
+                    continue
+                seq, us, cycles, core = (int(value) for value in match.groups()[:4])
+                machine, old, new = match.groups()[4:]
+                if boot is None or seq <= boot.last_seq:
+                    if boot is not None:
+                        boot.finish(events)
+                    count = sum(1 for b in boots if b.label.startswith(name + " "))
+                    boot = Boot(len(boots) + 1, "%s boot %d" % (name, count + 1))
+                    boots.append(boot)
+                    events.append({"ph": "M", "name": "process_name", "pid": boot.pid,
+                                   "args": {"name": boot.label}})
+                boot.add(seq, us, cycles, core, machine, old, new, events)
+        if boot is not None:
+            boot.finish(events)
+    return boots
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert state transition traces to Chrome/Perfetto JSON")
+    parser.add_argument("logs", nargs="*", default=["-"], help="log files (default: standard input)")
+    parser.add_argument("-o", "--output", help="JSON file to write (default: standard output)")
+    args = parser.parse_args()
+
+    events = []
+    boots = convert(args.logs, events)
+    if not boots:
+        sys.exit("No TRC lines found, was the firmware built with -D STATE_TRACE?")
+
+    trace = {"traceEvents": events, "displayTimeUnit": "ms"}
+    if args.output:
+        with open(args.output, "w") as out:
+            json.dump(trace, out)
+    else:
+        json.dump(trace, sys.stdout)
+        sys.stdout.write("\n")
+
+    for boot in boots:
+        transitions = sum(1 for event in events if event["pid"] == boot.pid and event["ph"] == "X")
+        lost = ", %d overwritten" % boot.lost if boot.lost else ""
+        print("%s: %d state slice(s) on %d machine(s)%s" % (boot.label, transitions, len(boot.tracks), lost),
+              file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()